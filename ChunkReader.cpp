@@ -0,0 +1,191 @@
+#include "ChunkReader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+
+namespace ospray {
+  namespace tamr {
+
+    IOMode parseIOMode(const std::string &name)
+    {
+      if (name.empty() || name == "mmap")
+        return IOMode::Mmap;
+      if (name == "populate")
+        return IOMode::Populate;
+      if (name == "prefetch")
+        return IOMode::Prefetch;
+      if (name == "pread")
+        return IOMode::Pread;
+      throw std::runtime_error("unknown io mode '" + name + "'");
+    }
+
+    const char *toString(IOMode mode)
+    {
+      switch (mode) {
+      case IOMode::Populate:
+        return "populate";
+      case IOMode::Prefetch:
+        return "prefetch";
+      case IOMode::Pread:
+        return "pread";
+      default:
+        return "mmap";
+      }
+    }
+
+    ChunkReader::ChunkReader(const FileName &fileName,
+                             IOMode mode,
+                             size_t chunkBytes,
+                             int depth,
+                             HugePageMode hugePages)
+        : fileName(fileName),
+          mode(mode),
+          chunkBytes(std::max(chunkBytes, size_t(1))),
+          prefetchDepth(depth - 1)
+    {
+      fd = open(fileName.c_str(), O_RDONLY);
+      if (fd == -1) {
+        perror(fileName.c_str());
+        return;
+      }
+      struct stat statBuf = {0};
+      fstat(fd, &statBuf);
+      size      = statBuf.st_size;
+      numChunks = (size + this->chunkBytes - 1) / this->chunkBytes;
+
+      if (mode == IOMode::Pread) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        bufferBytes.resize(depth);
+        for (int i = 0; i < depth; ++i)
+          buffers.emplace_back(std::min(this->chunkBytes, size), hugePages);
+        reader = std::thread([this]() { readerLoop(); });
+        return;
+      }
+
+      if (size == 0)
+        return;
+
+      const int flags = MAP_PRIVATE | (mode == IOMode::Populate ? MAP_POPULATE : 0);
+      mapping = mmap(NULL, size, PROT_READ, flags, fd, 0);
+      if (mapping == MAP_FAILED) {
+        perror("mapping file");
+        mapping = nullptr;
+        close(fd);
+        fd = -1;
+        return;
+      }
+      if (mode == IOMode::Prefetch)
+        madvise(mapping, size, MADV_SEQUENTIAL);
+      // only takes effect on kernels with read-only THP for file mappings
+      adviseHugePages(mapping, size, hugePages);
+    }
+
+    ChunkReader::~ChunkReader()
+    {
+      if (reader.joinable()) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stop = true;
+        }
+        cond.notify_all();
+        reader.join();
+      }
+      if (mapping)
+        munmap(mapping, size);
+      if (fd != -1)
+        close(fd);
+    }
+
+    void ChunkReader::readerLoop()
+    {
+      const size_t depth = buffers.size();
+      for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cond.wait(lock, [&]() { return stop || chunk - released < depth; });
+          if (stop)
+            return;
+        }
+
+        // the slot is free, fill it without holding the lock
+        const size_t slot   = chunk % depth;
+        const size_t offset = chunk * chunkBytes;
+        const size_t bytes  = std::min(chunkBytes, size - offset);
+        size_t done         = 0;
+        while (done < bytes) {
+          const ssize_t n =
+              pread(fd, (char *)buffers[slot].data() + done, bytes - done, offset + done);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n <= 0)
+            break;
+          done += n;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (done != bytes) {
+            failedChunk = chunk;
+            cond.notify_all();
+            return;
+          }
+          bufferBytes[slot] = done;
+          produced++;
+        }
+        cond.notify_all();
+      }
+    }
+
+    const void *ChunkReader::next(size_t &bytes)
+    {
+      bytes = 0;
+      if (fd == -1 || nextChunk >= numChunks)
+        return nullptr;
+
+      const size_t chunk = nextChunk++;
+
+      if (mode != IOMode::Pread) {
+        const size_t offset = chunk * chunkBytes;
+        bytes               = std::min(chunkBytes, size - offset);
+        char *base          = static_cast<char *>(mapping);
+        if (mode == IOMode::Prefetch) {
+          // ask the kernel to start reading the chunks after this one
+          const size_t ahead = offset + bytes;
+          if (ahead < size) {
+            const size_t aheadBytes =
+                std::min(size - ahead, prefetchDepth * chunkBytes);
+            madvise(base + ahead, aheadBytes, MADV_WILLNEED);
+          }
+          // pages behind us won't be touched again
+          if (chunk > 0)
+            madvise(base + offset - chunkBytes, chunkBytes, MADV_DONTNEED);
+        }
+        return base + offset;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      // the chunk handed out last time is done with now
+      released = chunk;
+      cond.notify_all();
+      cond.wait(lock,
+                [&]() { return produced > chunk || failedChunk <= chunk; });
+      if (produced <= chunk) {
+        // a short read would otherwise look like the end of the file
+        throw std::runtime_error("failed to read chunk " + std::to_string(chunk)
+                                 + " of " + fileName.str());
+      }
+      const size_t slot = chunk % buffers.size();
+      bytes             = bufferBytes[slot];
+      return buffers[slot].data();
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,95 @@
+#ifndef CHUNKREADER_H_
+#define CHUNKREADER_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HugePages.h"
+#include "ospcommon/FileName.h"
+
+using namespace ospcommon;
+
+namespace ospray {
+  namespace tamr {
+
+    /*! how input files are brought into memory.
+      Mmap:     plain MAP_PRIVATE mapping, pages fault in on first touch
+      Populate: MAP_POPULATE, the kernel reads the whole file up front
+      Prefetch: mapping plus MADV_SEQUENTIAL, and MADV_WILLNEED on the
+                chunks ahead of the one being processed
+      Pread:    a reader thread preads large chunks into a ring of
+                buffers ahead of the consumer */
+    enum class IOMode
+    {
+      Mmap,
+      Populate,
+      Prefetch,
+      Pread
+    };
+
+    IOMode parseIOMode(const std::string &name);
+    const char *toString(IOMode mode);
+
+    /*! sequential chunk-by-chunk reader over one file, reading ahead of
+      the consumer so disk reads overlap with processing. A 'chunkBytes'
+      of 0 is taken as 1 */
+    class ChunkReader
+    {
+     public:
+      ChunkReader(const FileName &fileName,
+                  IOMode mode,
+                  size_t chunkBytes,
+                  int depth                = 3,
+                  HugePageMode hugePages = HugePageMode::Off);
+      ~ChunkReader();
+
+      bool valid() const
+      {
+        return fd != -1;
+      }
+
+      size_t fileSize() const
+      {
+        return size;
+      }
+
+      /*! returns the next chunk and its size, or nullptr at the end of
+        the file. The data stays valid until the next call. Throws if
+        the file can't be read to its end */
+      const void *next(size_t &bytes);
+
+     private:
+      void readerLoop();
+
+      FileName fileName;
+      IOMode mode;
+      int fd{-1};
+      size_t size{0};
+      size_t chunkBytes;
+      size_t numChunks{0};
+      size_t nextChunk{0};
+
+      // Mmap, Populate, Prefetch
+      void *mapping{nullptr};
+      int prefetchDepth;
+
+      // Pread ring buffer
+      std::vector<HugePageBuffer> buffers;
+      std::vector<size_t> bufferBytes;
+      size_t produced{0};
+      //! chunks the consumer is done with, their buffers can be refilled
+      size_t released{0};
+      bool stop{false};
+      //! the chunk a read failed on; the reader stops there
+      size_t failedChunk{size_t(-1)};
+      std::mutex mutex;
+      std::condition_variable cond;
+      std::thread reader;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,279 @@
+#include "FieldStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIELDSTATS_X86 1
+#include <immintrin.h>
+#endif
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    // small enough that an io chunk is spread over all workers
+    static const size_t BLOCK_SIZE  = size_t(1) << 16;
+    static const size_t NUM_CLASSES = size_t(1) << 16;
+
+    // keys of -inf and +inf; NaNs fall outside them
+    static const uint32 NEG_INF_KEY = 0x007fffffu;
+    static const uint32 POS_INF_KEY = 0xff800000u;
+
+    // flips negative floats entirely and positive ones' sign bit, so the
+    // keys sort like the values
+    static inline uint32 orderedKey(float f)
+    {
+      int32_t bits;
+      memcpy(&bits, &f, sizeof(bits));
+      return uint32(bits ^ ((bits >> 31) | int32_t(0x80000000)));
+    }
+
+    static inline float fromKey(uint32 key)
+    {
+      const uint32 bits = (key & 0x80000000u) ? (key & 0x7fffffffu) : ~key;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      return f;
+    }
+
+    static void orderedKeysScalar(const float *values, size_t n, uint32 *keys)
+    {
+      for (size_t i = 0; i < n; ++i)
+        keys[i] = orderedKey(values[i]);
+    }
+
+#ifdef FIELDSTATS_X86
+    __attribute__((target("avx2"))) static void orderedKeysAVX2(
+        const float *values, size_t n, uint32 *keys)
+    {
+      const __m256i signBit = _mm256_set1_epi32(int(0x80000000));
+      size_t i              = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m256i bits =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+        const __m256i flip =
+            _mm256_or_si256(_mm256_srai_epi32(bits, 31), signBit);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(keys + i),
+                            _mm256_xor_si256(bits, flip));
+      }
+      orderedKeysScalar(values + i, n - i, keys + i);
+    }
+#endif
+
+    static void orderedKeys(const float *values, size_t n, uint32 *keys)
+    {
+#ifdef FIELDSTATS_X86
+      static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+      if (hasAVX2)
+        return orderedKeysAVX2(values, n, keys);
+#endif
+      orderedKeysScalar(values, n, keys);
+    }
+
+    FieldStatsBuilder::Accumulator::Accumulator()
+        : minKey(POS_INF_KEY), maxKey(NEG_INF_KEY), classes(NUM_CLASSES >> 8)
+    {
+    }
+
+    void FieldStatsBuilder::Accumulator::merge(const Accumulator &other)
+    {
+      count += other.count;
+      sum += other.sum;
+      minKey = std::min(minKey, other.minKey);
+      maxKey = std::max(maxKey, other.maxKey);
+      for (size_t g = 0; g < classes.size(); ++g) {
+        if (!other.classes[g])
+          continue;
+        if (!classes[g])
+          classes[g].reset(new uint64[256]());
+        for (size_t c = 0; c < 256; ++c)
+          classes[g][c] += other.classes[g][c];
+      }
+    }
+
+    FieldStats FieldStatsBuilder::Accumulator::stats(size_t numBins) const
+    {
+      FieldStats s;
+      s.count = count;
+      s.histogram.assign(numBins, 0.f);
+      if (count == 0)
+        return s;
+      s.range = range1f(fromKey(minKey), fromKey(maxKey));
+      s.mean  = sum / count;
+      if (numBins == 0)
+        return s;
+
+      const double lower = s.range.lower;
+      const double width = double(s.range.upper) - lower;
+      if (!std::isfinite(width))
+        return s;
+      for (uint32 c = minKey >> 16; c <= (maxKey >> 16); ++c) {
+        const uint64 inClass = classCount(c);
+        if (inClass == 0)
+          continue;
+        const double n = double(inClass);
+        if (width == 0.) {
+          s.histogram[0] += n;
+          continue;
+        }
+        // the class' values, clipped to the range, in bins
+        const uint32 first = std::max(uint32(c << 16), minKey);
+        const uint32 last  = std::min(uint32(c << 16) | 0xffffu, maxKey);
+        const double a     = (fromKey(first) - lower) / width * numBins;
+        const double b     = (fromKey(last) - lower) / width * numBins;
+        const size_t binA  = std::min(size_t(a), numBins - 1);
+        const size_t binB  = std::min(size_t(b), numBins - 1);
+        if (binA == binB) {
+          s.histogram[binA] += n;
+          continue;
+        }
+        // spread evenly over the bins the class spans
+        for (size_t bin = binA; bin <= binB; ++bin) {
+          const double overlap =
+              std::min(b, double(bin + 1)) - std::max(a, double(bin));
+          s.histogram[bin] += n * std::max(overlap, 0.) / (b - a);
+        }
+      }
+      return s;
+    }
+
+    template <typename VALUES_T, typename LEVEL_T>
+    void FieldStatsBuilder::accumulate(size_t n,
+                                       const VALUES_T &gather,
+                                       const LEVEL_T &level)
+    {
+      const size_t numBlocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        const size_t begin = b * BLOCK_SIZE;
+        const size_t count = std::min(BLOCK_SIZE, n - begin);
+        std::vector<float> values;
+        const float *v = gather(begin, count, values);
+        std::vector<uint32> keys(count);
+        orderedKeys(v, count, keys.data());
+
+        std::unique_ptr<LevelAccumulators> local = borrow();
+        Accumulator *acc = nullptr;
+        int accLevel     = 0;
+        for (size_t i = 0; i < count; ++i) {
+          const uint32 key = keys[i];
+          if (key < NEG_INF_KEY || key > POS_INF_KEY)
+            continue;
+          const int l = level(begin + i);
+          if (!acc || l != accLevel) {
+            acc      = &(*local)[l];
+            accLevel = l;
+          }
+          acc->count++;
+          acc->sum += v[i];
+          acc->minKey = std::min(acc->minKey, key);
+          acc->maxKey = std::max(acc->maxKey, key);
+          acc->addToClass(key >> 16);
+        }
+        giveBack(std::move(local));
+      });
+    }
+
+    std::unique_ptr<FieldStatsBuilder::LevelAccumulators>
+    FieldStatsBuilder::borrow()
+    {
+      std::lock_guard<std::mutex> lock(poolMutex);
+      if (pool.empty())
+        return std::unique_ptr<LevelAccumulators>(new LevelAccumulators);
+      std::unique_ptr<LevelAccumulators> local = std::move(pool.back());
+      pool.pop_back();
+      return local;
+    }
+
+    void FieldStatsBuilder::giveBack(std::unique_ptr<LevelAccumulators> local)
+    {
+      std::lock_guard<std::mutex> lock(poolMutex);
+      pool.push_back(std::move(local));
+    }
+
+    const FieldStatsBuilder::LevelAccumulators &FieldStatsBuilder::merged()
+        const
+    {
+      std::lock_guard<std::mutex> lock(poolMutex);
+      for (const auto &local : pool) {
+        for (const auto &l : *local)
+          levels[l.first].merge(l.second);
+      }
+      pool.clear();
+      return levels;
+    }
+
+    void FieldStatsBuilder::add(const float *values,
+                                const Hexahedron *hexes,
+                                size_t n)
+    {
+      accumulate(
+          n,
+          [&](size_t begin, size_t, std::vector<float> &) {
+            return values + begin;
+          },
+          [&](size_t i) { return hexes[i].level; });
+    }
+
+    void FieldStatsBuilder::add(const float *values,
+                                const Hexahedron *hexes,
+                                const uint64 *which,
+                                size_t n)
+    {
+      accumulate(
+          n,
+          [&](size_t begin, size_t count, std::vector<float> &out) {
+            out.resize(count);
+            for (size_t k = 0; k < count; ++k)
+              out[k] = values[which[begin + k]];
+            return out.data();
+          },
+          [&](size_t k) { return hexes[which[k]].level; });
+    }
+
+    void FieldStatsBuilder::add(int level,
+                                const float *values,
+                                const uint64 *valueIndex,
+                                size_t n)
+    {
+      accumulate(
+          n,
+          [&](size_t begin, size_t count, std::vector<float> &out) {
+            out.resize(count);
+            for (size_t k = 0; k < count; ++k)
+              out[k] = values[valueIndex[begin + k]];
+            return out.data();
+          },
+          [&](size_t) { return level; });
+    }
+
+    void FieldStatsBuilder::merge(const FieldStatsBuilder &other)
+    {
+      // our own pool stays as it is, it's merged when we're read out
+      const LevelAccumulators &otherLevels = other.merged();
+      std::lock_guard<std::mutex> lock(poolMutex);
+      for (const auto &l : otherLevels)
+        levels[l.first].merge(l.second);
+    }
+
+    FieldStats FieldStatsBuilder::global(size_t numBins) const
+    {
+      Accumulator all;
+      for (const auto &l : merged())
+        all.merge(l.second);
+      return all.stats(numBins);
+    }
+
+    std::map<int, FieldStats> FieldStatsBuilder::perLevel(
+        size_t numBins) const
+    {
+      std::map<int, FieldStats> stats;
+      for (const auto &l : merged())
+        stats[l.first] = l.second.stats(numBins);
+      return stats;
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
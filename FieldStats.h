@@ -0,0 +1,123 @@
+#ifndef FIELDSTATS_H_
+#define FIELDSTATS_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "HexFile.h"
+#include "ospcommon/range.h"
+
+namespace ospray {
+  namespace tamr {
+
+    //! summary of a cell field, or of one level's cells of it
+    struct FieldStats
+    {
+      size_t count{0};
+      //! empty if there are no cells
+      range1f range;
+      double mean{0.};
+      /*! cells per bin, for equal bins over 'range'. Counts can be
+        fractional where a value class of the builder spans several
+        bins, see FieldStatsBuilder. All zero if the range is infinite,
+        as it can't be split into bins */
+      std::vector<float> histogram;
+    };
+
+    /*! min, max, mean and histogram of a cell field, per level and over
+      all levels, gathered in the same pass that loads the field.
+
+      The range isn't known until the end, so values are first counted
+      by the top 16 bits of their order preserving integer key: 2^16
+      classes, each 1/128 of its magnitude wide. The classes are kept
+      in groups of 256 that are only allocated once one of their values
+      is seen, so an accumulator costs a few KB for the octaves a field
+      actually spans. The requested bins over the exact range are filled
+      from those classes when the stats are read out. Blocks of values
+      are reduced in parallel, the keys are computed with AVX2 where
+      available. NaNs are skipped.
+
+      Each block is reduced into accumulators borrowed from a pool, so
+      there are only ever about as many as worker threads. They're kept
+      for the builder's lifetime and merged once, when the stats are
+      first read out or merged elsewhere */
+    class FieldStatsBuilder
+    {
+     public:
+      //! the cells of hexes[i] with value values[i], i < n
+      void add(const float *values, const Hexahedron *hexes, size_t n);
+
+      //! the cells of hexes[which[k]] with value values[which[k]], k < n
+      void add(const float *values,
+               const Hexahedron *hexes,
+               const uint64 *which,
+               size_t n);
+
+      //! n cells of 'level' with values values[valueIndex[k]], k < n
+      void add(int level,
+               const float *values,
+               const uint64 *valueIndex,
+               size_t n);
+
+      //! add everything 'other' has seen
+      void merge(const FieldStatsBuilder &other);
+
+      //! stats over all levels, with 'numBins' histogram bins
+      FieldStats global(size_t numBins) const;
+
+      //! stats of each level seen, with 'numBins' histogram bins
+      std::map<int, FieldStats> perLevel(size_t numBins) const;
+
+     private:
+      struct Accumulator
+      {
+        Accumulator();
+        void merge(const Accumulator &other);
+        FieldStats stats(size_t numBins) const;
+
+        //! count one more value in class 'c'
+        void addToClass(uint32 c)
+        {
+          std::unique_ptr<uint64[]> &group = classes[c >> 8];
+          if (!group)
+            group.reset(new uint64[256]());
+          group[c & 0xff]++;
+        }
+
+        uint64 classCount(uint32 c) const
+        {
+          const std::unique_ptr<uint64[]> &group = classes[c >> 8];
+          return group ? group[c & 0xff] : 0;
+        }
+
+        size_t count{0};
+        double sum{0.};
+        uint32 minKey;
+        uint32 maxKey;
+        //! 256 groups of 256 classes, null until one of theirs is seen
+        std::vector<std::unique_ptr<uint64[]>> classes;
+      };
+
+      using LevelAccumulators = std::map<int, Accumulator>;
+
+      template <typename VALUES_T, typename LEVEL_T>
+      void accumulate(size_t n, const VALUES_T &gather, const LEVEL_T &level);
+
+      //! an idle set of accumulators from the pool, or a new one
+      std::unique_ptr<LevelAccumulators> borrow();
+      void giveBack(std::unique_ptr<LevelAccumulators> local);
+
+      //! the totals per level, after merging in the pool
+      const LevelAccumulators &merged() const;
+
+      mutable std::mutex poolMutex;
+      //! the workers' accumulators, not merged into 'levels' yet
+      mutable std::vector<std::unique_ptr<LevelAccumulators>> pool;
+      mutable LevelAccumulators levels;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,287 @@
+#include "FieldStream.h"
+
+#include <glob.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "ParallelSort.h"
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    std::vector<FileName> expandFieldFiles(const std::string &patterns,
+                                           const FileName &dir)
+    {
+      std::vector<FileName> files;
+      size_t begin = 0;
+      while (begin < patterns.size()) {
+        size_t end = patterns.find(';', begin);
+        if (end == std::string::npos)
+          end = patterns.size();
+        std::string pattern = patterns.substr(begin, end - begin);
+        begin               = end + 1;
+        if (pattern.empty())
+          continue;
+        if (pattern[0] != '/')
+          pattern = dir.path().str() + pattern;
+
+        glob_t matches;
+        memset(&matches, 0, sizeof(matches));
+        if (glob(pattern.c_str(), 0, NULL, &matches) == 0) {
+          for (size_t i = 0; i < matches.gl_pathc; ++i)
+            files.push_back(FileName(matches.gl_pathv[i]));
+        } else {
+          std::cout << "No field files match " << pattern << "\n";
+        }
+        globfree(&matches);
+      }
+      return files;
+    }
+
+    FieldStream::FieldStream(const std::vector<FileName> &files,
+                             const std::vector<uint64> &cellSource,
+                             IOMode ioMode,
+                             size_t chunkBytes,
+                             HugePageMode hugePages,
+                             FieldEncoding encoding,
+                             size_t blockSize,
+                             size_t residentBytes)
+        : files(files),
+          ioMode(ioMode),
+          chunkBytes(std::max(chunkBytes / sizeof(float), size_t(1))
+                     * sizeof(float)),
+          hugePages(hugePages),
+          back(cellSource.size()),
+          encoding(encoding),
+          blockSize(blockSize),
+          residentLimit(residentBytes),
+          resident(files.size()),
+          failures(files.size(), 0)
+    {
+      // raw hex files give cells in file order, indexed ones in level
+      // order; only the latter needs the inverse permutation
+      if (std::is_sorted(cellSource.begin(), cellSource.end())) {
+        this->cellSource = cellSource;
+      } else {
+        order.resize(cellSource.size());
+        tasking::parallel_for(cellSource.size(), [&](size_t i) {
+          order[i] = std::make_pair(cellSource[i], uint64(i));
+        });
+        parallelSort(order);
+      }
+      adviseHugePages(back, hugePages);
+      loader = std::thread([this]() { loaderLoop(); });
+    }
+
+    FieldStream::~FieldStream()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      cond.notify_all();
+      loader.join();
+    }
+
+    void FieldStream::prefetch(size_t step)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (requested != step) {
+        requested = step;
+        cond.notify_all();
+      }
+    }
+
+    bool FieldStream::ready(size_t step)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return (loaded == step && !loadFailed) || isResident(step);
+    }
+
+    bool FieldStream::failed(size_t step)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return step < failures.size() && failures[step] >= MAX_LOAD_ATTEMPTS;
+    }
+
+    bool FieldStream::copyTo(size_t step, float *front)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (requested != step) {
+        requested = step;
+        cond.notify_all();
+      }
+      if (isResident(step)) {
+        // the loader may drop the step from the cache meanwhile, this
+        // reference keeps it alive until it's decoded
+        const std::shared_ptr<const CompressedField> field = resident[step];
+        lock.unlock();
+        field->decode(front);
+        return true;
+      }
+      if (loaded != step || loadFailed)
+        return false;
+
+      // the loader doesn't touch the back buffer again until the next
+      // request, which needs the lock we're holding
+      const size_t blockSize = 1 << 20;
+      tasking::parallel_for((back.size() + blockSize - 1) / blockSize,
+                            [&](size_t b) {
+                              const size_t begin = b * blockSize;
+                              const size_t end =
+                                  std::min(back.size(), begin + blockSize);
+                              std::copy(back.begin() + begin,
+                                        back.begin() + end,
+                                        front + begin);
+                            });
+      return true;
+    }
+
+    void FieldStream::loaderLoop()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+        const auto wake = [&]() { return stop || needsLoad(); };
+        if (loadFailed && requested == loaded && loaded < failures.size()
+            && failures[loaded] < MAX_LOAD_ATTEMPTS)
+          cond.wait_until(lock, retryAt, wake);
+        else
+          cond.wait(lock, wake);
+        if (stop)
+          return;
+        if (!needsLoad())
+          continue;
+
+        const size_t step = requested;
+        // the back buffer is about to be overwritten
+        loaded = NO_STEP;
+        lock.unlock();
+        bool ok = false;
+        try {
+          ok = load(step);
+        } catch (const std::runtime_error &e) {
+          std::cout << e.what() << "\n";
+        }
+        if (ok && encoding != FieldEncoding::Float32)
+          makeResident(step);
+        lock.lock();
+
+        // a load abandoned for a newer request is simply dropped
+        if (requested == step) {
+          loaded     = step;
+          loadFailed = !ok;
+          if (ok) {
+            failures[step] = 0;
+          } else if (step < files.size()) {
+            // back off, in case the file is still being written or the
+            // file system is briefly unavailable
+            const int attempts = ++failures[step];
+            retryAt = Clock::now()
+                      + std::chrono::milliseconds(250 << (attempts - 1));
+            std::cout << "Failed to load timestep " << step << " from "
+                      << files[step]
+                      << (attempts < MAX_LOAD_ATTEMPTS ? ", retrying"
+                                                       : ", giving up")
+                      << "\n";
+          }
+        }
+      }
+    }
+
+    bool FieldStream::needsLoad() const
+    {
+      // resident steps are decoded by copyTo(), nothing to read
+      if (requested == NO_STEP || isResident(requested))
+        return false;
+      if (requested != loaded)
+        return true;
+      return loadFailed && requested < failures.size()
+             && failures[requested] < MAX_LOAD_ATTEMPTS
+             && Clock::now() >= retryAt;
+    }
+
+    bool FieldStream::isResident(size_t step) const
+    {
+      return step < resident.size() && resident[step];
+    }
+
+    void FieldStream::makeResident(size_t step)
+    {
+      std::shared_ptr<const CompressedField> field =
+          std::make_shared<CompressedField>(CompressedField::compress(
+              back.data(), back.size(), encoding, blockSize));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      resident[step] = field;
+      residentOrder.push_back(step);
+      residentBytes += field->sizeInBytes();
+      while (residentLimit && residentBytes > residentLimit
+             && residentOrder.size() > 1) {
+        const size_t oldest = residentOrder.front();
+        residentOrder.pop_front();
+        residentBytes -= resident[oldest]->sizeInBytes();
+        resident[oldest].reset();
+      }
+    }
+
+    bool FieldStream::load(size_t step)
+    {
+      if (step >= files.size())
+        return false;
+      ChunkReader reader(files[step], ioMode, chunkBytes, 3, hugePages);
+      if (!reader.valid())
+        return false;
+
+      const size_t numCells = back.size();
+      auto sourceOf         = [&](size_t k) -> uint64 {
+        return order.empty() ? cellSource[k] : order[k].first;
+      };
+      auto cellOf = [&](size_t k) -> uint64 {
+        return order.empty() ? k : order[k].second;
+      };
+
+      size_t k          = 0;
+      uint64 chunkStart = 0;
+      size_t bytes      = 0;
+      while (k < numCells) {
+        const void *chunk = reader.next(bytes);
+        if (!chunk)
+          break;
+        const float *values     = static_cast<const float *>(chunk);
+        const uint64 chunkEnd   = chunkStart + bytes / sizeof(float);
+
+        // the cells reading from this chunk are the next run of 'order'
+        size_t lo = k, hi = numCells;
+        while (lo < hi) {
+          const size_t mid = lo + (hi - lo) / 2;
+          if (sourceOf(mid) < chunkEnd)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+        const size_t kEnd = lo;
+
+        const size_t blockSize = 1 << 16;
+        tasking::parallel_for((kEnd - k + blockSize - 1) / blockSize,
+                              [&](size_t b) {
+          const size_t begin = k + b * blockSize;
+          const size_t end   = std::min(kEnd, begin + blockSize);
+          for (size_t j = begin; j < end; ++j)
+            back[cellOf(j)] = values[sourceOf(j) - chunkStart];
+        });
+        k          = kEnd;
+        chunkStart = chunkEnd;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stop || requested != step)
+          return false;
+      }
+      // a file shorter than the hex file can't fill every cell
+      return k == numCells;
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
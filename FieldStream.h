@@ -0,0 +1,137 @@
+#ifndef FIELDSTREAM_H_
+#define FIELDSTREAM_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ChunkReader.h"
+#include "HugePages.h"
+#include "TAMRFieldCompression.h"
+#include "ospcommon/FileName.h"
+#include "ospcommon/common.h"
+
+using namespace ospcommon;
+
+namespace ospray {
+  namespace tamr {
+
+    /*! expand a ';' separated list of field file names or glob patterns,
+      relative ones taken relative to 'dir', into a sorted file list */
+    std::vector<FileName> expandFieldFiles(const std::string &patterns,
+                                           const FileName &dir);
+
+    /*! double-buffered playback of per-timestep cell field files on a
+      fixed AMR topology. A background thread streams the requested
+      timestep's file and permutes it into imported cell order in a
+      back buffer, while the caller keeps showing the front one; the
+      geometry is loaded once.
+
+      'cellSource' maps each imported cell to its hex's position in the
+      field files. It's inverted once up front, so every timestep is
+      read sequentially and scattered into place in parallel.
+
+      With an 'encoding' other than Float32 every step loaded is also
+      kept resident as a CompressedField, up to 'residentBytes' (0 for
+      no bound) with the oldest dropped first. Those steps are decoded
+      block by block straight into the front buffer instead of being
+      read again, so several timesteps fit in memory at once */
+    class FieldStream
+    {
+     public:
+      FieldStream(const std::vector<FileName> &files,
+                  const std::vector<uint64> &cellSource,
+                  IOMode ioMode,
+                  size_t chunkBytes,
+                  HugePageMode hugePages = HugePageMode::Off,
+                  FieldEncoding encoding = FieldEncoding::Float32,
+                  size_t blockSize       = 4096,
+                  size_t residentBytes   = 0);
+      ~FieldStream();
+
+      size_t numSteps() const
+      {
+        return files.size();
+      }
+
+      size_t numCells() const
+      {
+        return back.size();
+      }
+
+      /*! start loading 'step' in the background, abandoning a load of
+        some other step that is still in flight */
+      void prefetch(size_t step);
+
+      /*! whether 'step' is loaded and waiting in the back buffer, or
+        resident in compressed form */
+      bool ready(size_t step);
+
+      /*! copy 'step' to 'front', which holds numCells() values, if it
+        is ready(). Never waits for the disk: otherwise 'step' is
+        requested and false returned, as it is if the step's file could
+        not be read; 'front' is left untouched then */
+      bool copyTo(size_t step, float *front);
+
+      /*! whether reading 'step' failed MAX_LOAD_ATTEMPTS times in a row.
+        A failed load is retried while the step stays requested, with
+        the delay doubling each time, until then */
+      bool failed(size_t step);
+
+      static const int MAX_LOAD_ATTEMPTS = 4;
+
+     private:
+      static const size_t NO_STEP = size_t(-1);
+      typedef std::chrono::steady_clock Clock;
+
+      void loaderLoop();
+      //! whether the loader has work for 'requested'; the mutex must be held
+      bool needsLoad() const;
+      bool load(size_t step);
+      //! keep the back buffer, holding 'step', in compressed form
+      void makeResident(size_t step);
+      //! whether 'step' is kept compressed; the mutex must be held
+      bool isResident(size_t step) const;
+
+      std::vector<FileName> files;
+      IOMode ioMode;
+      size_t chunkBytes;
+      HugePageMode hugePages;
+
+      /*! (field file position, cell) pairs sorted by position; empty if
+        cellSource was already sorted, then cell k reads position
+        cellSource[k] */
+      std::vector<std::pair<uint64, uint64>> order;
+      std::vector<uint64> cellSource;
+      std::vector<float> back;
+
+      FieldEncoding encoding;
+      size_t blockSize;
+      size_t residentLimit;
+      //! the compressed steps, null where a step isn't resident
+      std::vector<std::shared_ptr<const CompressedField>> resident;
+      //! resident steps, oldest first
+      std::deque<size_t> residentOrder;
+      size_t residentBytes{0};
+
+      size_t requested{NO_STEP};
+      size_t loaded{NO_STEP};
+      bool loadFailed{false};
+      //! failed loads in a row per step, reset once one succeeds
+      std::vector<int> failures;
+      //! when a failed 'loaded' step may be read again
+      Clock::time_point retryAt;
+      bool stop{false};
+      std::mutex mutex;
+      std::condition_variable cond;
+      std::thread loader;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
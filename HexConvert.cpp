@@ -0,0 +1,440 @@
+#include "HexConvert.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEXCONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    // corner offsets in the order the unstructured importer emits them:
+    // for k, for j, for i: x = (i + j) % 2
+    static const int CORNER_OFFSET[8][3] = {{0, 0, 0},
+                                            {1, 0, 0},
+                                            {1, 1, 0},
+                                            {0, 1, 0},
+                                            {0, 0, 1},
+                                            {1, 0, 1},
+                                            {1, 1, 1},
+                                            {0, 1, 1}};
+
+    // 2^-level, built from the exponent bits so every variant agrees
+    static inline float rcpLevelScale(int level)
+    {
+      const int bits = (127 - level) << 23;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      return f;
+    }
+
+    static void hexesToVoxelsScalar(const Hexahedron *hexes,
+                                    size_t n,
+                                    const vec3f &origin,
+                                    vec3f *out)
+    {
+      for (size_t i = 0; i < n; ++i) {
+        const float s = rcpLevelScale(hexes[i].level);
+        out[i]        = vec3f(((float)hexes[i].lower.x - origin.x) * s,
+                       ((float)hexes[i].lower.y - origin.y) * s,
+                       ((float)hexes[i].lower.z - origin.z) * s);
+      }
+    }
+
+    static void hexesToVoxelsIntScalar(const Hexahedron *hexes,
+                                       size_t n,
+                                       const vec3i &origin,
+                                       vec3i *out)
+    {
+      for (size_t i = 0; i < n; ++i) {
+        const int level = hexes[i].level;
+        out[i]          = vec3i((hexes[i].lower.x - origin.x) >> level,
+                       (hexes[i].lower.y - origin.y) >> level,
+                       (hexes[i].lower.z - origin.z) >> level);
+      }
+    }
+
+    static void hexCornersScalar(const Hexahedron *hexes,
+                                 size_t n,
+                                 const vec3i &gridMin,
+                                 float voxelScale,
+                                 const vec3f &worldMin,
+                                 vec3i *keys,
+                                 vec3f *pos)
+    {
+      for (size_t i = 0; i < n; ++i) {
+        const int size = 1 << hexes[i].level;
+        for (int c = 0; c < 8; ++c) {
+          const vec3i p(hexes[i].lower.x + size * CORNER_OFFSET[c][0],
+                        hexes[i].lower.y + size * CORNER_OFFSET[c][1],
+                        hexes[i].lower.z + size * CORNER_OFFSET[c][2]);
+          keys[8 * i + c] = p;
+          // multiply then add, not fma: the same rounding as the SIMD
+          // versions without a slow software fma on older CPUs. The build
+          // passes -ffp-contract=off so the compiler does not fuse them
+          pos[8 * i + c] =
+              vec3f(float(p.x - gridMin.x) * voxelScale + worldMin.x,
+                    float(p.y - gridMin.y) * voxelScale + worldMin.y,
+                    float(p.z - gridMin.z) * voxelScale + worldMin.z);
+        }
+      }
+    }
+
+#ifdef HEXCONVERT_X86
+    __attribute__((target("avx2"))) static void hexesToVoxelsAVX2(
+        const Hexahedron *hexes, size_t n, const vec3f &origin, vec3f *out)
+    {
+      const int *base       = reinterpret_cast<const int *>(hexes);
+      const __m256i stride  = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+      const __m256i bias    = _mm256_set1_epi32(127);
+      const __m256 ox       = _mm256_set1_ps(origin.x);
+      const __m256 oy       = _mm256_set1_ps(origin.y);
+      const __m256 oz       = _mm256_set1_ps(origin.z);
+      alignas(32) float x[8], y[8], z[8];
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const int *h = base + 4 * i;
+        const __m256 s = _mm256_castsi256_ps(_mm256_slli_epi32(
+            _mm256_sub_epi32(bias, _mm256_i32gather_epi32(h + 3, stride, 4)),
+            23));
+        _mm256_store_ps(x, _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_i32gather_epi32(h + 0, stride, 4)), ox), s));
+        _mm256_store_ps(y, _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_i32gather_epi32(h + 1, stride, 4)), oy), s));
+        _mm256_store_ps(z, _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_i32gather_epi32(h + 2, stride, 4)), oz), s));
+        for (int k = 0; k < 8; ++k)
+          out[i + k] = vec3f(x[k], y[k], z[k]);
+      }
+      hexesToVoxelsScalar(hexes + i, n - i, origin, out + i);
+    }
+
+    __attribute__((target("avx2"))) static void hexesToVoxelsIntAVX2(
+        const Hexahedron *hexes, size_t n, const vec3i &origin, vec3i *out)
+    {
+      const int *base      = reinterpret_cast<const int *>(hexes);
+      const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+      const __m256i ox     = _mm256_set1_epi32(origin.x);
+      const __m256i oy     = _mm256_set1_epi32(origin.y);
+      const __m256i oz     = _mm256_set1_epi32(origin.z);
+      alignas(32) int x[8], y[8], z[8];
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const int *h       = base + 4 * i;
+        const __m256i lvl  = _mm256_i32gather_epi32(h + 3, stride, 4);
+        _mm256_store_si256((__m256i *)x, _mm256_srav_epi32(_mm256_sub_epi32(_mm256_i32gather_epi32(h + 0, stride, 4), ox), lvl));
+        _mm256_store_si256((__m256i *)y, _mm256_srav_epi32(_mm256_sub_epi32(_mm256_i32gather_epi32(h + 1, stride, 4), oy), lvl));
+        _mm256_store_si256((__m256i *)z, _mm256_srav_epi32(_mm256_sub_epi32(_mm256_i32gather_epi32(h + 2, stride, 4), oz), lvl));
+        for (int k = 0; k < 8; ++k)
+          out[i + k] = vec3i(x[k], y[k], z[k]);
+      }
+      hexesToVoxelsIntScalar(hexes + i, n - i, origin, out + i);
+    }
+
+    __attribute__((target("avx2"))) static void hexCornersAVX2(
+        const Hexahedron *hexes,
+        size_t n,
+        const vec3i &gridMin,
+        float voxelScale,
+        const vec3f &worldMin,
+        vec3i *keys,
+        vec3f *pos)
+    {
+      const int *base      = reinterpret_cast<const int *>(hexes);
+      const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+      const __m256i one    = _mm256_set1_epi32(1);
+      const __m256i gx     = _mm256_set1_epi32(gridMin.x);
+      const __m256i gy     = _mm256_set1_epi32(gridMin.y);
+      const __m256i gz     = _mm256_set1_epi32(gridMin.z);
+      const __m256 scale   = _mm256_set1_ps(voxelScale);
+      const __m256 wx      = _mm256_set1_ps(worldMin.x);
+      const __m256 wy      = _mm256_set1_ps(worldMin.y);
+      const __m256 wz      = _mm256_set1_ps(worldMin.z);
+      alignas(32) int kx[8], ky[8], kz[8];
+      alignas(32) float px[8], py[8], pz[8];
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const int *h      = base + 4 * i;
+        const __m256i x   = _mm256_i32gather_epi32(h + 0, stride, 4);
+        const __m256i y   = _mm256_i32gather_epi32(h + 1, stride, 4);
+        const __m256i z   = _mm256_i32gather_epi32(h + 2, stride, 4);
+        const __m256i s   = _mm256_sllv_epi32(one, _mm256_i32gather_epi32(h + 3, stride, 4));
+        const __m256i x1  = _mm256_add_epi32(x, s);
+        const __m256i y1  = _mm256_add_epi32(y, s);
+        const __m256i z1  = _mm256_add_epi32(z, s);
+
+        for (int c = 0; c < 8; ++c) {
+          const __m256i cx = CORNER_OFFSET[c][0] ? x1 : x;
+          const __m256i cy = CORNER_OFFSET[c][1] ? y1 : y;
+          const __m256i cz = CORNER_OFFSET[c][2] ? z1 : z;
+          _mm256_store_si256((__m256i *)kx, cx);
+          _mm256_store_si256((__m256i *)ky, cy);
+          _mm256_store_si256((__m256i *)kz, cz);
+          _mm256_store_ps(px, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(cx, gx)), scale), wx));
+          _mm256_store_ps(py, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(cy, gy)), scale), wy));
+          _mm256_store_ps(pz, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(cz, gz)), scale), wz));
+          for (int k = 0; k < 8; ++k) {
+            keys[8 * (i + k) + c] = vec3i(kx[k], ky[k], kz[k]);
+            pos[8 * (i + k) + c]  = vec3f(px[k], py[k], pz[k]);
+          }
+        }
+      }
+      hexCornersScalar(hexes + i, n - i, gridMin, voxelScale, worldMin,
+                       keys + 8 * i, pos + 8 * i);
+    }
+
+    __attribute__((target("avx512f"))) static void hexesToVoxelsAVX512(
+        const Hexahedron *hexes, size_t n, const vec3f &origin, vec3f *out)
+    {
+      const int *base      = reinterpret_cast<const int *>(hexes);
+      const __m512i stride = _mm512_setr_epi32(
+          0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60);
+      const __m512i bias = _mm512_set1_epi32(127);
+      const __m512 ox    = _mm512_set1_ps(origin.x);
+      const __m512 oy    = _mm512_set1_ps(origin.y);
+      const __m512 oz    = _mm512_set1_ps(origin.z);
+      // component offsets into 16 consecutive vec3f (48 floats)
+      const __m512i outIdx = _mm512_setr_epi32(
+          0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 33, 36, 39, 42, 45);
+
+      size_t i = 0;
+      for (; i + 16 <= n; i += 16) {
+        const int *h     = base + 4 * i;
+        const __m512 s = _mm512_castsi512_ps(_mm512_slli_epi32(
+            _mm512_sub_epi32(bias, _mm512_i32gather_epi32(stride, h + 3, 4)),
+            23));
+        float *o = reinterpret_cast<float *>(out + i);
+        _mm512_i32scatter_ps(o + 0, outIdx, _mm512_mul_ps(_mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_i32gather_epi32(stride, h + 0, 4)), ox), s), 4);
+        _mm512_i32scatter_ps(o + 1, outIdx, _mm512_mul_ps(_mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_i32gather_epi32(stride, h + 1, 4)), oy), s), 4);
+        _mm512_i32scatter_ps(o + 2, outIdx, _mm512_mul_ps(_mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_i32gather_epi32(stride, h + 2, 4)), oz), s), 4);
+      }
+      hexesToVoxelsScalar(hexes + i, n - i, origin, out + i);
+    }
+
+    static bool cpuHasAVX2()
+    {
+      return __builtin_cpu_supports("avx2");
+    }
+
+    static bool cpuHasAVX512()
+    {
+      return __builtin_cpu_supports("avx512f");
+    }
+#endif
+
+    static bool forceScalar = false;
+
+    bool setHexConvertScalar(bool scalar)
+    {
+      const bool previous = forceScalar;
+      forceScalar         = scalar;
+      return previous;
+    }
+
+    const char *hexConvertISA()
+    {
+#ifdef HEXCONVERT_X86
+      if (!forceScalar && cpuHasAVX512())
+        return "avx512";
+      if (!forceScalar && cpuHasAVX2())
+        return "avx2";
+#endif
+      return "scalar";
+    }
+
+    void hexesToVoxels(const Hexahedron *hexes,
+                       size_t n,
+                       const vec3f &origin,
+                       vec3f *voxelLower)
+    {
+#ifdef HEXCONVERT_X86
+      if (!forceScalar && cpuHasAVX512())
+        return hexesToVoxelsAVX512(hexes, n, origin, voxelLower);
+      if (!forceScalar && cpuHasAVX2())
+        return hexesToVoxelsAVX2(hexes, n, origin, voxelLower);
+#endif
+      hexesToVoxelsScalar(hexes, n, origin, voxelLower);
+    }
+
+    void hexesToVoxelsParallel(const Hexahedron *hexes,
+                               size_t n,
+                               const vec3f &origin,
+                               std::vector<vec3f> &voxelLower)
+    {
+      const size_t blockSize = 64 * 1024;
+      voxelLower.resize(n);
+      tasking::parallel_for((n + blockSize - 1) / blockSize, [&](size_t b) {
+        const size_t begin = b * blockSize;
+        hexesToVoxels(hexes + begin,
+                      std::min(blockSize, n - begin),
+                      origin,
+                      voxelLower.data() + begin);
+      });
+    }
+
+    void hexesToVoxels(const Hexahedron *hexes,
+                       size_t n,
+                       const vec3i &origin,
+                       vec3i *voxelLower)
+    {
+      // like the corners, bound by the AoS stores; AVX-512 gains nothing
+#ifdef HEXCONVERT_X86
+      if (!forceScalar && cpuHasAVX2())
+        return hexesToVoxelsIntAVX2(hexes, n, origin, voxelLower);
+#endif
+      hexesToVoxelsIntScalar(hexes, n, origin, voxelLower);
+    }
+
+    void hexesToVoxelsParallel(const Hexahedron *hexes,
+                               size_t n,
+                               const vec3i &origin,
+                               std::vector<vec3i> &voxelLower)
+    {
+      const size_t blockSize = 64 * 1024;
+      voxelLower.resize(n);
+      tasking::parallel_for((n + blockSize - 1) / blockSize, [&](size_t b) {
+        const size_t begin = b * blockSize;
+        hexesToVoxels(hexes + begin,
+                      std::min(blockSize, n - begin),
+                      origin,
+                      voxelLower.data() + begin);
+      });
+    }
+
+    void bucketHexes(TAMRData &data,
+                     const Hexahedron *hexes,
+                     size_t n,
+                     const uint64 *source,
+                     uint64 firstSource,
+                     std::vector<vec3f> &voxelLower)
+    {
+      hexesToVoxelsParallel(hexes, n, data.amrOrigin, voxelLower);
+      for (size_t i = 0; i < n; ++i) {
+        TAMRVoxel voxel;
+        voxel.level         = hexes[i].level;
+        voxel.lower         = voxelLower[i];
+        voxel.indexInBuffer = source ? source[i] : firstSource + i;
+
+        data.voxelsInLevel[voxel.level].push_voxel(voxel);
+      }
+    }
+
+    void bucketHexes(TAMRDatai &data,
+                     const Hexahedron *hexes,
+                     size_t n,
+                     const uint64 *source,
+                     uint64 firstSource,
+                     std::vector<vec3i> &voxelLower)
+    {
+      hexesToVoxelsParallel(hexes, n, data.amrOrigin, voxelLower);
+      for (size_t i = 0; i < n; ++i) {
+        const int level = hexes[i].level;
+        // what the shift dropped, in cells of the level
+        const vec3i rest =
+            hexes[i].lower - data.amrOrigin - voxelLower[i] * (1 << level);
+        const vec3f offset = vec3f(rest) * rcpLevelScale(level);
+
+        TAMRLeveli &bucket = data.voxelsInLevel[level];
+        if (bucket.voxels.empty()) {
+          bucket.latticeOffset = offset;
+        } else if (offset.x != bucket.latticeOffset.x
+                   || offset.y != bucket.latticeOffset.y
+                   || offset.z != bucket.latticeOffset.z) {
+          throw std::runtime_error("hexes of level " + std::to_string(level)
+                                   + " are not on a common lattice");
+        }
+
+        TAMRVoxeli voxel;
+        voxel.level         = level;
+        voxel.lower         = voxelLower[i];
+        voxel.indexInBuffer = source ? source[i] : firstSource + i;
+        bucket.push_voxel(voxel);
+      }
+    }
+
+    vec3i minHexLower(const Hexahedron *hexes, size_t n)
+    {
+      const size_t blockSize = 64 * 1024;
+      const size_t numBlocks = (n + blockSize - 1) / blockSize;
+      std::vector<vec3i> blockMin(numBlocks);
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        const size_t begin = b * blockSize;
+        const size_t end   = std::min(begin + blockSize, n);
+        vec3i m            = hexes[begin].lower;
+        for (size_t i = begin + 1; i < end; ++i)
+          m = min(m, hexes[i].lower);
+        blockMin[b] = m;
+      });
+      vec3i m = blockMin[0];
+      for (const auto &b : blockMin)
+        m = min(m, b);
+      return m;
+    }
+
+    void rebaseVoxels(TAMRData &data, const vec3f &origin)
+    {
+      const vec3f move = data.amrOrigin - origin;
+      for (auto &lv : data.voxelsInLevel) {
+        TAMRLevel &bucket = lv.second;
+        if (bucket.voxels.empty())
+          continue;
+        const vec3f shift = move * rcpLevelScale(lv.first);
+        for (auto &v : bucket.voxels)
+          v.lower = v.lower + shift;
+        bucket.bounds.lower = bucket.bounds.lower + shift;
+        bucket.bounds.upper = bucket.bounds.upper + shift;
+      }
+      data.amrOrigin = origin;
+    }
+
+    void rebaseVoxels(TAMRDatai &data, const vec3i &origin)
+    {
+      const vec3i move = data.amrOrigin - origin;
+      for (auto &lv : data.voxelsInLevel) {
+        TAMRLeveli &bucket = lv.second;
+        if (bucket.voxels.empty())
+          continue;
+        const int level = lv.first;
+        // the lattice's offset from the new origin in grid units, split
+        // into whole cells of the level and what is left of one
+        const vec3i rest =
+            vec3i(bucket.latticeOffset * float(1 << level)) + move;
+        const vec3i shift(rest.x >> level, rest.y >> level, rest.z >> level);
+        bucket.latticeOffset =
+            vec3f(rest - shift * (1 << level)) * rcpLevelScale(level);
+        for (auto &v : bucket.voxels)
+          v.lower = v.lower + shift;
+        bucket.bounds.lower = bucket.bounds.lower + shift;
+        bucket.bounds.upper = bucket.bounds.upper + shift;
+      }
+      data.amrOrigin = origin;
+    }
+
+    void hexCorners(const Hexahedron *hexes,
+                    size_t n,
+                    const vec3i &gridMin,
+                    float voxelScale,
+                    const vec3f &worldMin,
+                    vec3i *cornerKeys,
+                    vec3f *cornerPos)
+    {
+      // the corner kernel is bound by the AoS stores, AVX2 is as good as
+      // it gets there so AVX-512 machines use it too
+#ifdef HEXCONVERT_X86
+      if (!forceScalar && cpuHasAVX2())
+        return hexCornersAVX2(
+            hexes, n, gridMin, voxelScale, worldMin, cornerKeys, cornerPos);
+#endif
+      hexCornersScalar(
+          hexes, n, gridMin, voxelScale, worldMin, cornerKeys, cornerPos);
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
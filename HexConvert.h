@@ -0,0 +1,98 @@
+#ifndef HEXCONVERT_H_
+#define HEXCONVERT_H_
+
+#include <vector>
+#include "HexFile.h"
+#include "TAMRData.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! batch conversion kernels from raw Hexahedron records. Each has a
+      scalar version and AVX2 / AVX-512 versions picked at runtime from
+      the CPU's features; all produce bit-identical results */
+
+    /*! level-scaled voxel coordinates, (lower - origin) / 2^level, as
+      used for TAMRVoxel::lower */
+    void hexesToVoxels(const Hexahedron *hexes,
+                       size_t n,
+                       const vec3f &origin,
+                       vec3f *voxelLower);
+
+    //! hexesToVoxels() over parallel blocks, resizing 'voxelLower' to n
+    void hexesToVoxelsParallel(const Hexahedron *hexes,
+                               size_t n,
+                               const vec3f &origin,
+                               std::vector<vec3f> &voxelLower);
+
+    /*! integer voxel coordinates, (lower - origin) >> level, i.e. the
+      level's cell the hex falls into counted from 'origin'. Exact for
+      any grid coordinate, as used for TAMRVoxeli::lower */
+    void hexesToVoxels(const Hexahedron *hexes,
+                       size_t n,
+                       const vec3i &origin,
+                       vec3i *voxelLower);
+
+    //! integer hexesToVoxels() over parallel blocks
+    void hexesToVoxelsParallel(const Hexahedron *hexes,
+                               size_t n,
+                               const vec3i &origin,
+                               std::vector<vec3i> &voxelLower);
+
+    /*! convert hexes to voxels relative to data.amrOrigin and append
+      each to its level of 'data'. Hex i's index into the field files is
+      source[i], or firstSource + i if 'source' is null. 'voxelLower' is
+      scratch space kept by the caller across batches */
+    void bucketHexes(TAMRData &data,
+                     const Hexahedron *hexes,
+                     size_t n,
+                     const uint64 *source,
+                     uint64 firstSource,
+                     std::vector<vec3f> &voxelLower);
+
+    /*! bucketHexes() with integer coordinates. Each level's cells must
+      lie on one lattice; its offset from the origin is recorded in the
+      level's latticeOffset, and a hex off that lattice throws */
+    void bucketHexes(TAMRDatai &data,
+                     const Hexahedron *hexes,
+                     size_t n,
+                     const uint64 *source,
+                     uint64 firstSource,
+                     std::vector<vec3i> &voxelLower);
+
+    //! the min over the lower corners of n > 0 hexes, in parallel blocks
+    vec3i minHexLower(const Hexahedron *hexes, size_t n);
+
+    /*! move the voxels of 'data' from data.amrOrigin to 'origin', giving
+      what bucketHexes() relative to 'origin' would have. Float voxels
+      are offset, which is exact while grid coordinates stay below 2^24;
+      int voxels and lattice offsets are carried over exactly */
+    void rebaseVoxels(TAMRData &data, const vec3f &origin);
+    void rebaseVoxels(TAMRDatai &data, const vec3i &origin);
+
+    /*! the 8 corners of each hex, in the unstructured importer's order
+      (bottom face counter-clockwise, then top face), as grid space keys
+      for vertex dedup and as world positions
+      (key - gridMin) * voxelScale + worldMin, evaluated as a separate
+      multiply and add in every variant so they round the same (the
+      file is built with -ffp-contract=off). Outputs need room for
+      8 * n entries */
+    void hexCorners(const Hexahedron *hexes,
+                    size_t n,
+                    const vec3i &gridMin,
+                    float voxelScale,
+                    const vec3f &worldMin,
+                    vec3i *cornerKeys,
+                    vec3f *cornerPos);
+
+    //! name of the kernel variant in use: "scalar", "avx2" or "avx512"
+    const char *hexConvertISA();
+
+    /*! force the scalar kernels (e.g. to compare against the SIMD ones);
+      returns the previous setting */
+    bool setHexConvertScalar(bool scalar);
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,206 @@
+#include "HexCrop.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEXCROP_X86 1
+#include <immintrin.h>
+#endif
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    std::vector<box3i> parseCropBoxes(const std::string &spec)
+    {
+      std::vector<box3i> boxes;
+      std::stringstream boxList(spec);
+      std::string boxSpec;
+      while (std::getline(boxList, boxSpec, ';')) {
+        if (boxSpec.empty())
+          continue;
+        int c[6];
+        std::stringstream coords(boxSpec);
+        std::string coord;
+        int numCoords = 0;
+        while (numCoords < 6 && std::getline(coords, coord, ','))
+          c[numCoords++] = atoi(coord.c_str());
+        if (numCoords != 6)
+          throw std::runtime_error("crop box '" + boxSpec
+                                   + "' needs 6 coordinates");
+        boxes.push_back(box3i(vec3i(c[0], c[1], c[2]), vec3i(c[3], c[4], c[5])));
+      }
+      return boxes;
+    }
+
+#ifdef HEXCROP_X86
+    // the SIMD versions test whole groups of hexes, appending to
+    // 'survivors', and return the position the scalar tail starts at
+    __attribute__((target("avx512f"))) static size_t cropHexesAVX512(
+        const Hexahedron *hexes,
+        size_t n,
+        const std::vector<box3i> &boxes,
+        uint32 *survivors,
+        size_t &numSurvivors)
+    {
+      size_t i = 0;
+      const int *base = reinterpret_cast<const int *>(hexes);
+      // 16 hexes per iteration, each hex is 4 ints: x, y, z, level
+      const __m512i stride16 = _mm512_setr_epi32(
+          0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60);
+      const __m512i one16 = _mm512_set1_epi32(1);
+      for (; i + 16 <= n; i += 16) {
+        const int *h    = base + 4 * i;
+        const __m512i x = _mm512_i32gather_epi32(stride16, h + 0, 4);
+        const __m512i y = _mm512_i32gather_epi32(stride16, h + 1, 4);
+        const __m512i z = _mm512_i32gather_epi32(stride16, h + 2, 4);
+        const __m512i s =
+            _mm512_sllv_epi32(one16, _mm512_i32gather_epi32(stride16, h + 3, 4));
+        const __m512i ux = _mm512_add_epi32(x, s);
+        const __m512i uy = _mm512_add_epi32(y, s);
+        const __m512i uz = _mm512_add_epi32(z, s);
+
+        __mmask16 hit = 0;
+        for (const auto &b : boxes) {
+          __mmask16 m = _mm512_cmplt_epi32_mask(x, _mm512_set1_epi32(b.upper.x));
+          m = _mm512_mask_cmpgt_epi32_mask(m, ux, _mm512_set1_epi32(b.lower.x));
+          m = _mm512_mask_cmplt_epi32_mask(m, y, _mm512_set1_epi32(b.upper.y));
+          m = _mm512_mask_cmpgt_epi32_mask(m, uy, _mm512_set1_epi32(b.lower.y));
+          m = _mm512_mask_cmplt_epi32_mask(m, z, _mm512_set1_epi32(b.upper.z));
+          m = _mm512_mask_cmpgt_epi32_mask(m, uz, _mm512_set1_epi32(b.lower.z));
+          hit |= m;
+        }
+
+        const __m512i ids =
+            _mm512_add_epi32(_mm512_set1_epi32(int(i)),
+                             _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+                                               10, 11, 12, 13, 14, 15));
+        _mm512_mask_compressstoreu_epi32(survivors + numSurvivors, hit, ids);
+        numSurvivors += __builtin_popcount(hit);
+      }
+      return i;
+    }
+
+    __attribute__((target("avx2"))) static size_t cropHexesAVX2(
+        const Hexahedron *hexes,
+        size_t n,
+        const std::vector<box3i> &boxes,
+        uint32 *survivors,
+        size_t &numSurvivors)
+    {
+      size_t i = 0;
+      const int *base = reinterpret_cast<const int *>(hexes);
+      // 8 hexes per iteration, each hex is 4 ints: x, y, z, level
+      const __m256i stride8 = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+      const __m256i one8    = _mm256_set1_epi32(1);
+      for (; i + 8 <= n; i += 8) {
+        const int *h    = base + 4 * i;
+        const __m256i x = _mm256_i32gather_epi32(h + 0, stride8, 4);
+        const __m256i y = _mm256_i32gather_epi32(h + 1, stride8, 4);
+        const __m256i z = _mm256_i32gather_epi32(h + 2, stride8, 4);
+        const __m256i s =
+            _mm256_sllv_epi32(one8, _mm256_i32gather_epi32(h + 3, stride8, 4));
+        const __m256i ux = _mm256_add_epi32(x, s);
+        const __m256i uy = _mm256_add_epi32(y, s);
+        const __m256i uz = _mm256_add_epi32(z, s);
+
+        __m256i hit = _mm256_setzero_si256();
+        for (const auto &b : boxes) {
+          __m256i m = _mm256_cmpgt_epi32(_mm256_set1_epi32(b.upper.x), x);
+          m = _mm256_and_si256(m, _mm256_cmpgt_epi32(ux, _mm256_set1_epi32(b.lower.x)));
+          m = _mm256_and_si256(m, _mm256_cmpgt_epi32(_mm256_set1_epi32(b.upper.y), y));
+          m = _mm256_and_si256(m, _mm256_cmpgt_epi32(uy, _mm256_set1_epi32(b.lower.y)));
+          m = _mm256_and_si256(m, _mm256_cmpgt_epi32(_mm256_set1_epi32(b.upper.z), z));
+          m = _mm256_and_si256(m, _mm256_cmpgt_epi32(uz, _mm256_set1_epi32(b.lower.z)));
+          hit = _mm256_or_si256(hit, m);
+        }
+
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        while (mask) {
+          survivors[numSurvivors++] = uint32(i + __builtin_ctz(mask));
+          mask &= mask - 1;
+        }
+      }
+      return i;
+    }
+
+    static bool cpuHasAVX2()
+    {
+      return __builtin_cpu_supports("avx2");
+    }
+
+    static bool cpuHasAVX512()
+    {
+      return __builtin_cpu_supports("avx512f");
+    }
+#endif
+
+    size_t cropHexes(const Hexahedron *hexes,
+                     size_t n,
+                     const std::vector<box3i> &boxes,
+                     uint32 *survivors)
+    {
+      size_t numSurvivors = 0;
+      size_t i            = 0;
+#ifdef HEXCROP_X86
+      if (cpuHasAVX512())
+        i = cropHexesAVX512(hexes, n, boxes, survivors, numSurvivors);
+      else if (cpuHasAVX2())
+        i = cropHexesAVX2(hexes, n, boxes, survivors, numSurvivors);
+#endif
+
+      for (; i < n; ++i) {
+        if (hexInCrop(hexes[i], boxes))
+          survivors[numSurvivors++] = uint32(i);
+      }
+      return numSurvivors;
+    }
+
+    void cropHexesParallel(const Hexahedron *hexes,
+                           size_t n,
+                           const std::vector<box3i> &boxes,
+                           std::vector<uint64> &survivors,
+                           uint64 firstIndex,
+                           int *maxLevel)
+    {
+      const size_t blockSize = 64 * 1024;
+      const size_t numBlocks = (n + blockSize - 1) / blockSize;
+      std::vector<std::vector<uint32>> blockSurvivors(numBlocks);
+      std::vector<int> blockMaxLevel(maxLevel ? numBlocks : 0);
+
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        const size_t begin = b * blockSize;
+        const size_t count = std::min(blockSize, n - begin);
+        std::vector<uint32> &out = blockSurvivors[b];
+        out.resize(count);
+        out.resize(cropHexes(hexes + begin, count, boxes, out.data()));
+        if (maxLevel) {
+          // the block is still in cache from the crop test
+          int level = 0;
+          for (size_t i = begin; i < begin + count; ++i)
+            level = std::max(level, hexes[i].level);
+          blockMaxLevel[b] = level;
+        }
+      });
+      for (const int level : blockMaxLevel)
+        *maxLevel = std::max(*maxLevel, level);
+
+      std::vector<size_t> offset(numBlocks + 1, 0);
+      for (size_t b = 0; b < numBlocks; ++b)
+        offset[b + 1] = offset[b] + blockSurvivors[b].size();
+
+      survivors.resize(offset[numBlocks]);
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        const uint64 blockFirst = firstIndex + b * blockSize;
+        uint64 *out             = survivors.data() + offset[b];
+        for (const uint32 s : blockSurvivors[b])
+          *out++ = blockFirst + s;
+      });
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,50 @@
+#ifndef HEXCROP_H_
+#define HEXCROP_H_
+
+#include <string>
+#include <vector>
+#include "HexFile.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! parse "x0,y0,z0,x1,y1,z1;..." into grid space boxes */
+    std::vector<box3i> parseCropBoxes(const std::string &spec);
+
+    /*! true if the hex [lower, lower + 2^level) overlaps any of the
+      (half open) boxes */
+    inline bool hexInCrop(const Hexahedron &h, const std::vector<box3i> &boxes)
+    {
+      const vec3i upper = h.lower + vec3i(1 << h.level);
+      for (const auto &b : boxes) {
+        if (h.lower.x < b.upper.x && upper.x > b.lower.x
+            && h.lower.y < b.upper.y && upper.y > b.lower.y
+            && h.lower.z < b.upper.z && upper.z > b.lower.z)
+          return true;
+      }
+      return false;
+    }
+
+    /*! write the positions (0..n-1) of all hexes overlapping any box to
+      'survivors' and return their count; 'survivors' needs room for n.
+      Tests 8 (AVX2) or 16 (AVX-512) hexes per iteration on CPUs that
+      have them, picked at runtime */
+    size_t cropHexes(const Hexahedron *hexes,
+                     size_t n,
+                     const std::vector<box3i> &boxes,
+                     uint32 *survivors);
+
+    /*! parallel version over a large array, survivors are returned in
+      input order as 'firstIndex + position'. If 'maxLevel' is given it
+      is raised to the highest level of all n hexes, cropped or not */
+    void cropHexesParallel(const Hexahedron *hexes,
+                           size_t n,
+                           const std::vector<box3i> &boxes,
+                           std::vector<uint64> &survivors,
+                           uint64 firstIndex = 0,
+                           int *maxLevel     = nullptr);
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,405 @@
+#include "HexFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    static void preadAll(int fd, void *dst, size_t size, uint64 offset)
+    {
+      char *out = static_cast<char *>(dst);
+      while (size > 0) {
+        const ssize_t n = pread(fd, out, size, offset);
+        if (n <= 0)
+          throw std::runtime_error("short read from indexed hex file");
+        out += n;
+        size -= n;
+        offset += n;
+      }
+    }
+
+    static uint64 alignUp(uint64 x, uint64 alignment)
+    {
+      return (x + alignment - 1) / alignment * alignment;
+    }
+
+    bool HexIndex::isIndexedFile(const FileName &fileName)
+    {
+      int fd = open(fileName.c_str(), O_RDONLY);
+      if (fd == -1)
+        return false;
+      char magicBuf[8] = {0};
+      const bool isIndexed = ::read(fd, magicBuf, sizeof(magicBuf)) == 8
+                             && strcmp(magicBuf, magic()) == 0;
+      close(fd);
+      return isIndexed;
+    }
+
+    HexIndex HexIndex::read(const FileName &fileName)
+    {
+      int fd = open(fileName.c_str(), O_RDONLY);
+      if (fd == -1)
+        throw std::runtime_error("could not open " + fileName.str());
+
+      // the header and tables have to fit the file before anything is
+      // sized by them
+      struct stat statBuf = {0};
+      fstat(fd, &statBuf);
+      const uint64 fileSize = statBuf.st_size;
+      auto fits = [&](uint64 offset, uint64 count, size_t size) {
+        return offset <= fileSize && count <= (fileSize - offset) / size;
+      };
+
+      HexIndex index;
+      index.fileName = fileName;
+      if (!fits(0, 1, sizeof(index.header))) {
+        close(fd);
+        throw std::runtime_error(fileName.str() + " is not an indexed hex file");
+      }
+      preadAll(fd, &index.header, sizeof(index.header), 0);
+      if (strncmp(index.header.magic, magic(), sizeof(index.header.magic))
+          != 0) {
+        close(fd);
+        throw std::runtime_error(fileName.str() + " is not an indexed hex file");
+      }
+
+      const HexFileHeader &h = index.header;
+      if (h.numLevels > uint32(MAX_HEX_LEVELS)
+          || !fits(h.levelTableOffset, h.numLevels, sizeof(HexLevelRun))
+          || !fits(h.blockTableOffset, h.numBlocks, sizeof(HexBlock))
+          || !fits(h.hexOffset, h.numHexes, sizeof(Hexahedron))
+          || !fits(h.indexOffset, h.numHexes, sizeof(uint64))) {
+        close(fd);
+        throw std::runtime_error(fileName.str()
+                                 + " is a truncated or corrupt indexed hex"
+                                   " file");
+      }
+
+      index.levels.resize(index.header.numLevels);
+      preadAll(fd,
+               index.levels.data(),
+               index.levels.size() * sizeof(HexLevelRun),
+               index.header.levelTableOffset);
+      index.blocks.resize(index.header.numBlocks);
+      preadAll(fd,
+               index.blocks.data(),
+               index.blocks.size() * sizeof(HexBlock),
+               index.header.blockTableOffset);
+      close(fd);
+
+      // and what the tables point at has to lie within the hexes
+      auto inHexes = [&](int level, uint64 first, uint64 count) {
+        return level >= 0 && level < MAX_HEX_LEVELS && first <= h.numHexes
+               && count <= h.numHexes - first;
+      };
+      bool valid = true;
+      for (const auto &run : index.levels)
+        valid = valid && inHexes(run.level, run.firstHex, run.numHexes);
+      for (const auto &block : index.blocks)
+        valid = valid && inHexes(block.level, block.firstHex, block.numHexes);
+      if (!valid) {
+        throw std::runtime_error(fileName.str()
+                                 + " is a truncated or corrupt indexed hex"
+                                   " file");
+      }
+      return index;
+    }
+
+    const HexLevelRun *HexIndex::findLevel(int level) const
+    {
+      for (const auto &run : levels) {
+        if (run.level == level)
+          return &run;
+      }
+      return nullptr;
+    }
+
+    int HexIndex::maxLevel() const
+    {
+      int maxLevel = 0;
+      for (const auto &run : levels)
+        maxLevel = std::max(maxLevel, run.level);
+      return maxLevel;
+    }
+
+    void HexIndex::readRange(uint64 firstHex,
+                             uint64 numHexes,
+                             Hexahedron *hexes,
+                             uint64 *originalIndex) const
+    {
+      int fd = open(fileName.c_str(), O_RDONLY);
+      if (fd == -1)
+        throw std::runtime_error("could not open " + fileName.str());
+      preadAll(fd,
+               hexes,
+               numHexes * sizeof(Hexahedron),
+               header.hexOffset + firstHex * sizeof(Hexahedron));
+      if (originalIndex) {
+        preadAll(fd,
+                 originalIndex,
+                 numHexes * sizeof(uint64),
+                 header.indexOffset + firstHex * sizeof(uint64));
+      }
+      close(fd);
+    }
+
+    void HexIndex::readLevel(int level,
+                             std::vector<Hexahedron> &hexes,
+                             std::vector<uint64> *originalIndex) const
+    {
+      const HexLevelRun *run = findLevel(level);
+      const uint64 numHexes  = run ? run->numHexes : 0;
+      hexes.resize(numHexes);
+      if (originalIndex)
+        originalIndex->resize(numHexes);
+      if (numHexes == 0)
+        return;
+      readRange(run->firstHex,
+                numHexes,
+                hexes.data(),
+                originalIndex ? originalIndex->data() : nullptr);
+    }
+
+    void HexIndex::readLevelRange(int level,
+                                  uint64 first,
+                                  uint64 count,
+                                  std::vector<Hexahedron> &hexes,
+                                  std::vector<uint64> *originalIndex) const
+    {
+      const HexLevelRun *run = findLevel(level);
+      const uint64 runHexes  = run ? run->numHexes : 0;
+      const uint64 numHexes =
+          first < runHexes ? std::min(count, runHexes - first) : 0;
+      hexes.resize(numHexes);
+      if (originalIndex)
+        originalIndex->resize(numHexes);
+      if (numHexes == 0)
+        return;
+      readRange(run->firstHex + first,
+                numHexes,
+                hexes.data(),
+                originalIndex ? originalIndex->data() : nullptr);
+    }
+
+    static inline bool overlaps(const box3i &a, const box3i &b)
+    {
+      return a.lower.x < b.upper.x && b.lower.x < a.upper.x
+             && a.lower.y < b.upper.y && b.lower.y < a.upper.y
+             && a.lower.z < b.upper.z && b.lower.z < a.upper.z;
+    }
+
+    void HexIndex::readRegion(const std::vector<box3i> &regions,
+                              std::vector<Hexahedron> &hexes,
+                              std::vector<uint64> *originalIndex,
+                              int level) const
+    {
+      hexes.clear();
+      if (originalIndex)
+        originalIndex->clear();
+
+      auto wanted = [&](const HexBlock &block) -> bool {
+        if (level != -1 && block.level != level)
+          return false;
+        for (const auto &r : regions) {
+          if (overlaps(block.bounds, r))
+            return true;
+        }
+        return false;
+      };
+
+      // coalesce consecutive wanted blocks into single reads
+      size_t b = 0;
+      while (b < blocks.size()) {
+        if (!wanted(blocks[b])) {
+          ++b;
+          continue;
+        }
+        const uint64 first = blocks[b].firstHex;
+        uint64 count       = 0;
+        while (b < blocks.size() && wanted(blocks[b])
+               && blocks[b].firstHex == first + count) {
+          count += blocks[b].numHexes;
+          ++b;
+        }
+
+        const size_t begin = hexes.size();
+        hexes.resize(begin + count);
+        if (originalIndex)
+          originalIndex->resize(begin + count);
+        readRange(first,
+                  count,
+                  hexes.data() + begin,
+                  originalIndex ? originalIndex->data() + begin : nullptr);
+      }
+    }
+
+    void convertHexFile(const FileName &rawFile,
+                        const FileName &indexedFile,
+                        uint32 blockSize)
+    {
+      if (blockSize == 0)
+        throw std::runtime_error("hexes per block must be at least 1");
+      int fd = open(rawFile.c_str(), O_RDONLY);
+      if (fd == -1)
+        throw std::runtime_error("could not open " + rawFile.str());
+      struct stat statBuf = {0};
+      fstat(fd, &statBuf);
+      const size_t numHexes = statBuf.st_size / sizeof(Hexahedron);
+      void *mapping =
+          mmap(NULL, statBuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (mapping == MAP_FAILED)
+        throw std::runtime_error("could not map " + rawFile.str());
+      const Hexahedron *hexes = static_cast<const Hexahedron *>(mapping);
+
+      // pass 1: per-chunk level histograms and bounds
+      struct ChunkStats
+      {
+        uint64 count[MAX_HEX_LEVELS];
+        box3i bounds[MAX_HEX_LEVELS];
+      };
+
+      const size_t chunkSize = 1 << 20;
+      const size_t numChunks = (numHexes + chunkSize - 1) / chunkSize;
+      std::vector<ChunkStats> stats(numChunks);
+      std::atomic<bool> badLevel(false);
+
+      tasking::parallel_for(numChunks, [&](size_t c) {
+        ChunkStats &s = stats[c];
+        std::fill(s.count, s.count + MAX_HEX_LEVELS, 0);
+        std::fill(s.bounds, s.bounds + MAX_HEX_LEVELS, box3i(empty));
+        const size_t end = std::min(numHexes, (c + 1) * chunkSize);
+        for (size_t i = c * chunkSize; i < end; ++i) {
+          const Hexahedron &h = hexes[i];
+          if (h.level < 0 || h.level >= MAX_HEX_LEVELS) {
+            badLevel = true;
+            continue;
+          }
+          s.count[h.level]++;
+          s.bounds[h.level].extend(hexBounds(h));
+        }
+      });
+
+      if (badLevel) {
+        munmap(mapping, statBuf.st_size);
+        throw std::runtime_error(rawFile.str() + " has invalid AMR levels");
+      }
+
+      // level directory and per (chunk, level) scatter offsets
+      HexFileHeader header{};
+      strcpy(header.magic, HexIndex::magic());
+      header.version   = 2;
+      header.numHexes  = numHexes;
+      header.blockSize = blockSize;
+
+      std::vector<HexLevelRun> levels;
+      std::vector<uint64> scatterOffset(numChunks * MAX_HEX_LEVELS);
+      box3i gridBounds(empty);
+      uint64 firstHex = 0;
+      for (int l = 0; l < MAX_HEX_LEVELS; ++l) {
+        HexLevelRun run{};
+        run.level    = l;
+        run.firstHex = firstHex;
+        run.bounds   = box3i(empty);
+        for (size_t c = 0; c < numChunks; ++c) {
+          scatterOffset[c * MAX_HEX_LEVELS + l] = firstHex + run.numHexes;
+          run.numHexes += stats[c].count[l];
+          run.bounds.extend(stats[c].bounds[l]);
+        }
+        if (run.numHexes == 0)
+          continue;
+        firstHex += run.numHexes;
+        gridBounds.extend(run.bounds);
+        header.numBlocks += (run.numHexes + blockSize - 1) / blockSize;
+        levels.push_back(run);
+      }
+      header.numLevels = levels.size();
+      header.gridMin   = gridBounds.lower;
+      header.gridMax   = gridBounds.upper;
+
+      header.levelTableOffset = sizeof(HexFileHeader);
+      header.blockTableOffset =
+          header.levelTableOffset + levels.size() * sizeof(HexLevelRun);
+      header.hexOffset = alignUp(
+          header.blockTableOffset + header.numBlocks * sizeof(HexBlock), 4096);
+      header.indexOffset =
+          alignUp(header.hexOffset + numHexes * sizeof(Hexahedron), 4096);
+      const size_t fileSize = header.indexOffset + numHexes * sizeof(uint64);
+
+      int outFd = open(indexedFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (outFd == -1 || ftruncate(outFd, fileSize) != 0) {
+        munmap(mapping, statBuf.st_size);
+        throw std::runtime_error("could not create " + indexedFile.str());
+      }
+      void *outMapping =
+          mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, outFd, 0);
+      close(outFd);
+      if (outMapping == MAP_FAILED) {
+        munmap(mapping, statBuf.st_size);
+        throw std::runtime_error("could not map " + indexedFile.str());
+      }
+      char *out = static_cast<char *>(outMapping);
+      Hexahedron *outHexes =
+          reinterpret_cast<Hexahedron *>(out + header.hexOffset);
+      uint64 *outIndex = reinterpret_cast<uint64 *>(out + header.indexOffset);
+
+      // pass 2: stable scatter by level, each chunk writes its own ranges
+      tasking::parallel_for(numChunks, [&](size_t c) {
+        uint64 *ofs      = &scatterOffset[c * MAX_HEX_LEVELS];
+        const size_t end = std::min(numHexes, (c + 1) * chunkSize);
+        for (size_t i = c * chunkSize; i < end; ++i) {
+          const uint64 dst = ofs[hexes[i].level]++;
+          outHexes[dst]    = hexes[i];
+          outIndex[dst]    = i;
+        }
+      });
+      munmap(mapping, statBuf.st_size);
+
+      // block table over the level sorted runs
+      std::vector<HexBlock> blocks;
+      blocks.reserve(header.numBlocks);
+      for (const auto &run : levels) {
+        for (uint64 b = 0; b < run.numHexes; b += blockSize) {
+          HexBlock block{};
+          block.firstHex = run.firstHex + b;
+          block.numHexes = std::min<uint64>(blockSize, run.numHexes - b);
+          block.level    = run.level;
+          blocks.push_back(block);
+        }
+      }
+
+      tasking::parallel_for(blocks.size(), [&](size_t b) {
+        HexBlock &block = blocks[b];
+        block.bounds    = box3i(empty);
+        for (uint64 i = 0; i < block.numHexes; ++i)
+          block.bounds.extend(hexBounds(outHexes[block.firstHex + i]));
+      });
+
+      memcpy(out, &header, sizeof(header));
+      memcpy(out + header.levelTableOffset,
+             levels.data(),
+             levels.size() * sizeof(HexLevelRun));
+      memcpy(out + header.blockTableOffset,
+             blocks.data(),
+             blocks.size() * sizeof(HexBlock));
+      munmap(outMapping, fileSize);
+
+      std::cout << "Wrote indexed hex file " << indexedFile << ": " << numHexes
+                << " hexes, " << levels.size() << " levels, " << blocks.size()
+                << " blocks\n";
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
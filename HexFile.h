@@ -0,0 +1,159 @@
+#ifndef HEXFILE_H_
+#define HEXFILE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ospcommon/FileName.h"
+#include "ospcommon/box.h"
+#include "ospcommon/common.h"
+#include "ospcommon/vec.h"
+
+using namespace ospcommon;
+
+namespace ospray {
+  namespace tamr {
+
+    //NATHAN: Looks like this maps to the Exajet file format. It specifies:
+    //* The lower left corner of the hex.
+    //* The AMR level.
+    struct Hexahedron
+    {
+      vec3i lower;
+      int level;
+    };
+
+    /*! levels are powers of two of the finest cell, so levels
+      0..MAX_HEX_LEVELS-1 cover int grids */
+    static const int MAX_HEX_LEVELS = 31;
+
+    /*! Indexed ("v2") hex container. Layout, all offsets in bytes from
+      the start of the file:
+
+        HexFileHeader
+        HexLevelRun[numLevels]
+        HexBlock[numBlocks]
+        Hexahedron[numHexes]      (at hexOffset, sorted by level)
+        uint64[numHexes]          (at indexOffset, position of each
+                                   hex in the original hexas.bin, i.e.
+                                   its index into the field files)
+
+      so a single level, or the blocks overlapping a region, can be
+      read with a seek instead of scanning the whole raw file */
+    struct HexFileHeader
+    {
+      char magic[8];
+      uint32 version;
+      uint32 numLevels;
+      uint64 numHexes;
+      //! min of all hexes' lower corners; the importers' amrOrigin
+      vec3i gridMin;
+      //! max over all hexes of lower + cell size
+      vec3i gridMax;
+      //! hexes per entry in the block table, blocks never span levels
+      uint32 blockSize;
+      uint32 pad;
+      uint64 numBlocks;
+      uint64 levelTableOffset;
+      uint64 blockTableOffset;
+      uint64 hexOffset;
+      uint64 indexOffset;
+    };
+
+    //! one contiguous run of same-level hexes in the container
+    struct HexLevelRun
+    {
+      int level;
+      uint32 pad;
+      //! first hex of this level in the sorted hex array
+      uint64 firstHex;
+      uint64 numHexes;
+      //! grid space bounds covered by this level's cells
+      box3i bounds;
+    };
+
+    struct HexBlock
+    {
+      uint64 firstHex;
+      uint32 numHexes;
+      int level;
+      box3i bounds;
+    };
+
+    /*! the header and directory of an indexed hex file; hex and index
+      data are read on demand */
+    struct HexIndex
+    {
+      static const char *magic() { return "EXAHEX2"; }
+
+      //! true if 'fileName' starts with an indexed container header
+      static bool isIndexedFile(const FileName &fileName);
+
+      /*! read header, level table and block table of a container;
+        throws if it can't be read or its tables don't fit the file */
+      static HexIndex read(const FileName &fileName);
+
+      //! returns nullptr if the file has no cells of 'level'
+      const HexLevelRun *findLevel(int level) const;
+
+      int maxLevel() const;
+
+      /*! read all hexes of one level; if 'originalIndex' is given it
+        receives each hex's index into the field files */
+      void readLevel(int level,
+                     std::vector<Hexahedron> &hexes,
+                     std::vector<uint64> *originalIndex = nullptr) const;
+
+      /*! read hexes [first, first + count) of one level's run, clamped
+        to the run, so a level can be streamed in bounded windows */
+      void readLevelRange(int level,
+                          uint64 first,
+                          uint64 count,
+                          std::vector<Hexahedron> &hexes,
+                          std::vector<uint64> *originalIndex = nullptr) const;
+
+      /*! read all hexes of the blocks overlapping any of 'regions'
+        (grid space), only from 'level' unless that is -1. This is block
+        granular, callers wanting exact results still have to filter */
+      void readRegion(const std::vector<box3i> &regions,
+                      std::vector<Hexahedron> &hexes,
+                      std::vector<uint64> *originalIndex = nullptr,
+                      int level                          = -1) const;
+
+      void readRegion(const box3i &region,
+                      std::vector<Hexahedron> &hexes,
+                      std::vector<uint64> *originalIndex = nullptr,
+                      int level                          = -1) const
+      {
+        readRegion(std::vector<box3i>(1, region), hexes, originalIndex, level);
+      }
+
+      FileName fileName;
+      HexFileHeader header;
+      std::vector<HexLevelRun> levels;
+      std::vector<HexBlock> blocks;
+
+     private:
+      void readRange(uint64 firstHex,
+                     uint64 numHexes,
+                     Hexahedron *hexes,
+                     uint64 *originalIndex) const;
+    };
+
+    /*! convert a raw hexas.bin into an indexed container, bucketing
+      and scattering the hexes by level in parallel. Throws if a file
+      can't be read or written, or 'blockSize' is 0 */
+    void convertHexFile(const FileName &rawFile,
+                        const FileName &indexedFile,
+                        uint32 blockSize = 1 << 16);
+
+    //! grid space bounds of the cell, i.e. [lower, lower + 2^level]
+    inline box3i hexBounds(const Hexahedron &h)
+    {
+      return box3i(h.lower, h.lower + vec3i(1 << h.level));
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
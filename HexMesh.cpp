@@ -0,0 +1,144 @@
+#include "HexMesh.h"
+
+#include <iostream>
+#include <limits>
+
+#include "HexConvert.h"
+
+// TODO: Using this vertex index re-mapping will help us save
+// a ton of memory and indices by re-using existing vertices, but will
+// really hurt load performance.
+#define REMAP_INDICES
+
+namespace ospray {
+  namespace tamr {
+
+    static const size_t HEX_BATCH_SIZE = 4096;
+
+    static const vec3i gridMin     = vec3i(1232128, 1259072, 1238336);
+    static const float voxelScale  = 0.0005;
+    static const vec3f worldMin    = vec3f(-1.73575, -9.44, -3.73281);
+
+    HexMesh::HexMesh(size_t memLimit,
+                     bool recordSources,
+                     HugePageMode hugePages)
+        : memLimit(memLimit),
+          recordSources(recordSources),
+          vertsMap(0,
+                   HashHexVert(),
+                   std::equal_to<HexVert>(),
+                   decltype(vertsMap)::allocator_type(
+                       hugePages == HugePageMode::Off
+                           ? nullptr
+                           : std::make_shared<HugePageArena>(hugePages))),
+          cornerKeys(8 * HEX_BATCH_SIZE),
+          cornerPos(8 * HEX_BATCH_SIZE)
+    {
+    }
+
+    box3f HexMesh::worldBounds(const box3i &bounds)
+    {
+      return box3f(vec3f(bounds.lower - gridMin) * voxelScale + worldMin,
+                   vec3f(bounds.upper - gridMin) * voxelScale + worldMin);
+    }
+
+    bool HexMesh::add(const Hexahedron &h, float cellValue, uint64 source)
+    {
+      if (stopped)
+        return false;
+      batchHexes.push_back(h);
+      batchValues.push_back(cellValue);
+      batchSources.push_back(source);
+      if (batchHexes.size() == HEX_BATCH_SIZE)
+        flush();
+      return !stopped;
+    }
+
+    void HexMesh::flush()
+    {
+      hexCorners(batchHexes.data(),
+                 batchHexes.size(),
+                 gridMin,
+                 voxelScale,
+                 worldMin,
+                 cornerKeys.data(),
+                 cornerPos.data());
+      for (size_t b = 0; b < batchHexes.size() && !stopped; ++b) {
+        stopped = !addCorners(&cornerKeys[8 * b],
+                              &cornerPos[8 * b],
+                              batchValues[b],
+                              batchSources[b]);
+      }
+      batchHexes.clear();
+      batchValues.clear();
+      batchSources.clear();
+    }
+
+    void HexMesh::reserve(size_t numCells)
+    {
+      indices.reserve(2 * numCells);
+      cellVals.reserve(numCells);
+      if (recordSources)
+        cellSource.reserve(numCells);
+    }
+
+    void HexMesh::adviseHugePages(HugePageMode mode) const
+    {
+      tamr::adviseHugePages(verts, mode);
+      tamr::adviseHugePages(indices, mode);
+      tamr::adviseHugePages(cellVals, mode);
+    }
+
+    // Appends one hex, given its corners from hexCorners(), and its field
+    // value; returns false once a size limit has been reached.
+    bool HexMesh::addCorners(const vec3i *cornerKeys,
+                             const vec3f *cornerPos,
+                             float cellValue,
+                             uint64 source)
+    {
+      if (verts.size() + 8 >= std::numeric_limits<int32_t>::max()) {
+        std::cout << "Index size limit reached, terminating mesh load\n";
+        return false;
+      }
+      // Pretty inefficient, no vertex re-use, but rendering the octree AMR
+      // as an unstructured mesh is a bad route anyways that we won't do
+      // beyond quick testing/previewing
+
+      // Verts ordering for a hex cell:
+      // four bottom verts counter-clockwise
+      // four top verts counter-clockwise
+      for (int k = 0; k < 2; ++k) {
+        vec4i idx;
+        for (int c = 0; c < 4; ++c) {
+          const vec3i &p        = cornerKeys[k * 4 + c];
+          const vec3f &worldPos = cornerPos[k * 4 + c];
+
+#ifdef REMAP_INDICES
+          HexVert hexVert(p);
+          auto fnd = vertsMap.find(hexVert);
+          if (fnd == vertsMap.end()) {
+            vertsMap[hexVert] = verts.size();
+            idx[c]            = verts.size();
+            verts.push_back(worldPos);
+          } else {
+            idx[c] = fnd->second;
+          }
+#else
+          idx[c] = verts.size();
+          verts.push_back(worldPos);
+#endif
+        }
+        indices.push_back(idx);
+      }
+      cellVals.push_back(cellValue);
+      if (recordSources)
+        cellSource.push_back(source);
+
+      const size_t memSize = verts.size() * sizeof(vec3f)
+                             + indices.size() * sizeof(vec4i)
+                             + cellVals.size() * sizeof(float);
+      return memLimit == 0 || memSize < memLimit;
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,106 @@
+#ifndef HEXMESH_H_
+#define HEXMESH_H_
+
+#include <vector>
+#include "HexFile.h"
+#include "HugePages.h"
+#include "ospcommon/containers/AlignedVector.h"
+#include "sparsepp/spp.h"
+
+namespace ospray {
+  namespace tamr {
+
+    struct HexVert
+    {
+      size_t x, y, z;
+      HexVert() : x(-1), y(-1), z(-1) {}
+      HexVert(size_t x, size_t y, size_t z) : x(x), y(y), z(z) {}
+      HexVert(const vec3i &v) : x(v.x), y(v.y), z(v.z) {}
+    };
+
+    inline bool operator==(const HexVert &a, const HexVert &b)
+    {
+      return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+
+    struct HashHexVert
+    {
+      // Hard to really decide how to hash each vert to a unique index,
+      // due to the AMR layout..
+      size_t operator()(const HexVert &a) const
+      {
+        return a.x + 1232128 * (a.y + a.z * 1259072);
+      }
+    };
+
+    /*! unstructured hex mesh for the exajet volume. Hexes are queued up
+      and converted to corner keys and world positions in batches by the
+      SIMD kernel, then the corners are deduplicated */
+    class HexMesh
+    {
+     public:
+      /*! 'memLimit' stops the mesh growing past that many bytes, 0 for
+        no limit; with 'recordSources' each cell's position in the hex
+        file is kept in cellSource. The vertex dedup map is allocated
+        from 'hugePages' pages */
+      HexMesh(size_t memLimit        = 0,
+              bool recordSources     = false,
+              HugePageMode hugePages = HugePageMode::Off);
+
+      /*! queue one hex, its cell value and its position in the hex and
+        field files; returns false once a size limit has been reached
+        and the load should stop */
+      bool add(const Hexahedron &h, float cellValue, uint64 source);
+
+      //! convert whatever is still queued, call once after the last add()
+      void flush();
+
+      /*! make room for 'numCells' cells up front, e.g. from a HexScan.
+        Only the per cell buffers are presized; how many vertices the
+        cells share isn't known until they're deduplicated */
+      void reserve(size_t numCells);
+
+      //! mark the output buffers as huge page eligible
+      void adviseHugePages(HugePageMode mode) const;
+
+      //! world space box of grid space 'bounds', as the vertices are placed
+      static box3f worldBounds(const box3i &bounds);
+
+      bool limitReached() const
+      {
+        return stopped;
+      }
+
+      ospcommon::containers::AlignedVector<vec3f> verts;
+      ospcommon::containers::AlignedVector<vec4i> indices;
+      ospcommon::containers::AlignedVector<float> cellVals;
+      std::vector<uint64> cellSource;
+
+     private:
+      bool addCorners(const vec3i *cornerKeys,
+                      const vec3f *cornerPos,
+                      float cellValue,
+                      uint64 source);
+
+      size_t memLimit;
+      bool recordSources;
+      bool stopped{false};
+
+      spp::sparse_hash_map<HexVert,
+                           int32_t,
+                           HashHexVert,
+                           std::equal_to<HexVert>,
+                           HugePageAllocator<std::pair<const HexVert, int32_t>>>
+          vertsMap;
+
+      std::vector<Hexahedron> batchHexes;
+      std::vector<float> batchValues;
+      std::vector<uint64> batchSources;
+      std::vector<vec3i> cornerKeys;
+      std::vector<vec3f> cornerPos;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,310 @@
+#include "HexParts.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "HexConvert.h"
+#include "HexCrop.h"
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    static const size_t BLOCK_SIZE = size_t(1) << 20;
+
+    bool isDirectory(const FileName &fileName)
+    {
+      struct stat statBuf = {0};
+      return stat(fileName.c_str(), &statBuf) == 0
+             && S_ISDIR(statBuf.st_mode);
+    }
+
+    std::vector<HexPart> listHexParts(const FileName &fileName,
+                                      const std::string &fieldName)
+    {
+      std::vector<HexPart> parts;
+      if (isDirectory(fileName)) {
+        const std::string dir = fileName.str() + "/";
+        DIR *d                = opendir(fileName.c_str());
+        if (!d)
+          throw std::runtime_error("can't list " + fileName.str());
+        std::vector<std::string> names;
+        while (const dirent *e = readdir(d)) {
+          const std::string name = e->d_name;
+          if (name.size() >= 9 && name.compare(0, 5, "hexas") == 0
+              && name.compare(name.size() - 4, 4, ".bin") == 0)
+            names.push_back(name);
+        }
+        closedir(d);
+        std::sort(names.begin(), names.end());
+        for (const auto &name : names) {
+          HexPart part;
+          part.hexFile   = dir + name;
+          part.fieldFile = dir + fieldName + name.substr(5);
+          parts.push_back(part);
+        }
+        return parts;
+      }
+
+      std::ifstream in(fileName.c_str());
+      if (!in)
+        throw std::runtime_error("can't read part list " + fileName.str());
+      const std::string dir = fileName.path().str();
+      auto resolve          = [&](const std::string &name) -> FileName {
+        return name[0] == '/' ? FileName(name) : FileName(dir + name);
+      };
+      std::string line;
+      while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string hexFile, fieldFile;
+        if (!(fields >> hexFile))
+          continue;
+        HexPart part;
+        part.hexFile = resolve(hexFile);
+        if (fields >> fieldFile)
+          part.fieldFile = resolve(fieldFile);
+        parts.push_back(part);
+      }
+      return parts;
+    }
+
+    //! a whole hex file mapped read-only
+    struct MappedHexes
+    {
+      explicit MappedHexes(const FileName &fileName)
+      {
+        fd = open(fileName.c_str(), O_RDONLY);
+        if (fd == -1)
+          throw std::runtime_error("can't open " + fileName.str());
+        struct stat statBuf = {0};
+        fstat(fd, &statBuf);
+        numHexes = statBuf.st_size / sizeof(Hexahedron);
+        if (numHexes == 0)
+          return;
+        void *mapping = mmap(NULL, numHexes * sizeof(Hexahedron), PROT_READ,
+                             MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+          close(fd);
+          throw std::runtime_error("can't map " + fileName.str());
+        }
+        madvise(mapping, numHexes * sizeof(Hexahedron), MADV_SEQUENTIAL);
+        hexes = static_cast<const Hexahedron *>(mapping);
+      }
+
+      ~MappedHexes()
+      {
+        if (hexes)
+          munmap((void *)hexes, numHexes * sizeof(Hexahedron));
+        if (fd != -1)
+          close(fd);
+      }
+
+      int fd{-1};
+      size_t numHexes{0};
+      const Hexahedron *hexes{nullptr};
+    };
+
+    // where the level's cells sit relative to their floored integer
+    // coordinates, see TAMRLevel_t::latticeOffset; floats have none
+    template <typename COORD_T>
+    static inline vec3f latticeOffsetOf(const Hexahedron &,
+                                        const vec_t<COORD_T, 3> &,
+                                        const vec_t<COORD_T, 3> &)
+    {
+      return vec3f(0.f);
+    }
+
+    static inline vec3f latticeOffsetOf(const Hexahedron &h,
+                                        const vec3i &voxelLower,
+                                        const vec3i &origin)
+    {
+      const vec3i rest = h.lower - origin - voxelLower * (1 << h.level);
+      return vec3f(rest) * (1.f / float(1 << h.level));
+    }
+
+    //! a block of one part's hexes, the unit of parallel work
+    template <typename COORD_T>
+    struct PartBlock
+    {
+      size_t part;
+      size_t begin;
+      size_t count;
+
+      // filled by the scan
+      vec3i minLower{INT_MAX};
+      int minLevel{0};
+      int maxLevel{0};
+      std::array<size_t, MAX_HEX_LEVELS> levelCount;
+
+      // filled by the bucketing
+      std::array<box_t<COORD_T, 3>, MAX_HEX_LEVELS> bounds;
+      std::array<vec3f, MAX_HEX_LEVELS> latticeOffset;
+      std::array<bool, MAX_HEX_LEVELS> offLattice;
+    };
+
+    template <typename COORD_T>
+    int loadHexParts(TAMRData_t<COORD_T> &data,
+                     const std::vector<HexPart> &parts,
+                     int keepLevel,
+                     const std::vector<box3i> &cropBoxes,
+                     HugePageMode hugePages)
+    {
+      using Vec   = vec_t<COORD_T, 3>;
+      using Block = PartBlock<COORD_T>;
+
+      std::vector<std::unique_ptr<MappedHexes>> files(parts.size());
+      tasking::parallel_for(parts.size(), [&](size_t p) {
+        try {
+          files[p].reset(new MappedHexes(parts[p].hexFile));
+        } catch (const std::runtime_error &) {
+        }
+      });
+
+      std::vector<Block> blocks;
+      std::vector<uint64> partFirst(parts.size() + 1, 0);
+      for (size_t p = 0; p < parts.size(); ++p) {
+        if (!files[p])
+          throw std::runtime_error("can't read " + parts[p].hexFile.str());
+        const size_t n   = files[p]->numHexes;
+        partFirst[p + 1] = partFirst[p] + n;
+        for (size_t begin = 0; begin < n; begin += BLOCK_SIZE) {
+          Block b;
+          b.part  = p;
+          b.begin = begin;
+          b.count = std::min(BLOCK_SIZE, n - begin);
+          blocks.push_back(b);
+        }
+      }
+
+      auto kept = [&](const Hexahedron &h) {
+        return (keepLevel == -1 || h.level == keepLevel)
+               && (cropBoxes.empty() || hexInCrop(h, cropBoxes));
+      };
+
+      tasking::parallel_for(blocks.size(), [&](size_t i) {
+        Block &b                = blocks[i];
+        const Hexahedron *hexes = files[b.part]->hexes + b.begin;
+        b.levelCount.fill(0);
+        for (size_t k = 0; k < b.count; ++k) {
+          const Hexahedron &h = hexes[k];
+          b.minLower          = min(b.minLower, h.lower);
+          b.minLevel          = std::min(b.minLevel, h.level);
+          b.maxLevel          = std::max(b.maxLevel, h.level);
+          if (h.level >= 0 && h.level < MAX_HEX_LEVELS && kept(h))
+            b.levelCount[h.level]++;
+        }
+      });
+
+      vec3i origin(INT_MAX);
+      int minLevel = 0;
+      int maxLevel = 0;
+      std::array<size_t, MAX_HEX_LEVELS> levelSize;
+      levelSize.fill(0);
+      // from here on a block's level counts are its first slots
+      for (auto &b : blocks) {
+        origin   = min(origin, b.minLower);
+        minLevel = std::min(minLevel, b.minLevel);
+        maxLevel = std::max(maxLevel, b.maxLevel);
+        for (int l = 0; l < MAX_HEX_LEVELS; ++l) {
+          const size_t count = b.levelCount[l];
+          b.levelCount[l]    = levelSize[l];
+          levelSize[l] += count;
+        }
+      }
+      // the bucketing below indexes by level, so no hex may be out of range
+      if (minLevel < 0 || maxLevel >= MAX_HEX_LEVELS)
+        throw std::runtime_error(
+            "hex level "
+            + std::to_string(minLevel < 0 ? minLevel : maxLevel)
+            + " out of range");
+      if (blocks.empty())
+        origin = vec3i(0);
+      data.amrOrigin = Vec(origin);
+
+      std::array<TAMRVoxel_t<COORD_T> *, MAX_HEX_LEVELS> out;
+      out.fill(nullptr);
+      for (int l = 0; l < MAX_HEX_LEVELS; ++l) {
+        if (levelSize[l] == 0)
+          continue;
+        auto &voxels = data.voxelsInLevel[l].voxels;
+        voxels.reserve(levelSize[l]);
+        adviseHugePages(voxels, hugePages);
+        voxels.resize(levelSize[l]);
+        out[l] = voxels.data();
+      }
+
+      tasking::parallel_for(blocks.size(), [&](size_t i) {
+        Block &b                = blocks[i];
+        const Hexahedron *hexes = files[b.part]->hexes + b.begin;
+        const uint64 first      = partFirst[b.part] + b.begin;
+        b.offLattice.fill(false);
+        std::vector<Vec> voxelLower(b.count);
+        hexesToVoxels(hexes, b.count, data.amrOrigin, voxelLower.data());
+
+        std::array<size_t, MAX_HEX_LEVELS> slot = b.levelCount;
+        for (size_t k = 0; k < b.count; ++k) {
+          const Hexahedron &h = hexes[k];
+          if (!kept(h))
+            continue;
+          const int l        = h.level;
+          const vec3f offset =
+              latticeOffsetOf(h, voxelLower[k], data.amrOrigin);
+          if (b.bounds[l].empty()) {
+            b.latticeOffset[l] = offset;
+          } else if (offset.x != b.latticeOffset[l].x
+                     || offset.y != b.latticeOffset[l].y
+                     || offset.z != b.latticeOffset[l].z) {
+            b.offLattice[l] = true;
+          }
+          b.bounds[l].extend(voxelLower[k]);
+
+          TAMRVoxel_t<COORD_T> &voxel = out[l][slot[l]++];
+          voxel.level                 = l;
+          voxel.lower                 = voxelLower[k];
+          voxel.indexInBuffer         = first + k;
+        }
+      });
+
+      for (const auto &b : blocks) {
+        for (int l = 0; l < MAX_HEX_LEVELS; ++l) {
+          if (b.bounds[l].empty())
+            continue;
+          TAMRLevel_t<COORD_T> &level = data.voxelsInLevel[l];
+          if (level.bounds.empty())
+            level.latticeOffset = b.latticeOffset[l];
+          if (b.offLattice[l] || b.latticeOffset[l].x != level.latticeOffset.x
+              || b.latticeOffset[l].y != level.latticeOffset.y
+              || b.latticeOffset[l].z != level.latticeOffset.z)
+            throw std::runtime_error("hexes of level " + std::to_string(l)
+                                     + " are not on a common lattice");
+          level.bounds.extend(b.bounds[l]);
+        }
+      }
+      return maxLevel;
+    }
+
+    template int loadHexParts<float>(TAMRData_t<float> &,
+                                     const std::vector<HexPart> &,
+                                     int,
+                                     const std::vector<box3i> &,
+                                     HugePageMode);
+    template int loadHexParts<int>(TAMRData_t<int> &,
+                                   const std::vector<HexPart> &,
+                                   int,
+                                   const std::vector<box3i> &,
+                                   HugePageMode);
+
+  }  // namespace tamr
+}  // namespace ospray
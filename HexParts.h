@@ -0,0 +1,73 @@
+#ifndef HEXPARTS_H_
+#define HEXPARTS_H_
+
+#include <string>
+#include <vector>
+#include "HexFile.h"
+#include "HugePages.h"
+#include "TAMRData.h"
+#include "ospcommon/FileName.h"
+
+using namespace ospcommon;
+
+namespace ospray {
+  namespace tamr {
+
+    //! one piece of a partitioned run, e.g. what one solver rank wrote
+    struct HexPart
+    {
+      FileName hexFile;
+      //! empty if the part has no field file
+      FileName fieldFile;
+    };
+
+    //! whether 'fileName' names a directory
+    bool isDirectory(const FileName &fileName);
+
+    /*! the hex/field file pairs of a partitioned run. 'fileName' is
+      either
+       - a directory: every hexas*.bin in it in name order, each paired
+         with the '<fieldName>' file of the same suffix, e.g.
+         hexas_0003.bin with y_vorticity_0003.bin, or
+       - a list file: one "hexFile [fieldFile]" pair per line, relative
+         to the list's directory, '#' starting a comment.
+      The hexes of all parts are numbered in part order, as if the files
+      were concatenated; that's the field index the importers record */
+    std::vector<HexPart> listHexParts(const FileName &fileName,
+                                      const std::string &fieldName);
+
+    /*! read the hex files of 'parts' and bucket their cells into 'data'
+      by level, without concatenating the parts first:
+       - all files are mapped and scanned in parallel blocks for their
+         min lower corner, max level and per-level counts; the min over
+         all blocks is data.amrOrigin
+       - a prefix sum over the blocks gives each block its slots in the
+         presized levels, which they then fill in parallel.
+      Voxels end up in part order, same as bucketHexes() over the
+      concatenated files. Only hexes of 'keepLevel' (-1 for all) and
+      overlapping 'cropBoxes' (if any) are kept, but the max level
+      returned is that of all hexes. Throws if a file can't be read, a
+      hex's level is out of range or, for int coordinates, a level's
+      cells aren't on a common lattice */
+    template <typename COORD_T>
+    int loadHexParts(TAMRData_t<COORD_T> &data,
+                     const std::vector<HexPart> &parts,
+                     int keepLevel,
+                     const std::vector<box3i> &cropBoxes,
+                     HugePageMode hugePages = HugePageMode::Off);
+
+    extern template int loadHexParts<float>(TAMRData_t<float> &,
+                                            const std::vector<HexPart> &,
+                                            int,
+                                            const std::vector<box3i> &,
+                                            HugePageMode);
+    extern template int loadHexParts<int>(TAMRData_t<int> &,
+                                          const std::vector<HexPart> &,
+                                          int,
+                                          const std::vector<box3i> &,
+                                          HugePageMode);
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,522 @@
+#include "HexScan.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEXSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    static const size_t BLOCK_SIZE = size_t(1) << 16;
+    // the slot of field values without a level, i.e. of an indexed file
+    static const int NO_LEVEL = MAX_HEX_LEVELS;
+
+    static const char *SIDECAR_MAGIC    = "EXASCAN";
+    static const uint32 SIDECAR_VERSION = 1;
+
+    struct HexScanHeader
+    {
+      char magic[8];
+      uint32 version;
+      uint32 numLevels;
+      uint64 hexFileSize;
+      int64 hexFileTime;
+      uint64 numHexes;
+      box3i gridBounds;
+      uint32 numFields;
+      uint32 pad;
+    };
+
+    //! one range of a field in the sidecar, level -1 is all cells
+    struct HexScanRange
+    {
+      int level;
+      uint32 pad;
+      uint64 count;
+      float lower;
+      float upper;
+      double mean;
+    };
+
+    //! a field's values of one level within a block
+    struct FieldAccumulator
+    {
+      uint64 count{0};
+      double sum{0.};
+      float lower{std::numeric_limits<float>::infinity()};
+      float upper{-std::numeric_limits<float>::infinity()};
+
+      void merge(const FieldAccumulator &other)
+      {
+        count += other.count;
+        sum += other.sum;
+        lower = std::min(lower, other.lower);
+        upper = std::max(upper, other.upper);
+      }
+
+      FieldStats stats() const
+      {
+        FieldStats s;
+        s.count = count;
+        if (count) {
+          s.range = range1f(lower, upper);
+          s.mean  = sum / count;
+        }
+        return s;
+      }
+    };
+
+    //! what a block of hexes and their values reduce to
+    struct BlockScan
+    {
+      explicit BlockScan(size_t numFields)
+          : field(numFields * (MAX_HEX_LEVELS + 1))
+      {
+        std::fill(count, count + MAX_HEX_LEVELS, 0);
+        for (int l = 0; l < MAX_HEX_LEVELS; ++l) {
+          std::fill(minLower[l], minLower[l] + 4, INT_MAX);
+          std::fill(maxLower[l], maxLower[l] + 4, INT_MIN);
+        }
+      }
+
+      void merge(const BlockScan &other)
+      {
+        badLevel |= other.badLevel;
+        for (int l = 0; l < MAX_HEX_LEVELS; ++l) {
+          count[l] += other.count[l];
+          for (int c = 0; c < 4; ++c) {
+            minLower[l][c] = std::min(minLower[l][c], other.minLower[l][c]);
+            maxLower[l][c] = std::max(maxLower[l][c], other.maxLower[l][c]);
+          }
+        }
+        for (size_t i = 0; i < field.size(); ++i)
+          field[i].merge(other.field[i]);
+      }
+
+      uint64 count[MAX_HEX_LEVELS];
+      // min and max of each level's whole records; the 4th lane is the
+      // level itself and goes unused
+      alignas(16) int minLower[MAX_HEX_LEVELS][4];
+      alignas(16) int maxLower[MAX_HEX_LEVELS][4];
+      bool badLevel{false};
+      //! [field * (MAX_HEX_LEVELS + 1) + level]
+      std::vector<FieldAccumulator> field;
+    };
+
+    static void scanHexesScalar(const Hexahedron *hexes,
+                                size_t n,
+                                BlockScan &s)
+    {
+      for (size_t i = 0; i < n; ++i) {
+        const Hexahedron &h = hexes[i];
+        if (uint32(h.level) >= uint32(MAX_HEX_LEVELS)) {
+          s.badLevel = true;
+          continue;
+        }
+        s.count[h.level]++;
+        int *lo = s.minLower[h.level];
+        int *hi = s.maxLower[h.level];
+        lo[0]   = std::min(lo[0], h.lower.x);
+        lo[1]   = std::min(lo[1], h.lower.y);
+        lo[2]   = std::min(lo[2], h.lower.z);
+        hi[0]   = std::max(hi[0], h.lower.x);
+        hi[1]   = std::max(hi[1], h.lower.y);
+        hi[2]   = std::max(hi[2], h.lower.z);
+      }
+    }
+
+#ifdef HEXSCAN_X86
+    // a Hexahedron is exactly one 128 bit lane
+    __attribute__((target("sse4.1"))) static void scanHexesSSE41(
+        const Hexahedron *hexes, size_t n, BlockScan &s)
+    {
+      for (size_t i = 0; i < n; ++i) {
+        const int level = hexes[i].level;
+        if (uint32(level) >= uint32(MAX_HEX_LEVELS)) {
+          s.badLevel = true;
+          continue;
+        }
+        s.count[level]++;
+        const __m128i h =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(hexes + i));
+        __m128i *lo = reinterpret_cast<__m128i *>(s.minLower[level]);
+        __m128i *hi = reinterpret_cast<__m128i *>(s.maxLower[level]);
+        _mm_store_si128(lo, _mm_min_epi32(_mm_load_si128(lo), h));
+        _mm_store_si128(hi, _mm_max_epi32(_mm_load_si128(hi), h));
+      }
+    }
+#endif
+
+    static void scanHexes(const Hexahedron *hexes, size_t n, BlockScan &s)
+    {
+#ifdef HEXSCAN_X86
+      static const bool hasSSE41 = __builtin_cpu_supports("sse4.1");
+      if (hasSSE41)
+        return scanHexesSSE41(hexes, n, s);
+#endif
+      scanHexesScalar(hexes, n, s);
+    }
+
+    // values of one field, by their hex's level if 'hexes' is given
+    static void scanValues(const float *values,
+                           const Hexahedron *hexes,
+                           size_t n,
+                           FieldAccumulator *levels)
+    {
+      for (size_t i = 0; i < n; ++i) {
+        const float v = values[i];
+        if (v != v)
+          continue;
+        const int level = hexes ? hexes[i].level : NO_LEVEL;
+        if (uint32(level) > uint32(NO_LEVEL))
+          continue;
+        FieldAccumulator &acc = levels[level];
+        acc.count++;
+        acc.sum += v;
+        acc.lower = std::min(acc.lower, v);
+        acc.upper = std::max(acc.upper, v);
+      }
+    }
+
+    const HexScanLevel *HexScan::findLevel(int level) const
+    {
+      for (const auto &lv : levels) {
+        if (lv.level == level)
+          return &lv;
+      }
+      return nullptr;
+    }
+
+    int HexScan::maxLevel() const
+    {
+      return levels.empty() ? 0 : levels.back().level;
+    }
+
+    FileName HexScan::sidecarName(const FileName &hexFile)
+    {
+      return hexFile.str() + ".scan";
+    }
+
+    static void statFile(const FileName &fileName, uint64 &size, int64 &time)
+    {
+      struct stat statBuf = {0};
+      if (stat(fileName.c_str(), &statBuf) != 0)
+        throw std::runtime_error("could not stat " + fileName.str());
+      size = statBuf.st_size;
+      time = statBuf.st_mtime;
+    }
+
+    void HexScan::writeSidecar(const FileName &hexFile) const
+    {
+      const FileName fileName = sidecarName(hexFile);
+      std::ofstream out(fileName.c_str(), std::ios::binary);
+      if (!out)
+        throw std::runtime_error("could not create " + fileName.str());
+
+      HexScanHeader header{};
+      strcpy(header.magic, SIDECAR_MAGIC);
+      header.version     = SIDECAR_VERSION;
+      header.numLevels   = levels.size();
+      header.hexFileSize = hexFileSize;
+      header.hexFileTime = hexFileTime;
+      header.numHexes    = numHexes;
+      header.gridBounds  = gridBounds;
+      header.numFields   = fields.size();
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      out.write(reinterpret_cast<const char *>(levels.data()),
+                levels.size() * sizeof(HexScanLevel));
+
+      auto toRange = [](int level, const FieldStats &s) {
+        HexScanRange r{};
+        r.level = level;
+        r.count = s.count;
+        r.lower = s.range.lower;
+        r.upper = s.range.upper;
+        r.mean  = s.mean;
+        return r;
+      };
+      for (const auto &f : fields) {
+        // fields are kept next to their hex file, so the name will do
+        const std::string name = f.fileName.name();
+        const uint32 nameLength = name.size();
+        out.write(reinterpret_cast<const char *>(&nameLength),
+                  sizeof(nameLength));
+        out.write(name.data(), nameLength);
+        out.write(reinterpret_cast<const char *>(&f.numValues),
+                  sizeof(f.numValues));
+        std::vector<HexScanRange> ranges(1, toRange(-1, f.all));
+        for (const auto &l : f.perLevel)
+          ranges.push_back(toRange(l.first, l.second));
+        const uint32 numRanges = ranges.size();
+        out.write(reinterpret_cast<const char *>(&numRanges),
+                  sizeof(numRanges));
+        out.write(reinterpret_cast<const char *>(ranges.data()),
+                  ranges.size() * sizeof(HexScanRange));
+      }
+      if (!out)
+        throw std::runtime_error("could not write " + fileName.str());
+    }
+
+    bool HexScan::readSidecar(const FileName &hexFile, HexScan &scan)
+    {
+      std::ifstream in(sidecarName(hexFile).c_str(), std::ios::binary);
+      if (!in)
+        return false;
+      auto read = [&](void *dst, size_t bytes) {
+        return bool(in.read(static_cast<char *>(dst), bytes));
+      };
+
+      HexScanHeader header;
+      if (!read(&header, sizeof(header))
+          || strncmp(header.magic, SIDECAR_MAGIC, sizeof(header.magic)) != 0
+          || header.version != SIDECAR_VERSION)
+        return false;
+      uint64 size = 0;
+      int64 time  = 0;
+      try {
+        statFile(hexFile, size, time);
+      } catch (const std::runtime_error &) {
+        return false;
+      }
+      if (size != header.hexFileSize || time != header.hexFileTime)
+        return false;
+
+      // nothing is sized by the header before it is known to fit the file
+      const std::streamoff start = in.tellg();
+      in.seekg(0, std::ios::end);
+      const uint64 rest = uint64(in.tellg() - start);
+      in.seekg(start);
+      // name length, value count and range count, and at least one range
+      const size_t minFieldBytes = sizeof(uint32) + sizeof(uint64)
+                                   + sizeof(uint32) + sizeof(HexScanRange);
+      if (!in || header.numLevels > uint32(MAX_HEX_LEVELS)
+          || header.numLevels * sizeof(HexScanLevel) > rest
+          || header.numFields
+                 > (rest - header.numLevels * sizeof(HexScanLevel))
+                       / minFieldBytes)
+        return false;
+
+      HexScan s;
+      s.hexFileSize = header.hexFileSize;
+      s.hexFileTime = header.hexFileTime;
+      s.numHexes    = header.numHexes;
+      s.gridBounds  = header.gridBounds;
+      s.levels.resize(header.numLevels);
+      if (!read(s.levels.data(), s.levels.size() * sizeof(HexScanLevel)))
+        return false;
+      for (const auto &lv : s.levels) {
+        if (lv.level < 0 || lv.level >= MAX_HEX_LEVELS)
+          return false;
+      }
+      s.fields.resize(header.numFields);
+      for (auto &f : s.fields) {
+        uint32 nameLength = 0;
+        if (!read(&nameLength, sizeof(nameLength)) || nameLength > 4096)
+          return false;
+        std::string name(nameLength, '\0');
+        uint32 numRanges = 0;
+        if (!read(&name[0], nameLength)
+            || !read(&f.numValues, sizeof(f.numValues))
+            || !read(&numRanges, sizeof(numRanges)) || numRanges == 0
+            || numRanges > uint32(MAX_HEX_LEVELS + 1))
+          return false;
+        std::vector<HexScanRange> ranges(numRanges);
+        if (!read(ranges.data(), ranges.size() * sizeof(HexScanRange)))
+          return false;
+        f.fileName = hexFile.path().str() + name;
+        for (const auto &r : ranges) {
+          if (r.level < -1 || r.level >= MAX_HEX_LEVELS)
+            return false;
+          FieldStats &stats = r.level == -1 ? f.all : f.perLevel[r.level];
+          stats.count       = r.count;
+          if (r.count)
+            stats.range = range1f(r.lower, r.upper);
+          stats.mean = r.mean;
+        }
+      }
+      scan = std::move(s);
+      return true;
+    }
+
+    void HexScan::print(std::ostream &out) const
+    {
+      out << "#hexes: " << numHexes << "\n"
+          << "grid bounds: " << gridBounds << "\n";
+      for (const auto &lv : levels) {
+        out << "level " << lv.level << ": " << lv.numHexes << " hexes, bounds "
+            << lv.bounds << "\n";
+      }
+      for (const auto &f : fields) {
+        out << "field " << f.fileName.str() << ": " << f.numValues
+            << " values";
+        if (f.numValues != numHexes)
+          out << " (" << numHexes << " hexes!)";
+        out << ", range [" << f.all.range.lower << ", " << f.all.range.upper
+            << "], mean " << f.all.mean << " over " << f.all.count
+            << " finite values\n";
+        for (const auto &l : f.perLevel) {
+          out << "  level " << l.first << ": range [" << l.second.range.lower
+              << ", " << l.second.range.upper << "], mean " << l.second.mean
+              << "\n";
+        }
+      }
+    }
+
+    HexScan scanHexFile(const FileName &hexFile,
+                        const std::vector<FileName> &fieldFiles,
+                        IOMode ioMode,
+                        size_t chunkBytes,
+                        HugePageMode hugePages)
+    {
+      HexScan scan;
+      statFile(hexFile, scan.hexFileSize, scan.hexFileTime);
+
+      // the level table of an indexed file has everything but the fields
+      const bool indexed = HexIndex::isIndexedFile(hexFile);
+      if (indexed) {
+        const HexIndex index = HexIndex::read(hexFile);
+        scan.numHexes        = index.header.numHexes;
+        scan.gridBounds = box3i(index.header.gridMin, index.header.gridMax);
+        for (const auto &run : index.levels) {
+          HexScanLevel lv{};
+          lv.level    = run.level;
+          lv.numHexes = run.numHexes;
+          lv.bounds   = run.bounds;
+          scan.levels.push_back(lv);
+        }
+        std::sort(scan.levels.begin(),
+                  scan.levels.end(),
+                  [](const HexScanLevel &a, const HexScanLevel &b) {
+                    return a.level < b.level;
+                  });
+      }
+
+      const size_t hexesPerChunk =
+          std::max(chunkBytes / sizeof(Hexahedron), size_t(1));
+      std::unique_ptr<ChunkReader> hexReader;
+      if (!indexed) {
+        hexReader.reset(new ChunkReader(hexFile,
+                                        ioMode,
+                                        hexesPerChunk * sizeof(Hexahedron),
+                                        3,
+                                        hugePages));
+        if (!hexReader->valid())
+          throw std::runtime_error("could not open " + hexFile.str());
+        scan.numHexes = hexReader->fileSize() / sizeof(Hexahedron);
+      }
+
+      const size_t numFields = fieldFiles.size();
+      std::vector<std::unique_ptr<ChunkReader>> fieldReaders;
+      for (const auto &fieldFile : fieldFiles) {
+        fieldReaders.emplace_back(new ChunkReader(
+            fieldFile, ioMode, hexesPerChunk * sizeof(float), 3, hugePages));
+        if (!fieldReaders.back()->valid())
+          throw std::runtime_error("could not open " + fieldFile.str());
+      }
+
+      // chunk by chunk in lockstep; each chunk is reduced in parallel
+      // blocks, which are then merged into the totals
+      BlockScan total(numFields);
+      std::vector<const float *> values(numFields);
+      std::vector<size_t> numValues(numFields);
+      while (true) {
+        const Hexahedron *hexes = nullptr;
+        size_t numHexes         = 0;
+        size_t bytes            = 0;
+        if (hexReader) {
+          hexes = static_cast<const Hexahedron *>(hexReader->next(bytes));
+          if (!hexes)
+            break;
+          numHexes = bytes / sizeof(Hexahedron);
+        }
+        size_t n = numHexes;
+        for (size_t f = 0; f < numFields; ++f) {
+          values[f] =
+              static_cast<const float *>(fieldReaders[f]->next(bytes));
+          numValues[f] = values[f] ? bytes / sizeof(float) : 0;
+          // values past the end of the hexes have no level to go with
+          if (hexes)
+            numValues[f] = std::min(numValues[f], numHexes);
+          n = std::max(n, numValues[f]);
+        }
+        if (n == 0)
+          break;
+
+        const size_t numBlocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        std::vector<BlockScan> blocks(numBlocks, BlockScan(numFields));
+        tasking::parallel_for(numBlocks, [&](size_t b) {
+          BlockScan &s       = blocks[b];
+          const size_t begin = b * BLOCK_SIZE;
+          if (begin < numHexes) {
+            scanHexes(hexes + begin,
+                      std::min(BLOCK_SIZE, numHexes - begin),
+                      s);
+          }
+          for (size_t f = 0; f < numFields; ++f) {
+            if (begin >= numValues[f])
+              continue;
+            scanValues(values[f] + begin,
+                       hexes ? hexes + begin : nullptr,
+                       std::min(BLOCK_SIZE, numValues[f] - begin),
+                       &s.field[f * (MAX_HEX_LEVELS + 1)]);
+          }
+        });
+        for (const auto &s : blocks)
+          total.merge(s);
+      }
+
+      if (total.badLevel)
+        throw std::runtime_error(hexFile.str() + " has invalid AMR levels");
+
+      if (!indexed) {
+        scan.gridBounds = box3i(empty);
+        for (int l = 0; l < MAX_HEX_LEVELS; ++l) {
+          if (total.count[l] == 0)
+            continue;
+          HexScanLevel lv{};
+          lv.level    = l;
+          lv.numHexes = total.count[l];
+          const int *lo = total.minLower[l];
+          const int *hi = total.maxLower[l];
+          lv.bounds = box3i(vec3i(lo[0], lo[1], lo[2]),
+                            vec3i(hi[0], hi[1], hi[2]) + vec3i(1 << l));
+          scan.gridBounds.extend(lv.bounds);
+          scan.levels.push_back(lv);
+        }
+        if (scan.levels.empty())
+          scan.gridBounds = box3i(vec3i(0), vec3i(0));
+      }
+
+      for (size_t f = 0; f < numFields; ++f) {
+        HexScanField field;
+        field.fileName  = fieldFiles[f];
+        field.numValues = fieldReaders[f]->fileSize() / sizeof(float);
+        const FieldAccumulator *levels = &total.field[f * (MAX_HEX_LEVELS + 1)];
+        FieldAccumulator all;
+        for (int l = 0; l <= NO_LEVEL; ++l) {
+          all.merge(levels[l]);
+          if (l != NO_LEVEL && levels[l].count)
+            field.perLevel[l] = levels[l].stats();
+        }
+        field.all = all.stats();
+        scan.fields.push_back(field);
+      }
+      return scan;
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
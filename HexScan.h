@@ -0,0 +1,96 @@
+#ifndef HEXSCAN_H_
+#define HEXSCAN_H_
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+#include "ChunkReader.h"
+#include "FieldStats.h"
+#include "HexFile.h"
+#include "ospcommon/FileName.h"
+
+using namespace ospcommon;
+
+namespace ospray {
+  namespace tamr {
+
+    //! the cells of one level of a scanned hex file
+    struct HexScanLevel
+    {
+      int level;
+      uint32 pad;
+      uint64 numHexes;
+      //! grid space bounds covered by the level's cells
+      box3i bounds;
+    };
+
+    //! a cell field scanned along with the hexes
+    struct HexScanField
+    {
+      FileName fileName;
+      uint64 numValues{0};
+      //! over all cells; histograms are left empty
+      FieldStats all;
+      /*! per level; empty for indexed hex files, whose hexes aren't in
+        field order */
+      std::map<int, FieldStats> perLevel;
+    };
+
+    /*! what an import needs to know about a hex file up front, gathered
+      without building any voxels or meshes. The hexes and fields are
+      streamed through a ChunkReader and each chunk is reduced in
+      parallel blocks; the per-level min/max of the hexes is taken on
+      whole 16 byte records with SSE4.1 where available. An indexed
+      file's level table already has the hex facts, so only its fields
+      are read.
+
+      The result can be kept in a sidecar next to the hex file, which
+      later imports of that file use to presize their buffers */
+    struct HexScan
+    {
+      //! size and modification time of the scanned hex file
+      uint64 hexFileSize{0};
+      int64 hexFileTime{0};
+
+      uint64 numHexes{0};
+      /*! grid space bounds of all cells; the lower corner is the grid
+        origin */
+      box3i gridBounds;
+      //! levels present, in increasing order
+      std::vector<HexScanLevel> levels;
+      std::vector<HexScanField> fields;
+
+      //! returns nullptr if no cells of 'level' were seen
+      const HexScanLevel *findLevel(int level) const;
+      int maxLevel() const;
+
+      //! the sidecar of 'hexFile', "<hexFile>.scan"
+      static FileName sidecarName(const FileName &hexFile);
+
+      /*! write the scan to the sidecar of 'hexFile'; throws if it can't
+        be written */
+      void writeSidecar(const FileName &hexFile) const;
+
+      /*! read the sidecar of 'hexFile' into 'scan'. False if there is
+        none, it can't be read or is corrupt, or 'hexFile' changed since
+        the scan */
+      static bool readSidecar(const FileName &hexFile, HexScan &scan);
+
+      //! print counts, bounds and field ranges per level
+      void print(std::ostream &out) const;
+    };
+
+    /*! scan a raw or indexed hex file and the given field files, one
+      float per hex. Throws if a file can't be read or a hex has an
+      invalid level */
+    HexScan scanHexFile(const FileName &hexFile,
+                        const std::vector<FileName> &fieldFiles,
+                        IOMode ioMode,
+                        size_t chunkBytes,
+                        HugePageMode hugePages = HugePageMode::Off);
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
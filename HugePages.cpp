@@ -0,0 +1,244 @@
+#include "HugePages.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace ospray {
+  namespace tamr {
+
+    static const size_t SIZE_2M = size_t(1) << 21;
+    static const size_t SIZE_1G = size_t(1) << 30;
+
+    static inline size_t roundUp(size_t x, size_t alignment)
+    {
+      return (x + alignment - 1) / alignment * alignment;
+    }
+
+    // arena blocks come in 16 byte steps up to 4KB, then in powers of two
+    // up to 1MB; larger ones get a buffer of their own
+    static const size_t ARENA_GRAIN       = 16;
+    static const size_t ARENA_SMALL       = 4096;
+    static const size_t ARENA_LARGE       = size_t(1) << 20;
+    static const size_t ARENA_NUM_CLASSES = ARENA_SMALL / ARENA_GRAIN + 8;
+    static const size_t ARENA_SLAB        = size_t(64) << 20;
+
+    static size_t arenaClass(size_t bytes, size_t &classBytes)
+    {
+      if (bytes <= ARENA_SMALL) {
+        classBytes = roundUp(std::max(bytes, size_t(1)), ARENA_GRAIN);
+        return classBytes / ARENA_GRAIN - 1;
+      }
+      size_t c   = ARENA_SMALL / ARENA_GRAIN;
+      classBytes = 2 * ARENA_SMALL;
+      while (classBytes < bytes) {
+        classBytes *= 2;
+        ++c;
+      }
+      return c;
+    }
+
+    HugePageMode parseHugePageMode(const std::string &name)
+    {
+      if (name.empty() || name == "off")
+        return HugePageMode::Off;
+      if (name == "thp" || name == "transparent")
+        return HugePageMode::Transparent;
+      if (name == "2m" || name == "2M")
+        return HugePageMode::Huge2M;
+      if (name == "1g" || name == "1G")
+        return HugePageMode::Huge1G;
+      throw std::runtime_error("unknown huge page mode '" + name + "'");
+    }
+
+    const char *toString(HugePageMode mode)
+    {
+      switch (mode) {
+      case HugePageMode::Transparent:
+        return "thp";
+      case HugePageMode::Huge2M:
+        return "2m";
+      case HugePageMode::Huge1G:
+        return "1g";
+      default:
+        return "off";
+      }
+    }
+
+    HugePageBuffer::HugePageBuffer(size_t bytes, HugePageMode mode)
+        : bytes(bytes)
+    {
+      if (bytes == 0)
+        return;
+
+      const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+      if (mode == HugePageMode::Huge1G) {
+        mappedBytes = roundUp(bytes, SIZE_1G);
+        ptr         = mmap(NULL,
+                   mappedBytes,
+                   PROT_READ | PROT_WRITE,
+                   flags | MAP_HUGETLB | MAP_HUGE_1GB,
+                   -1,
+                   0);
+        if (ptr != MAP_FAILED) {
+          this->mode = HugePageMode::Huge1G;
+          return;
+        }
+        mode = HugePageMode::Huge2M;
+      }
+
+      if (mode == HugePageMode::Huge2M) {
+        mappedBytes = roundUp(bytes, SIZE_2M);
+        ptr         = mmap(NULL,
+                   mappedBytes,
+                   PROT_READ | PROT_WRITE,
+                   flags | MAP_HUGETLB | MAP_HUGE_2MB,
+                   -1,
+                   0);
+        if (ptr != MAP_FAILED) {
+          this->mode = HugePageMode::Huge2M;
+          return;
+        }
+        mode = HugePageMode::Transparent;
+      }
+
+      // over-allocate by 2MB so the buffer can start on a 2MB boundary,
+      // which is what lets THP cover it from the first byte
+      const bool thp = mode == HugePageMode::Transparent;
+      mappedBytes    = thp ? roundUp(bytes, SIZE_2M) + SIZE_2M : bytes;
+      void *base =
+          mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if (base == MAP_FAILED) {
+        ptr = nullptr;
+        throw std::bad_alloc();
+      }
+
+      if (!thp) {
+        ptr = base;
+        return;
+      }
+
+      uintptr_t aligned = roundUp(uintptr_t(base), SIZE_2M);
+      const size_t head = aligned - uintptr_t(base);
+      const size_t tail = mappedBytes - head - roundUp(bytes, SIZE_2M);
+      if (head)
+        munmap(base, head);
+      if (tail)
+        munmap((char *)aligned + roundUp(bytes, SIZE_2M), tail);
+      mappedBytes = roundUp(bytes, SIZE_2M);
+      ptr         = (void *)aligned;
+      madvise(ptr, mappedBytes, MADV_HUGEPAGE);
+      this->mode = HugePageMode::Transparent;
+    }
+
+    HugePageBuffer::HugePageBuffer(HugePageBuffer &&other)
+    {
+      *this = std::move(other);
+    }
+
+    HugePageBuffer &HugePageBuffer::operator=(HugePageBuffer &&other)
+    {
+      if (this != &other) {
+        release();
+        ptr               = other.ptr;
+        bytes             = other.bytes;
+        mappedBytes       = other.mappedBytes;
+        mode              = other.mode;
+        other.ptr         = nullptr;
+        other.bytes       = 0;
+        other.mappedBytes = 0;
+      }
+      return *this;
+    }
+
+    HugePageBuffer::~HugePageBuffer()
+    {
+      release();
+    }
+
+    void HugePageBuffer::release()
+    {
+      if (ptr)
+        munmap(ptr, mappedBytes);
+      ptr = nullptr;
+    }
+
+    HugePageArena::HugePageArena(HugePageMode mode)
+        : mode(mode),
+          slabBytes(mode == HugePageMode::Huge1G ? SIZE_1G : ARENA_SLAB),
+          freeLists(ARENA_NUM_CLASSES, nullptr)
+    {
+    }
+
+    void *HugePageArena::allocate(size_t bytes)
+    {
+      if (bytes > ARENA_LARGE) {
+        // a gigabyte page only for what fills at least half of one
+        const HugePageMode bufferMode =
+            mode == HugePageMode::Huge1G && bytes < SIZE_1G / 2
+                ? HugePageMode::Huge2M
+                : mode;
+        HugePageBuffer buffer(bytes, bufferMode);
+        void *ptr = buffer.data();
+        large.emplace(ptr, std::move(buffer));
+        return ptr;
+      }
+
+      size_t classBytes = 0;
+      const size_t c    = arenaClass(bytes, classBytes);
+      if (void *ptr = freeLists[c]) {
+        freeLists[c] = *static_cast<void **>(ptr);
+        return ptr;
+      }
+      if (classBytes > slabLeft) {
+        // what's left of the last slab is given up
+        slabs.emplace_back(slabBytes, mode);
+        slabNext = static_cast<char *>(slabs.back().data());
+        slabLeft = slabBytes;
+      }
+      void *ptr = slabNext;
+      slabNext += classBytes;
+      slabLeft -= classBytes;
+      return ptr;
+    }
+
+    void HugePageArena::deallocate(void *ptr, size_t bytes)
+    {
+      if (!ptr)
+        return;
+      if (bytes > ARENA_LARGE) {
+        large.erase(ptr);
+        return;
+      }
+      size_t classBytes = 0;
+      const size_t c    = arenaClass(bytes, classBytes);
+
+      *static_cast<void **>(ptr) = freeLists[c];
+      freeLists[c]               = ptr;
+    }
+
+    void adviseHugePages(const void *ptr, size_t bytes, HugePageMode mode)
+    {
+      if (mode == HugePageMode::Off || !ptr)
+        return;
+
+      const uintptr_t begin = roundUp(uintptr_t(ptr), SIZE_2M);
+      const uintptr_t end   = (uintptr_t(ptr) + bytes) / SIZE_2M * SIZE_2M;
+      if (end > begin)
+        madvise((void *)begin, end - begin, MADV_HUGEPAGE);
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,197 @@
+#ifndef HUGEPAGES_H_
+#define HUGEPAGES_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ospray {
+  namespace tamr {
+
+    /*! page size used for the large import buffers and mappings.
+      Transparent: normal allocations marked MADV_HUGEPAGE so the kernel
+                   backs them with 2MB pages when it can
+      Huge2M/1G:   explicit MAP_HUGETLB pages from the hugetlbfs pool for
+                   memory allocated as a HugePageBuffer (the pread ring
+                   buffers) or from a HugePageArena (the vertex dedup
+                   map); these fall back to the next smaller page size,
+                   and finally to Transparent, if the pool is empty.
+                   Memory that already exists (vectors, file mappings)
+                   can only be advised, so there they are the same
+                   Transparent hint */
+    enum class HugePageMode
+    {
+      Off,
+      Transparent,
+      Huge2M,
+      Huge1G
+    };
+
+    HugePageMode parseHugePageMode(const std::string &name);
+    const char *toString(HugePageMode mode);
+
+    /*! anonymous read/write memory backed according to a HugePageMode.
+      'mode' reports what the allocation actually got after fallbacks */
+    class HugePageBuffer
+    {
+     public:
+      HugePageBuffer() = default;
+      HugePageBuffer(size_t bytes, HugePageMode mode);
+      HugePageBuffer(HugePageBuffer &&other);
+      HugePageBuffer &operator=(HugePageBuffer &&other);
+      HugePageBuffer(const HugePageBuffer &) = delete;
+      HugePageBuffer &operator=(const HugePageBuffer &) = delete;
+      ~HugePageBuffer();
+
+      void *data() const
+      {
+        return ptr;
+      }
+
+      size_t size() const
+      {
+        return bytes;
+      }
+
+      HugePageMode mode{HugePageMode::Off};
+
+     private:
+      void release();
+
+      void *ptr{nullptr};
+      size_t bytes{0};
+      size_t mappedBytes{0};
+    };
+
+    /*! many small allocations carved out of large HugePageBuffer slabs,
+      so that node based containers get huge pages too. Freed blocks are
+      kept on free lists by size for reuse, slabs are only returned when
+      the arena goes away; allocations above 1MB get buffers of their
+      own. Not thread safe */
+    class HugePageArena
+    {
+     public:
+      explicit HugePageArena(HugePageMode mode);
+      HugePageArena(const HugePageArena &) = delete;
+      HugePageArena &operator=(const HugePageArena &) = delete;
+
+      //! 16 byte aligned; throws std::bad_alloc if out of memory
+      void *allocate(size_t bytes);
+      //! 'bytes' has to be what 'ptr' was allocated with
+      void deallocate(void *ptr, size_t bytes);
+
+      const HugePageMode mode;
+
+     private:
+      size_t slabBytes;
+      std::vector<HugePageBuffer> slabs;
+      char *slabNext{nullptr};
+      size_t slabLeft{0};
+      //! heads of the free lists, linked through the free blocks
+      std::vector<void *> freeLists;
+      std::unordered_map<void *, HugePageBuffer> large;
+    };
+
+    /*! allocator drawing from a shared HugePageArena, or from malloc
+      without one, e.g. for spp::sparse_hash_map */
+    template <typename T>
+    class HugePageAllocator
+    {
+     public:
+      typedef T value_type;
+      typedef T *pointer;
+      typedef const T *const_pointer;
+      typedef T &reference;
+      typedef const T &const_reference;
+      typedef size_t size_type;
+      typedef ptrdiff_t difference_type;
+
+      template <typename U>
+      struct rebind
+      {
+        typedef HugePageAllocator<U> other;
+      };
+
+      HugePageAllocator() = default;
+
+      explicit HugePageAllocator(std::shared_ptr<HugePageArena> arena)
+          : arena(std::move(arena))
+      {
+      }
+
+      template <typename U>
+      HugePageAllocator(const HugePageAllocator<U> &other)
+          : arena(other.arena)
+      {
+      }
+
+      pointer allocate(size_type n, const_pointer = nullptr)
+      {
+        const size_t bytes = n * sizeof(T);
+        void *ptr = arena ? arena->allocate(bytes) : std::malloc(bytes);
+        if (!ptr)
+          throw std::bad_alloc();
+        return static_cast<pointer>(ptr);
+      }
+
+      void deallocate(pointer ptr, size_type n)
+      {
+        if (arena)
+          arena->deallocate(ptr, n * sizeof(T));
+        else
+          std::free(ptr);
+      }
+
+      size_type max_size() const
+      {
+        return size_type(-1) / sizeof(T);
+      }
+
+      template <typename U, typename... Args>
+      void construct(U *ptr, Args &&... args)
+      {
+        new (ptr) U(std::forward<Args>(args)...);
+      }
+
+      template <typename U>
+      void destroy(U *ptr)
+      {
+        ptr->~U();
+      }
+
+      std::shared_ptr<HugePageArena> arena;
+    };
+
+    template <typename T, typename U>
+    inline bool operator==(const HugePageAllocator<T> &a,
+                           const HugePageAllocator<U> &b)
+    {
+      return a.arena == b.arena;
+    }
+
+    template <typename T, typename U>
+    inline bool operator!=(const HugePageAllocator<T> &a,
+                           const HugePageAllocator<U> &b)
+    {
+      return a.arena != b.arena;
+    }
+
+    /*! mark the 2MB aligned interior of an existing buffer or mapping as
+      huge page eligible. A no-op for HugePageMode::Off; explicit modes
+      can't be applied after the fact and are treated as Transparent */
+    void adviseHugePages(const void *ptr, size_t bytes, HugePageMode mode);
+
+    template <typename VECTOR_T>
+    inline void adviseHugePages(const VECTOR_T &v, HugePageMode mode)
+    {
+      adviseHugePages(v.data(), v.capacity() * sizeof(v[0]), mode);
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
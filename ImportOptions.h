@@ -0,0 +1,150 @@
+#ifndef IMPORTOPTIONS_H_
+#define IMPORTOPTIONS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include "ChunkReader.h"
+#include "HexCrop.h"
+#include "HugePages.h"
+#include "TAMRFieldCompression.h"
+
+namespace ospray {
+  namespace tamr {
+
+    inline std::string getEnvString(const char *name,
+                                    const std::string &defaultValue = "")
+    {
+      const char *value = getenv(name);
+      return value ? std::string(value) : defaultValue;
+    }
+
+    inline long getEnvInt(const char *name, long defaultValue)
+    {
+      const char *value = getenv(name);
+      return value ? atol(value) : defaultValue;
+    }
+
+    inline double getEnvFloat(const char *name, double defaultValue)
+    {
+      const char *value = getenv(name);
+      return value ? atof(value) : defaultValue;
+    }
+
+    /*! knobs for the exajet importers. The scene graph only hands an
+      import function the file name, so these are read from EXAJET_*
+      environment variables. fromEnvironment() throws on a malformed
+      value */
+    struct ImportOptions
+    {
+      /*! EXAJET_FIELD_ENCODING = float|q16|q8|lossless, how the steps
+        of a time series are kept resident once loaded, see FieldStream */
+      FieldEncoding fieldEncoding{FieldEncoding::Float32};
+      //! EXAJET_FIELD_BLOCK_SIZE, values per compressed field block
+      size_t fieldBlockSize{4096};
+      /*! EXAJET_FIELD_CACHE_MB, bound on the compressed steps kept
+        resident, the oldest are dropped first; 0 keeps every step */
+      size_t fieldCacheBytes{0};
+      //! EXAJET_IO_MODE = mmap|populate|prefetch|pread
+      IOMode ioMode{IOMode::Mmap};
+      //! EXAJET_IO_CHUNK_MB, size of the chunks read ahead of processing
+      size_t ioChunkBytes{size_t(64) << 20};
+      //! EXAJET_HUGE_PAGES = off|thp|2m|1g, for large buffers and mappings
+      HugePageMode hugePages{HugePageMode::Off};
+      /*! EXAJET_CROP = "x0,y0,z0,x1,y1,z1;...", grid space boxes; only
+        hexes overlapping one of them are imported. Empty imports all */
+      std::vector<box3i> cropBoxes;
+      /*! EXAJET_TIME_SERIES = "y_vorticity_*.bin;...", per-timestep field
+        files played back on the unstructured mesh, see FieldStream */
+      std::string timeSeries;
+      /*! EXAJET_PROGRESSIVE = 1, build the coarsest level of an indexed
+        hex file first and stream finer levels in behind it */
+      bool progressive{false};
+      /*! EXAJET_STREAMING = 1, run the sphere preview as a streaming
+        pipeline: only the preview level's voxels are kept, each stage
+        hands its data on to the next and frees it, and input pages are
+        dropped once consumed */
+      bool streaming{false};
+      /*! EXAJET_MEMORY_BUDGET_MB, warn once the buffers accounted by the
+        import exceed this; 0 for no budget */
+      size_t memoryBudget{0};
+      /*! EXAJET_SURFACE_OPTIMIZE = 0 keeps imported surfaces as read,
+        otherwise their vertices are welded and the meshes reordered
+        along a Morton curve, see SurfaceOptimize */
+      bool surfaceOptimize{true};
+      /*! EXAJET_KDT_MAX_DEPTH, EXAJET_KDT_MIN_LEAF_SIZE and
+        EXAJET_KDT_MIN_OCCUPANCY (0..1) bound the sphere preview's KD
+        tree; by default only fully occupied boxes become leaves.
+        EXAJET_KDT_COMPACT_LEAVES = 1 packs its leaves' voxels, see
+        TAMRLevelKDT_t::Leaf::makeCompact */
+      TAMRKDTParams kdtParams;
+      /*! EXAJET_INT_COORDS = 1, bucket the sphere preview's voxels and
+        build its KD tree on exact integer grid coordinates (TAMRVoxeli,
+        TAMRLevelKDTi) instead of floats */
+      bool intCoords{false};
+      /*! EXAJET_FIELD_STATS_BINS, histogram bins of the field statistics
+        gathered while the unstructured volume loads; 0 skips them */
+      size_t fieldStatsBins{256};
+      /*! EXAJET_ASYNC = 1, return from the import right away and load in
+        the background; the data shows up under an ExajetAsyncImport
+        node once it's loaded */
+      bool async{false};
+      /*! EXAJET_SCAN = 1, only scan the hex file and its field for their
+        counts, bounds and ranges, see HexScan. No voxels or meshes are
+        built; the scan is added to the scene and written to the hex
+        file's sidecar, which later imports use to presize their
+        buffers */
+      bool scan{false};
+
+      static ImportOptions fromEnvironment()
+      {
+        ImportOptions opts;
+        opts.fieldEncoding =
+            parseFieldEncoding(getEnvString("EXAJET_FIELD_ENCODING"));
+        const long fieldBlockSize =
+            getEnvInt("EXAJET_FIELD_BLOCK_SIZE", opts.fieldBlockSize);
+        // a block's value count is kept in 32 bits
+        if (fieldBlockSize <= 0 || fieldBlockSize > long(UINT32_MAX))
+          throw std::runtime_error("EXAJET_FIELD_BLOCK_SIZE must be in 1.."
+                                   + std::to_string(UINT32_MAX));
+        opts.fieldBlockSize = fieldBlockSize;
+        opts.fieldCacheBytes =
+            size_t(std::max(getEnvInt("EXAJET_FIELD_CACHE_MB", 0), 0l)) << 20;
+        opts.ioMode = parseIOMode(getEnvString("EXAJET_IO_MODE"));
+        // at least 1MB, so every chunk holds whole hexes
+        opts.ioChunkBytes =
+            size_t(std::max(
+                getEnvInt("EXAJET_IO_CHUNK_MB", opts.ioChunkBytes >> 20), 1l))
+            << 20;
+        opts.hugePages = parseHugePageMode(getEnvString("EXAJET_HUGE_PAGES"));
+        opts.cropBoxes = parseCropBoxes(getEnvString("EXAJET_CROP"));
+        opts.timeSeries = getEnvString("EXAJET_TIME_SERIES");
+        opts.progressive = getEnvInt("EXAJET_PROGRESSIVE", 0) != 0;
+        opts.streaming = getEnvInt("EXAJET_STREAMING", 0) != 0;
+        opts.memoryBudget =
+            size_t(std::max(getEnvInt("EXAJET_MEMORY_BUDGET_MB", 0), 0l)) << 20;
+        opts.surfaceOptimize = getEnvInt("EXAJET_SURFACE_OPTIMIZE", 1) != 0;
+        opts.kdtParams.maxDepth =
+            getEnvInt("EXAJET_KDT_MAX_DEPTH", opts.kdtParams.maxDepth);
+        opts.kdtParams.minLeafSize = size_t(std::max(
+            getEnvInt("EXAJET_KDT_MIN_LEAF_SIZE", opts.kdtParams.minLeafSize),
+            1l));
+        opts.kdtParams.minOccupancy =
+            getEnvFloat("EXAJET_KDT_MIN_OCCUPANCY", opts.kdtParams.minOccupancy);
+        opts.kdtParams.compactLeaves =
+            getEnvInt("EXAJET_KDT_COMPACT_LEAVES", 0) != 0;
+        opts.intCoords = getEnvInt("EXAJET_INT_COORDS", 0) != 0;
+        opts.fieldStatsBins = size_t(std::max(
+            getEnvInt("EXAJET_FIELD_STATS_BINS", opts.fieldStatsBins), 0l));
+        opts.async = getEnvInt("EXAJET_ASYNC", 0) != 0;
+        opts.scan = getEnvInt("EXAJET_SCAN", 0) != 0;
+        return opts;
+      }
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,79 @@
+#include "MemoryLedger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace ospray {
+  namespace tamr {
+
+    static double toMB(size_t bytes)
+    {
+      return bytes / double(1 << 20);
+    }
+
+    MemoryLedger::MemoryLedger(size_t budget) : budget(budget) {}
+
+    void MemoryLedger::set(const std::string &stage, size_t bytes)
+    {
+      Account &account = accounts[stage];
+      total            = total - account.current + bytes;
+      account.current  = bytes;
+      account.peak     = std::max(account.peak, bytes);
+
+      if (total > peakTotal) {
+        peakTotal = total;
+        atPeak.clear();
+        for (const auto &a : accounts) {
+          if (a.second.current)
+            atPeak[a.first] = a.second.current;
+        }
+      }
+
+      if (budget && total > budget && !overBudget) {
+        overBudget = true;
+        std::cout << "Memory budget of " << toMB(budget)
+                  << "MB exceeded while '" << stage << "' held "
+                  << toMB(bytes) << "MB (" << toMB(total)
+                  << "MB accounted)\n";
+      }
+    }
+
+    void MemoryLedger::report() const
+    {
+      std::cout << "Accounted peak: " << toMB(peakTotal) << "MB";
+      const char *sep = " (";
+      for (const auto &a : atPeak) {
+        std::cout << sep << a.first << " " << toMB(a.second) << "MB";
+        sep = ", ";
+      }
+      std::cout << (atPeak.empty() ? "" : ")") << "\n";
+
+      for (const auto &a : accounts) {
+        std::cout << "  " << a.first << ": peak " << toMB(a.second.peak)
+                  << "MB\n";
+      }
+
+      const size_t rss = peakResidentBytes();
+      if (rss)
+        std::cout << "Process peak RSS: " << toMB(rss) << "MB\n";
+    }
+
+    size_t MemoryLedger::peakResidentBytes()
+    {
+      std::ifstream status("/proc/self/status");
+      std::string key;
+      while (status >> key) {
+        if (key == "VmHWM:") {
+          size_t kB = 0;
+          status >> kB;
+          return kB << 10;
+        }
+        status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      }
+      return 0;
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,64 @@
+#ifndef MEMORYLEDGER_H_
+#define MEMORYLEDGER_H_
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+namespace ospray {
+  namespace tamr {
+
+    /*! explicit accounting of the large buffers an import holds, one
+      named account per pipeline stage. Stages report their current
+      size as they grow and shrink, so the peak and which stages made
+      it up can be printed, and checked against a budget, at the end */
+    class MemoryLedger
+    {
+     public:
+      //! 'budget' in bytes, 0 for none
+      explicit MemoryLedger(size_t budget = 0);
+
+      //! set the bytes currently held by 'stage'
+      void set(const std::string &stage, size_t bytes);
+
+      void release(const std::string &stage)
+      {
+        set(stage, 0);
+      }
+
+      size_t current() const
+      {
+        return total;
+      }
+
+      size_t peak() const
+      {
+        return peakTotal;
+      }
+
+      //! print the accounted peak, its breakdown and the process' peak RSS
+      void report() const;
+
+      //! the process' peak resident set size (VmHWM), 0 if unknown
+      static size_t peakResidentBytes();
+
+     private:
+      struct Account
+      {
+        size_t current{0};
+        size_t peak{0};
+      };
+
+      std::map<std::string, Account> accounts;
+      //! what each stage held when the total peaked
+      std::map<std::string, size_t> atPeak;
+      size_t total{0};
+      size_t peakTotal{0};
+      size_t budget;
+      bool overBudget{false};
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef PARALLELSORT_H_
+#define PARALLELSORT_H_
+
+#include <algorithm>
+#include <vector>
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    // sort chunks in parallel, then merge neighbouring runs pairwise in
+    // parallel until a single sorted run is left
+    template <typename T>
+    inline void parallelSort(std::vector<T> &items)
+    {
+      const size_t chunkSize = 1 << 18;
+      size_t runSize         = chunkSize;
+      const size_t numChunks = (items.size() + chunkSize - 1) / chunkSize;
+
+      tasking::parallel_for(numChunks, [&](size_t c) {
+        const size_t begin = c * chunkSize;
+        const size_t end   = std::min(items.size(), begin + chunkSize);
+        std::sort(items.begin() + begin, items.begin() + end);
+      });
+
+      while (runSize < items.size()) {
+        const size_t numPairs =
+            (items.size() + 2 * runSize - 1) / (2 * runSize);
+        tasking::parallel_for(numPairs, [&](size_t p) {
+          const size_t begin = p * 2 * runSize;
+          const size_t mid   = std::min(items.size(), begin + runSize);
+          const size_t end   = std::min(items.size(), begin + 2 * runSize);
+          std::inplace_merge(items.begin() + begin,
+                             items.begin() + mid,
+                             items.begin() + end);
+        });
+        runSize *= 2;
+      }
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,210 @@
+#include "SurfaceOptimize.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "ParallelSort.h"
+#include "ospcommon/box.h"
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    static const size_t BLOCK_SIZE = 1 << 16;
+
+    static inline size_t numBlocks(size_t n)
+    {
+      return (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    static inline uint32 floatBits(float f)
+    {
+      // +0 and -0 are the same position
+      f += 0.f;
+      uint32 bits;
+      memcpy(&bits, &f, sizeof(bits));
+      return bits;
+    }
+
+    /*! keep the triangles for which 'keep' is set, in order. Blocks count
+      their survivors, a prefix sum gives each block its output slot */
+    template <typename KEEP_T>
+    static void compactTriangles(SurfaceMesh &mesh, const KEEP_T &keep)
+    {
+      const size_t n      = mesh.indices.size();
+      const size_t blocks = numBlocks(n);
+      std::vector<size_t> offset(blocks + 1, 0);
+      tasking::parallel_for(blocks, [&](size_t b) {
+        const size_t end = std::min(n, (b + 1) * BLOCK_SIZE);
+        size_t kept      = 0;
+        for (size_t t = b * BLOCK_SIZE; t < end; ++t)
+          kept += keep(mesh.indices[t]);
+        offset[b + 1] = kept;
+      });
+      for (size_t b = 0; b < blocks; ++b)
+        offset[b + 1] += offset[b];
+      if (offset[blocks] == n)
+        return;
+
+      ospcommon::containers::AlignedVector<vec3i> kept(offset[blocks]);
+      tasking::parallel_for(blocks, [&](size_t b) {
+        const size_t end = std::min(n, (b + 1) * BLOCK_SIZE);
+        size_t out       = offset[b];
+        for (size_t t = b * BLOCK_SIZE; t < end; ++t) {
+          if (keep(mesh.indices[t]))
+            kept[out++] = mesh.indices[t];
+        }
+      });
+      mesh.indices = std::move(kept);
+    }
+
+    size_t weldVertices(SurfaceMesh &mesh)
+    {
+      const size_t n = mesh.vertices.size();
+      if (n == 0)
+        return 0;
+
+      // (x|y bits, z bits|index) sorts by position, then by index
+      std::vector<std::pair<uint64, uint64>> keys(n);
+      tasking::parallel_for(n, [&](size_t i) {
+        const vec3f &v = mesh.vertices[i];
+        keys[i]        = std::make_pair(
+            (uint64(floatBits(v.x)) << 32) | floatBits(v.y),
+            (uint64(floatBits(v.z)) << 32) | uint64(i));
+      });
+      parallelSort(keys);
+
+      auto samePosition = [&](size_t k) -> bool {
+        return keys[k].first == keys[k - 1].first
+               && (keys[k].second >> 32) == (keys[k - 1].second >> 32);
+      };
+
+      // number the runs of equal positions, block by block
+      const size_t blocks = numBlocks(n);
+      std::vector<size_t> runOffset(blocks + 1, 0);
+      tasking::parallel_for(blocks, [&](size_t b) {
+        const size_t end = std::min(n, (b + 1) * BLOCK_SIZE);
+        size_t runs      = 0;
+        for (size_t k = b * BLOCK_SIZE; k < end; ++k)
+          runs += k == 0 || !samePosition(k);
+        runOffset[b + 1] = runs;
+      });
+      for (size_t b = 0; b < blocks; ++b)
+        runOffset[b + 1] += runOffset[b];
+      const size_t numWelded = runOffset[blocks];
+      if (numWelded == n)
+        return 0;
+
+      std::vector<int> remap(n);
+      ospcommon::containers::AlignedVector<vec3f> welded(numWelded);
+      tasking::parallel_for(blocks, [&](size_t b) {
+        const size_t end = std::min(n, (b + 1) * BLOCK_SIZE);
+        // the run of the block's first key may have started before it
+        size_t run = runOffset[b] - 1;
+        for (size_t k = b * BLOCK_SIZE; k < end; ++k) {
+          const size_t i = keys[k].second & 0xffffffff;
+          if (k == 0 || !samePosition(k)) {
+            ++run;
+            welded[run] = mesh.vertices[i];
+          }
+          remap[i] = int(run);
+        }
+      });
+      keys = std::vector<std::pair<uint64, uint64>>();
+
+      tasking::parallel_for(numBlocks(mesh.indices.size()), [&](size_t b) {
+        const size_t end = std::min(mesh.indices.size(), (b + 1) * BLOCK_SIZE);
+        for (size_t t = b * BLOCK_SIZE; t < end; ++t) {
+          vec3i &tri = mesh.indices[t];
+          tri        = vec3i(remap[tri.x], remap[tri.y], remap[tri.z]);
+        }
+      });
+      mesh.vertices = std::move(welded);
+
+      compactTriangles(mesh, [](const vec3i &tri) -> bool {
+        return tri.x != tri.y && tri.y != tri.z && tri.x != tri.z;
+      });
+      return n - numWelded;
+    }
+
+    // spread the low 21 bits of 'x' to every third bit
+    static inline uint64 spreadBits(uint64 x)
+    {
+      x &= 0x1fffff;
+      x = (x | x << 32) & 0x1f00000000ffffull;
+      x = (x | x << 16) & 0x1f0000ff0000ffull;
+      x = (x | x << 8) & 0x100f00f00f00f00full;
+      x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+      x = (x | x << 2) & 0x1249249249249249ull;
+      return x;
+    }
+
+    void reorderMorton(SurfaceMesh &mesh)
+    {
+      const size_t numTriangles = mesh.indices.size();
+      const size_t numVertices  = mesh.vertices.size();
+      if (numTriangles == 0)
+        return;
+
+      const size_t vertexBlocks = numBlocks(numVertices);
+      std::vector<box3f> blockBounds(vertexBlocks);
+      tasking::parallel_for(vertexBlocks, [&](size_t b) {
+        const size_t end = std::min(numVertices, (b + 1) * BLOCK_SIZE);
+        box3f bounds;
+        for (size_t i = b * BLOCK_SIZE; i < end; ++i)
+          bounds.extend(mesh.vertices[i]);
+        blockBounds[b] = bounds;
+      });
+      box3f bounds;
+      for (const auto &b : blockBounds)
+        bounds.extend(b);
+
+      const float cells   = float((1 << 21) - 1);
+      const vec3f extent  = max(bounds.size(), vec3f(1e-20f));
+      const vec3f scale   = vec3f(cells) / extent;
+
+      // (code, triangle), sorted along the curve
+      std::vector<std::pair<uint64, uint64>> order(numTriangles);
+      tasking::parallel_for(numTriangles, [&](size_t t) {
+        const vec3i &tri = mesh.indices[t];
+        const vec3f centroid =
+            (mesh.vertices[tri.x] + mesh.vertices[tri.y]
+             + mesh.vertices[tri.z])
+            * (1.f / 3.f);
+        const vec3f p = min(max((centroid - bounds.lower) * scale, vec3f(0.f)),
+                            vec3f(cells));
+        const uint64 code = spreadBits(uint64(p.x))
+                            | spreadBits(uint64(p.y)) << 1
+                            | spreadBits(uint64(p.z)) << 2;
+        order[t] = std::make_pair(code, uint64(t));
+      });
+      parallelSort(order);
+
+      ospcommon::containers::AlignedVector<vec3i> sorted(numTriangles);
+      tasking::parallel_for(numTriangles, [&](size_t t) {
+        sorted[t] = mesh.indices[order[t].second];
+      });
+      order = std::vector<std::pair<uint64, uint64>>();
+
+      // vertices in order of first use along the sorted triangles
+      std::vector<int> remap(numVertices, -1);
+      ospcommon::containers::AlignedVector<vec3f> vertices;
+      vertices.reserve(numVertices);
+      for (auto &tri : sorted) {
+        for (int k = 0; k < 3; ++k) {
+          int &id = remap[tri[k]];
+          if (id == -1) {
+            id = int(vertices.size());
+            vertices.push_back(mesh.vertices[tri[k]]);
+          }
+          tri[k] = id;
+        }
+      }
+
+      mesh.indices  = std::move(sorted);
+      mesh.vertices = std::move(vertices);
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,24 @@
+#ifndef SURFACEOPTIMIZE_H_
+#define SURFACEOPTIMIZE_H_
+
+#include "VTPSurface.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! merge vertices with identical positions, as the shared borders
+      of neighbouring surface patches have them, via a parallel sort of
+      the positions. Triangles that collapse are dropped. Returns the
+      number of vertices removed */
+    size_t weldVertices(SurfaceMesh &mesh);
+
+    /*! sort the triangles along a Morton curve through their centroids
+      and renumber the vertices in order of first use, so neighbouring
+      triangles and their vertices sit close together in memory.
+      Vertices no triangle uses are dropped */
+    void reorderMorton(SurfaceMesh &mesh);
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,265 @@
+#include "TAMRCellIndex.h"
+
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    static const uint64 EMPTY_KEY  = ~uint64(0);
+    static const int KEY_BITS      = 21;
+    static const int BRICK_BITS    = 3;
+    static const size_t BLOCK_SIZE = 4096;
+
+    static inline uint64 hashKey(uint64 key)
+    {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdULL;
+      key ^= key >> 33;
+      key *= 0xc4ceb9fe1a85ec53ULL;
+      key ^= key >> 33;
+      return key;
+    }
+
+    static inline vec3i brickCoord(const vec3i &cell)
+    {
+      // arithmetic shift, i.e. floor division by the brick size
+      return vec3i(cell.x >> BRICK_BITS, cell.y >> BRICK_BITS,
+                   cell.z >> BRICK_BITS);
+    }
+
+    bool TAMRCellIndex::Level::pack(const vec3i &brick, uint64 &key) const
+    {
+      const vec3i d      = brick - brickOrigin;
+      const int maxCoord = 1 << KEY_BITS;
+      if (d.x < 0 || d.y < 0 || d.z < 0 || d.x >= maxCoord || d.y >= maxCoord
+          || d.z >= maxCoord)
+        return false;
+      key = uint64(d.x) | (uint64(d.y) << KEY_BITS)
+            | (uint64(d.z) << (2 * KEY_BITS));
+      return true;
+    }
+
+    const TAMRCellIndex::Brick *TAMRCellIndex::Level::findBrick(
+        const vec3i &cell) const
+    {
+      uint64 key;
+      if (bricks.empty() || !pack(brickCoord(cell), key))
+        return nullptr;
+      for (uint64 slot = hashKey(key) & slotMask;;
+           slot        = (slot + 1) & slotMask) {
+        const Brick &b = bricks[slot];
+        if (b.key == key)
+          return &b;
+        if (b.key == EMPTY_KEY)
+          return nullptr;
+      }
+    }
+
+    bool TAMRCellIndex::locate(const Brick &brick,
+                               const vec3i &cell,
+                               uint64 &rank)
+    {
+      const vec3i c  = cell - (brickCoord(cell) * (1 << BRICK_BITS));
+      const int bit  = c.x + 8 * c.y;
+      const uint64 m = brick.mask[c.z];
+      rank           = brick.base;
+      for (int w = 0; w < c.z; ++w)
+        rank += __builtin_popcountll(brick.mask[w]);
+      rank += __builtin_popcountll(m & ((uint64(1) << bit) - 1));
+      return (m >> bit) & 1;
+    }
+
+    TAMRCellIndex::TAMRCellIndex(const TAMRData &data)
+    {
+      origin = vec3i(std::floor(data.amrOrigin.x + 0.5f),
+                     std::floor(data.amrOrigin.y + 0.5f),
+                     std::floor(data.amrOrigin.z + 0.5f));
+
+      for (const auto &lv : data.voxelsInLevel) {
+        if (!lv.second.voxels.empty())
+          levels.push_back(lv.first);
+      }
+      std::sort(levels.begin(), levels.end());
+      if (levels.empty())
+        return;
+
+      tables.resize(levels.back() + 1);
+      for (const int l : levels)
+        buildLevel(tables[l], data.voxelsInLevel.at(l), l);
+    }
+
+    void TAMRCellIndex::buildLevel(Level &lv, const TAMRLevel &level, int l)
+    {
+      TAMRVoxel lo, hi;
+      lo.level = hi.level = l;
+      lo.lower            = level.bounds.lower;
+      hi.lower            = level.bounds.upper;
+      lv.brickOrigin      = brickCoord(cellCoord(lo));
+      if (reduce_max(brickCoord(cellCoord(hi)) - lv.brickOrigin)
+          >= (1 << KEY_BITS))
+        throw std::runtime_error("TAMRCellIndex: level " + std::to_string(l)
+                                 + " is too large for 21 bit brick keys");
+
+      const size_t numVoxels = level.voxels.size();
+      const size_t numBlocks = (numVoxels + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+      Brick emptyBrick;
+      emptyBrick.key  = EMPTY_KEY;
+      emptyBrick.base = 0;
+      std::fill(emptyBrick.mask, emptyBrick.mask + 8, 0);
+
+      // AMR levels are mostly dense, so start out assuming a few dozen
+      // cells per brick and grow the table if that turns out wrong
+      size_t capacity = 16;
+      while (capacity < numVoxels / 32)
+        capacity *= 2;
+
+      for (;;) {
+        lv.slotMask = capacity - 1;
+        lv.bricks.resize(capacity);
+        tasking::parallel_for((capacity + BLOCK_SIZE - 1) / BLOCK_SIZE,
+                              [&](size_t b) {
+                                const size_t end =
+                                    std::min(capacity, (b + 1) * BLOCK_SIZE);
+                                for (size_t i = b * BLOCK_SIZE; i < end; ++i)
+                                  lv.bricks[i] = emptyBrick;
+                              });
+
+        std::atomic<size_t> numBricks(0);
+        std::atomic<bool> overflow(false);
+
+        // insert brick keys and set occupancy bits; plain fields updated
+        // with atomic builtins so Brick stays one flat record for lookups
+        tasking::parallel_for(numBlocks, [&](size_t b) {
+          const size_t end = std::min(numVoxels, (b + 1) * BLOCK_SIZE);
+          for (size_t i = b * BLOCK_SIZE; i < end && !overflow; ++i) {
+            const vec3i cell = cellCoord(level.voxels[i]);
+            uint64 key;
+            lv.pack(brickCoord(cell), key);
+
+            Brick *brick = nullptr;
+            uint64 slot  = hashKey(key) & lv.slotMask;
+            for (size_t probes = 0; probes < capacity && !brick; ++probes) {
+              Brick &candidate = lv.bricks[slot];
+              uint64 expected  = EMPTY_KEY;
+              if (__atomic_compare_exchange_n(&candidate.key,
+                                              &expected,
+                                              key,
+                                              false,
+                                              __ATOMIC_RELAXED,
+                                              __ATOMIC_RELAXED)) {
+                if (++numBricks > capacity / 2)
+                  overflow = true;
+                brick = &candidate;
+              } else if (expected == key) {
+                brick = &candidate;
+              }
+              slot = (slot + 1) & lv.slotMask;
+            }
+            if (!brick) {
+              overflow = true;
+              break;
+            }
+
+            const vec3i c = cell - (brickCoord(cell) * (1 << BRICK_BITS));
+            __atomic_fetch_or(&brick->mask[c.z],
+                              uint64(1) << (c.x + 8 * c.y),
+                              __ATOMIC_RELAXED);
+          }
+        });
+
+        if (!overflow)
+          break;
+        capacity *= 4;
+      }
+
+      // brick bases: exclusive prefix sum of the occupancy counts
+      const size_t numSlotBlocks = (capacity + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      std::vector<uint64> blockBase(numSlotBlocks + 1, 0);
+      tasking::parallel_for(numSlotBlocks, [&](size_t b) {
+        const size_t end = std::min(capacity, (b + 1) * BLOCK_SIZE);
+        uint64 sum       = 0;
+        for (size_t i = b * BLOCK_SIZE; i < end; ++i) {
+          for (int w = 0; w < 8; ++w)
+            sum += __builtin_popcountll(lv.bricks[i].mask[w]);
+        }
+        blockBase[b + 1] = sum;
+      });
+      for (size_t b = 0; b < numSlotBlocks; ++b)
+        blockBase[b + 1] += blockBase[b];
+      tasking::parallel_for(numSlotBlocks, [&](size_t b) {
+        const size_t end = std::min(capacity, (b + 1) * BLOCK_SIZE);
+        uint64 base      = blockBase[b];
+        for (size_t i = b * BLOCK_SIZE; i < end; ++i) {
+          lv.bricks[i].base = base;
+          for (int w = 0; w < 8; ++w)
+            base += __builtin_popcountll(lv.bricks[i].mask[w]);
+        }
+      });
+
+      // scatter every cell's indexInBuffer to its rank
+      lv.indices.resize(blockBase[numSlotBlocks]);
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        const size_t end = std::min(numVoxels, (b + 1) * BLOCK_SIZE);
+        for (size_t i = b * BLOCK_SIZE; i < end; ++i) {
+          const TAMRVoxel &v = level.voxels[i];
+          const vec3i cell   = cellCoord(v);
+          uint64 rank;
+          locate(*lv.findBrick(cell), cell, rank);
+          // duplicate cells write the same slot, the last one wins
+          lv.indices[rank] = v.indexInBuffer;
+        }
+      });
+    }
+
+    vec3i TAMRCellIndex::gridLower(const TAMRVoxel &voxel) const
+    {
+      const float scale = float(1 << voxel.level);
+      return vec3i(std::floor(voxel.lower.x * scale + 0.5f),
+                   std::floor(voxel.lower.y * scale + 0.5f),
+                   std::floor(voxel.lower.z * scale + 0.5f))
+             + origin;
+    }
+
+    bool TAMRCellIndex::find(int level,
+                             const vec3i &cell,
+                             size_t &indexInBuffer) const
+    {
+      if (level < 0 || level >= (int)tables.size())
+        return false;
+      const Level &lv    = tables[level];
+      const Brick *brick = lv.findBrick(cell);
+      uint64 rank;
+      if (!brick || !locate(*brick, cell, rank))
+        return false;
+      indexInBuffer = lv.indices[rank];
+      return true;
+    }
+
+    bool TAMRCellIndex::contains(int level, const vec3i &cell) const
+    {
+      if (level < 0 || level >= (int)tables.size())
+        return false;
+      const Brick *brick = tables[level].findBrick(cell);
+      if (!brick)
+        return false;
+      const vec3i c = cell - (brickCoord(cell) * (1 << BRICK_BITS));
+      return (brick->mask[c.z] >> (c.x + 8 * c.y)) & 1;
+    }
+
+    size_t TAMRCellIndex::sizeInBytes() const
+    {
+      size_t bytes = 0;
+      for (const auto &lv : tables) {
+        bytes += lv.bricks.size() * sizeof(Brick)
+                 + lv.indices.size() * sizeof(size_t);
+      }
+      return bytes;
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
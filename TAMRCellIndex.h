@@ -0,0 +1,80 @@
+#ifndef TAMRCELLINDEX_H_
+#define TAMRCELLINDEX_H_
+
+#include <vector>
+#include "TAMRData.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! O(1) "is there a level L cell at (i,j,k), and what is its
+      indexInBuffer" for every level of a TAMRData. Each level is a
+      compressed sparse block table: a hash over 8^3 cell bricks, where
+      a brick holds a 512 bit occupancy mask and the rank of its first
+      cell in a dense indexInBuffer array. A lookup is one hash probe,
+      a bit test and a popcount, and dense regions cost 8 bytes per cell
+      plus 80 bytes per brick.
+
+      Cells are addressed in the absolute hex grid divided by 2^level,
+      i.e. (voxel.lower * 2^level + amrOrigin) >> level, so cells of
+      different levels line up exactly */
+    struct TAMRCellIndex
+    {
+      TAMRCellIndex(const TAMRData &data);
+
+      //! indexInBuffer of the level 'level' cell at coordinate 'cell'
+      bool find(int level, const vec3i &cell, size_t &indexInBuffer) const;
+
+      bool contains(int level, const vec3i &cell) const;
+
+      //! absolute grid position of a voxel's lower corner
+      vec3i gridLower(const TAMRVoxel &voxel) const;
+
+      //! cell coordinate of a voxel on its own level
+      inline vec3i cellCoord(const TAMRVoxel &voxel) const
+      {
+        const vec3i p = gridLower(voxel);
+        return vec3i(p.x >> voxel.level, p.y >> voxel.level, p.z >> voxel.level);
+      }
+
+      size_t sizeInBytes() const;
+
+      //! levels present in the data, ascending
+      std::vector<int> levels;
+
+     private:
+      struct Brick
+      {
+        uint64 key;
+        //! rank of the brick's first cell in Level::indices
+        uint64 base;
+        //! bit x + 8*y of word z is set if cell (x,y,z) exists
+        uint64 mask[8];
+      };
+
+      struct Level
+      {
+        vec3i brickOrigin;
+        uint64 slotMask{0};
+        std::vector<Brick> bricks;
+        std::vector<size_t> indices;
+
+        bool pack(const vec3i &brick, uint64 &key) const;
+        const Brick *findBrick(const vec3i &cell) const;
+      };
+
+      /*! rank of 'cell' in its brick's level, i.e. its slot in
+        Level::indices; returns whether the cell exists */
+      static bool locate(const Brick &brick, const vec3i &cell, uint64 &rank);
+
+      void buildLevel(Level &lv, const TAMRLevel &level, int l);
+
+      vec3i origin;
+      //! indexed by level, empty for levels without cells
+      std::vector<Level> tables;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
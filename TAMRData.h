@@ -19,14 +19,22 @@ using namespace ospray::sg;
 namespace ospray {
   namespace tamr {
 
-    struct TAMRVoxel
+    /*! one cell, 'lower' in cells of its own level relative to the
+      data's amrOrigin. With float coordinates the importers compute
+      (lower - origin) / 2^level directly, which stops being exact once
+      grid coordinates pass 2^24. With int coordinates 'lower' is
+      floored to the level's cell lattice and the lattice's offset from
+      the origin is kept once per level, see TAMRLevel_t */
+    template <typename COORD_T>
+    struct TAMRVoxel_t
     {
-      vec3f lower;
+      vec_t<COORD_T, 3> lower;
       int level;
       size_t indexInBuffer;
     };
 
-    struct TAMRLevel
+    template <typename COORD_T>
+    struct TAMRLevel_t
     {
       float cellWidthInModel;
       float cellWidth;
@@ -34,23 +42,36 @@ namespace ospray {
       float halfCellWidth;
       int level;
 
-      box3f bounds;
-      std::vector<TAMRVoxel> voxels;
+      box_t<COORD_T, 3> bounds;
+      std::vector<TAMRVoxel_t<COORD_T>> voxels;
+      /*! where the level's cells start relative to integer 'lower', in
+        cells: a cell's lower corner is (lower + latticeOffset) cells
+        from the origin. Always zero for float coordinates */
+      vec3f latticeOffset{0.f};
 
-      inline void push_voxel(TAMRVoxel &voxel)
+      inline void push_voxel(TAMRVoxel_t<COORD_T> &voxel)
       {
         voxels.push_back(voxel);
         bounds.extend(voxel.lower);
       }
     };
 
-    struct TAMRData
+    template <typename COORD_T>
+    struct TAMRData_t
     {
-      vec3f amrOrigin;
+      vec_t<COORD_T, 3> amrOrigin;
       float cellScale;
-      std::unordered_map<int, TAMRLevel> voxelsInLevel;
+      std::unordered_map<int, TAMRLevel_t<COORD_T>> voxelsInLevel;
     };
 
+    using TAMRVoxel = TAMRVoxel_t<float>;
+    using TAMRLevel = TAMRLevel_t<float>;
+    using TAMRData  = TAMRData_t<float>;
+
+    using TAMRVoxeli = TAMRVoxel_t<int>;
+    using TAMRLeveli = TAMRLevel_t<int>;
+    using TAMRDatai  = TAMRData_t<int>;
+
   }  // namespace tamr
 }  // namespace ospray
 
@@ -0,0 +1,385 @@
+#include "TAMRFieldCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIELDCOMPRESSION_X86 1
+#include <immintrin.h>
+#endif
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    FieldEncoding parseFieldEncoding(const std::string &name)
+    {
+      if (name.empty() || name == "float" || name == "float32")
+        return FieldEncoding::Float32;
+      if (name == "q16" || name == "quant16")
+        return FieldEncoding::Quant16;
+      if (name == "q8" || name == "quant8")
+        return FieldEncoding::Quant8;
+      if (name == "lossless")
+        return FieldEncoding::Lossless;
+      throw std::runtime_error("unknown field encoding '" + name + "'");
+    }
+
+    const char *toString(FieldEncoding encoding)
+    {
+      switch (encoding) {
+      case FieldEncoding::Quant16:
+        return "q16";
+      case FieldEncoding::Quant8:
+        return "q8";
+      case FieldEncoding::Lossless:
+        return "lossless";
+      default:
+        return "float32";
+      }
+    }
+
+    static inline uint32 floatBits(float f)
+    {
+      uint32 u;
+      memcpy(&u, &f, sizeof(u));
+      return u;
+    }
+
+    static inline float bitsFloat(uint32 u)
+    {
+      float f;
+      memcpy(&f, &u, sizeof(f));
+      return f;
+    }
+
+    static inline int maxCode(FieldEncoding encoding)
+    {
+      return encoding == FieldEncoding::Quant16 ? 0xffff : 0xff;
+    }
+
+    static inline size_t bytesPerValue(FieldEncoding encoding)
+    {
+      switch (encoding) {
+      case FieldEncoding::Quant16:
+        return 2;
+      case FieldEncoding::Quant8:
+        return 1;
+      default:
+        return 4;
+      }
+    }
+
+    template <typename CODE_T>
+    static void quantize(const float *in,
+                         size_t n,
+                         const CompressedField::Block &block,
+                         CODE_T *out)
+    {
+      const float rcpScale = block.scale > 0.f ? 1.f / block.scale : 0.f;
+      for (size_t i = 0; i < n; ++i)
+        out[i] = (CODE_T)((in[i] - block.minValue) * rcpScale + 0.5f);
+    }
+
+    // dequantization kernels: value = minValue + scale * code, eight
+    // values per iteration on CPUs with AVX2
+    template <typename CODE_T>
+    static void dequantizeScalar(const CODE_T *in,
+                                 size_t n,
+                                 float minValue,
+                                 float scale,
+                                 float *out)
+    {
+      for (size_t i = 0; i < n; ++i)
+        out[i] = minValue + scale * (float)in[i];
+    }
+
+#ifdef FIELDCOMPRESSION_X86
+    __attribute__((target("avx2"))) static void dequantizeAVX2(
+        const uint16_t *in, size_t n, float minValue, float scale, float *out)
+    {
+      size_t i            = 0;
+      const __m256 vMin   = _mm256_set1_ps(minValue);
+      const __m256 vScale = _mm256_set1_ps(scale);
+      for (; i + 8 <= n; i += 8) {
+        const __m128i c16 = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m256 c    = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(c16));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(vMin, _mm256_mul_ps(vScale, c)));
+      }
+      dequantizeScalar(in + i, n - i, minValue, scale, out + i);
+    }
+
+    __attribute__((target("avx2"))) static void dequantizeAVX2(
+        const uint8_t *in, size_t n, float minValue, float scale, float *out)
+    {
+      size_t i            = 0;
+      const __m256 vMin   = _mm256_set1_ps(minValue);
+      const __m256 vScale = _mm256_set1_ps(scale);
+      for (; i + 8 <= n; i += 8) {
+        const __m128i c8 = _mm_loadl_epi64((const __m128i *)(in + i));
+        const __m256 c   = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(c8));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(vMin, _mm256_mul_ps(vScale, c)));
+      }
+      dequantizeScalar(in + i, n - i, minValue, scale, out + i);
+    }
+
+    static bool cpuHasAVX2()
+    {
+      return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    template <typename CODE_T>
+    static void dequantize(const CODE_T *in,
+                           size_t n,
+                           float minValue,
+                           float scale,
+                           float *out)
+    {
+#ifdef FIELDCOMPRESSION_X86
+      if (cpuHasAVX2())
+        return dequantizeAVX2(in, n, minValue, scale, out);
+#endif
+      dequantizeScalar(in, n, minValue, scale, out);
+    }
+
+    /*! lossless block layout: one nibble per value holding the number
+      of significant bytes (0..4) of (bits ^ prevBits), followed by
+      those bytes, least significant first */
+    static void encodeLossless(const float *in,
+                               size_t n,
+                               std::vector<uint8_t> &out)
+    {
+      const size_t headerBytes = (n + 1) / 2;
+      out.assign(headerBytes, 0);
+      out.reserve(headerBytes + 4 * n);
+      uint32 prev = 0;
+      for (size_t i = 0; i < n; ++i) {
+        const uint32 bits = floatBits(in[i]);
+        uint32 x          = bits ^ prev;
+        prev              = bits;
+        int numBytes      = 0;
+        while (x >> (8 * numBytes) && numBytes < 4)
+          ++numBytes;
+        out[i / 2] |= numBytes << (4 * (i & 1));
+        for (int b = 0; b < numBytes; ++b)
+          out.push_back((x >> (8 * b)) & 0xff);
+      }
+    }
+
+    static void decodeLossless(const uint8_t *in, size_t n, float *out)
+    {
+      const uint8_t *bytes = in + (n + 1) / 2;
+      uint32 prev          = 0;
+      for (size_t i = 0; i < n; ++i) {
+        const int numBytes = (in[i / 2] >> (4 * (i & 1))) & 0xf;
+        uint32 x           = 0;
+        for (int b = 0; b < numBytes; ++b)
+          x |= uint32(*bytes++) << (8 * b);
+        prev   = prev ^ x;
+        out[i] = bitsFloat(prev);
+      }
+    }
+
+    /*! value 'local' of a lossless block of n values. Every value is
+      relative to the one before, so this walks the block up to it */
+    static float decodeLosslessValue(const uint8_t *in, size_t n, size_t local)
+    {
+      const uint8_t *bytes = in + (n + 1) / 2;
+      uint32 prev          = 0;
+      for (size_t i = 0; i <= local; ++i) {
+        const int numBytes = (in[i / 2] >> (4 * (i & 1))) & 0xf;
+        uint32 x           = 0;
+        for (int b = 0; b < numBytes; ++b)
+          x |= uint32(*bytes++) << (8 * b);
+        prev = prev ^ x;
+      }
+      return bitsFloat(prev);
+    }
+
+    CompressedField CompressedField::compress(const float *values,
+                                              size_t numValues,
+                                              FieldEncoding encoding,
+                                              size_t blockSize)
+    {
+      // Block::numValues is 32 bits
+      if (blockSize == 0 || blockSize > UINT32_MAX)
+        throw std::runtime_error("field compression needs a block size in "
+                                 "1.." + std::to_string(UINT32_MAX));
+
+      CompressedField field;
+      field.encoding  = encoding;
+      field.numValues = numValues;
+      field.blockSize = blockSize;
+      field.blocks.resize((numValues + blockSize - 1) / blockSize);
+      for (size_t b = 0; b < field.blocks.size(); ++b) {
+        field.blocks[b].firstValue = b * blockSize;
+        field.blocks[b].numValues  = std::min(blockSize, numValues - b * blockSize);
+      }
+      field.encodeBlocks(values);
+      return field;
+    }
+
+    CompressedField CompressedField::compressLeaves(const TAMRLevelKDT &accel,
+                                                    const float *field,
+                                                    FieldEncoding encoding)
+    {
+      CompressedField result;
+      result.encoding = encoding;
+      result.blocks.resize(accel.leaf.size());
+      for (size_t l = 0; l < accel.leaf.size(); ++l) {
+        result.blocks[l].firstValue = result.numValues;
+        result.blocks[l].numValues  = accel.leaf[l].size();
+        result.numValues += accel.leaf[l].size();
+      }
+
+      // gather the leaves' values into leaf order, then encode as usual
+      std::vector<float> gathered(result.numValues);
+      tasking::parallel_for(accel.leaf.size(), [&](size_t l) {
+        const TAMRLevelKDT::Leaf &leaf = accel.leaf[l];
+        float *out = gathered.data() + result.blocks[l].firstValue;
+        uint64 index[256];
+        for (size_t b = 0; b < leaf.size(); b += 256) {
+          const size_t n = std::min(leaf.size() - b, size_t(256));
+          leaf.decode(b, n, nullptr, index);
+          for (size_t k = 0; k < n; ++k)
+            *out++ = field[index[k]];
+        }
+      });
+
+      result.encodeBlocks(gathered.data());
+      return result;
+    }
+
+    void CompressedField::encodeBlocks(const float *values)
+    {
+      std::vector<std::vector<uint8_t>> encoded(blocks.size());
+
+      tasking::parallel_for(blocks.size(), [&](size_t b) {
+        Block &block     = blocks[b];
+        const float *in  = values + block.firstValue;
+        const size_t n   = block.numValues;
+        block.minValue   = std::numeric_limits<float>::infinity();
+        block.maxValue   = -std::numeric_limits<float>::infinity();
+        bool finite      = true;
+        for (size_t i = 0; i < n; ++i) {
+          block.minValue = std::min(block.minValue, in[i]);
+          block.maxValue = std::max(block.maxValue, in[i]);
+          finite         = finite && std::isfinite(in[i]);
+        }
+        block.scale = 0.f;
+        block.raw   = false;
+
+        const bool quantized = encoding == FieldEncoding::Quant16
+                               || encoding == FieldEncoding::Quant8;
+        if (quantized
+            && (!finite || !std::isfinite(block.maxValue - block.minValue))) {
+          // the codes would be made from NaN, so keep the floats
+          block.raw = true;
+        }
+
+        std::vector<uint8_t> &out = encoded[b];
+        switch (block.raw ? FieldEncoding::Float32 : encoding) {
+        case FieldEncoding::Quant16:
+        case FieldEncoding::Quant8:
+          if (block.maxValue > block.minValue)
+            block.scale = (block.maxValue - block.minValue) / maxCode(encoding);
+          out.resize(n * bytesPerValue(encoding));
+          if (encoding == FieldEncoding::Quant16)
+            quantize(in, n, block, (uint16_t *)out.data());
+          else
+            quantize(in, n, block, out.data());
+          break;
+        case FieldEncoding::Lossless:
+          encodeLossless(in, n, out);
+          break;
+        default:
+          out.resize(n * sizeof(float));
+          memcpy(out.data(), in, n * sizeof(float));
+        }
+      });
+
+      size_t totalBytes = 0;
+      for (size_t b = 0; b < blocks.size(); ++b) {
+        blocks[b].byteOffset = totalBytes;
+        totalBytes += encoded[b].size();
+      }
+
+      payload.resize(totalBytes);
+      tasking::parallel_for(blocks.size(), [&](size_t b) {
+        std::copy(encoded[b].begin(),
+                  encoded[b].end(),
+                  payload.begin() + blocks[b].byteOffset);
+      });
+    }
+
+    void CompressedField::decodeBlock(size_t blockID, float *out) const
+    {
+      const Block &block = blocks[blockID];
+      const uint8_t *in  = payload.data() + block.byteOffset;
+      switch (block.raw ? FieldEncoding::Float32 : encoding) {
+      case FieldEncoding::Quant16:
+        dequantize((const uint16_t *)in,
+                   block.numValues,
+                   block.minValue,
+                   block.scale,
+                   out);
+        break;
+      case FieldEncoding::Quant8:
+        dequantize(in, block.numValues, block.minValue, block.scale, out);
+        break;
+      case FieldEncoding::Lossless:
+        decodeLossless(in, block.numValues, out);
+        break;
+      default:
+        memcpy(out, in, block.numValues * sizeof(float));
+      }
+    }
+
+    void CompressedField::decode(float *out) const
+    {
+      tasking::parallel_for(blocks.size(), [&](size_t b) {
+        decodeBlock(b, out + blocks[b].firstValue);
+      });
+    }
+
+    float CompressedField::value(size_t i) const
+    {
+      size_t blockID;
+      if (blockSize != 0) {
+        blockID = i / blockSize;
+      } else {
+        auto it = std::upper_bound(
+            blocks.begin(), blocks.end(), i, [](size_t i, const Block &b) {
+              return i < b.firstValue;
+            });
+        blockID = (it - blocks.begin()) - 1;
+      }
+
+      const Block &block = blocks[blockID];
+      const size_t local = i - block.firstValue;
+      const uint8_t *in  = payload.data() + block.byteOffset;
+      switch (block.raw ? FieldEncoding::Float32 : encoding) {
+      case FieldEncoding::Quant16:
+        return block.minValue + block.scale * ((const uint16_t *)in)[local];
+      case FieldEncoding::Quant8:
+        return block.minValue + block.scale * in[local];
+      case FieldEncoding::Lossless:
+        return decodeLosslessValue(in, block.numValues, local);
+      default:
+        return ((const float *)in)[local];
+      }
+    }
+
+    size_t CompressedField::sizeInBytes() const
+    {
+      return payload.size() + blocks.size() * sizeof(Block);
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,89 @@
+#ifndef TAMRFIELDCOMPRESSION_H_
+#define TAMRFIELDCOMPRESSION_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "TAMRLevelKDT.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! how a cell field is kept resident. Quant16/Quant8 store each
+      value relative to its block's [min,max] range, Lossless stores
+      the xor against the previous value with leading zero bytes
+      stripped */
+    enum class FieldEncoding
+    {
+      Float32,
+      Quant16,
+      Quant8,
+      Lossless
+    };
+
+    FieldEncoding parseFieldEncoding(const std::string &name);
+    const char *toString(FieldEncoding encoding);
+
+    /*! a cell field split into independently decodable blocks. Blocks
+      are either fixed size runs of the input array (compress()), or
+      one block per KD tree leaf holding that leaf's voxels in leaf
+      order (compressLeaves()) */
+    struct CompressedField
+    {
+      struct Block
+      {
+        float minValue;
+        float maxValue;
+        //! value = minValue + scale * code, for quantized encodings
+        float scale;
+        uint32 numValues;
+        /*! the block holds plain floats; quantized fields keep blocks
+          with NaN or infinite values, or a range too wide for a finite
+          scale, this way */
+        bool raw;
+        //! first value of this block in the decoded array
+        size_t firstValue;
+        //! byte offset of this block's codes in 'payload'
+        size_t byteOffset;
+      };
+
+      static CompressedField compress(const float *values,
+                                      size_t numValues,
+                                      FieldEncoding encoding,
+                                      size_t blockSize = 4096);
+
+      static CompressedField compressLeaves(const TAMRLevelKDT &accel,
+                                            const float *field,
+                                            FieldEncoding encoding);
+
+      /*! decode all values of one block to 'out', which must have room
+        for blocks[blockID].numValues floats */
+      void decodeBlock(size_t blockID, float *out) const;
+
+      //! decode the whole field, blocks in parallel
+      void decode(float *out) const;
+
+      /*! random access to a single value in decoded order. O(1) for
+        the fixed size encodings; a Lossless value is decoded by walking
+        its block up to it, O(blockSize) */
+      float value(size_t i) const;
+
+      size_t sizeInBytes() const;
+
+      FieldEncoding encoding{FieldEncoding::Float32};
+      size_t numValues{0};
+      //! values per block for compress(); 0 for per-leaf blocks
+      size_t blockSize{0};
+      std::vector<Block> blocks;
+      std::vector<uint8_t> payload;
+
+     private:
+      /*! encode 'values' (in decoded order) into 'payload', using the
+        block ranges already set up in 'blocks' */
+      void encodeBlocks(const float *values);
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -1,33 +1,200 @@
 #include "TAMRLevelKDT.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include "ospcommon/tasking/parallel_for.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TAMRLEVELKDT_X86 1
+#include <immintrin.h>
+#endif
 
 namespace ospray {
   namespace tamr {
 
-    TAMRLevelKDT::TAMRLevelKDT(const TAMRData &input, int level) 
+    // voxels decoded at a time when walking a leaf
+    static const size_t DECODE_BATCH = 256;
+
+    static inline int popcount(uint64 bits)
+    {
+      return __builtin_popcountll(bits);
+    }
+
+    // bits needed for the offsets 0..extent-1
+    static inline int bitsFor(size_t extent)
+    {
+      int bits = 0;
+      while ((size_t(1) << bits) < extent)
+        ++bits;
+      return bits;
+    }
+
+    static void unpackOffsetsScalar(const uint32 *packed,
+                                    size_t n,
+                                    int bitsX,
+                                    int bitsY,
+                                    int *dx,
+                                    int *dy,
+                                    int *dz)
+    {
+      const uint32 maskX = (uint32(1) << bitsX) - 1;
+      const uint32 maskY = (uint32(1) << bitsY) - 1;
+      for (size_t i = 0; i < n; ++i) {
+        dx[i] = int(packed[i] & maskX);
+        dy[i] = int((packed[i] >> bitsX) & maskY);
+        dz[i] = int(packed[i] >> (bitsX + bitsY));
+      }
+    }
+
+#ifdef TAMRLEVELKDT_X86
+    static bool cpuHasAVX2()
+    {
+      static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+      return hasAVX2;
+    }
+
+    __attribute__((target("avx2"))) static void unpackOffsetsAVX2(
+        const uint32 *packed,
+        size_t n,
+        int bitsX,
+        int bitsY,
+        int *dx,
+        int *dy,
+        int *dz)
+    {
+      const __m256i maskX  = _mm256_set1_epi32((1 << bitsX) - 1);
+      const __m256i maskY  = _mm256_set1_epi32((1 << bitsY) - 1);
+      const __m128i shiftY = _mm_cvtsi32_si128(bitsX);
+      const __m128i shiftZ = _mm_cvtsi32_si128(bitsX + bitsY);
+      size_t i             = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m256i p =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(packed + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dx + i),
+                            _mm256_and_si256(p, maskX));
+        const __m256i y = _mm256_srl_epi32(p, shiftY);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dy + i),
+                            _mm256_and_si256(y, maskY));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dz + i),
+                            _mm256_srl_epi32(p, shiftZ));
+      }
+      unpackOffsetsScalar(packed + i, n - i, bitsX, bitsY, dx + i, dy + i,
+                          dz + i);
+    }
+
+    // position of 'key' in the first n entries of 'packed', or n
+    __attribute__((target("avx2"))) static size_t scanKeyAVX2(
+        const uint32 *packed, size_t n, uint32 key)
+    {
+      const __m256i k = _mm256_set1_epi32(int(key));
+      size_t i        = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m256i p =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(packed + i));
+        const int hits =
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(p, k)));
+        if (hits)
+          return i + __builtin_ctz(hits);
+      }
+      for (; i < n; ++i) {
+        if (packed[i] == key)
+          return i;
+      }
+      return n;
+    }
+#endif
+
+    static void unpackOffsets(const uint32 *packed,
+                              size_t n,
+                              int bitsX,
+                              int bitsY,
+                              int *dx,
+                              int *dy,
+                              int *dz)
+    {
+#ifdef TAMRLEVELKDT_X86
+      if (cpuHasAVX2())
+        return unpackOffsetsAVX2(packed, n, bitsX, bitsY, dx, dy, dz);
+#endif
+      unpackOffsetsScalar(packed, n, bitsX, bitsY, dx, dy, dz);
+    }
+
+    // position of 'key' in the sorted 'packed', or n; short leaves are
+    // scanned, longer ones searched
+    static size_t findKey(const uint32 *packed, size_t n, uint32 key)
+    {
+#ifdef TAMRLEVELKDT_X86
+      if (n <= 64 && cpuHasAVX2())
+        return scanKeyAVX2(packed, n, key);
+#endif
+      const uint32 *it = std::lower_bound(packed, packed + n, key);
+      return it != packed + n && *it == key ? size_t(it - packed) : n;
+    }
+
+    template <typename COORD_T>
+    TAMRLevelKDT_t<COORD_T>::TAMRLevelKDT_t(const TAMRData_t<COORD_T> &input,
+                                            int level,
+                                            const TAMRKDTParams &params)
+        : params(params)
     {
-      std::unordered_map<int,TAMRLevel>::const_iterator itr = input.voxelsInLevel.find(level);
+      typename std::unordered_map<int,TAMRLevel_t<COORD_T>>::const_iterator itr = input.voxelsInLevel.find(level);
 
       if(itr == input.voxelsInLevel.end()){
         throw std::runtime_error("An wrong AMR level is specified");
       }
 
-      const TAMRLevel&  levelInput = itr->second;
+      build(itr->second, level, itr->second.voxels);
+    }
+
+    template <typename COORD_T>
+    TAMRLevelKDT_t<COORD_T>::TAMRLevelKDT_t(TAMRData_t<COORD_T> &&input,
+                                            int level,
+                                            const TAMRKDTParams &params)
+        : params(params)
+    {
+      typename std::unordered_map<int,TAMRLevel_t<COORD_T>>::iterator itr = input.voxelsInLevel.find(level);
+
+      if(itr == input.voxelsInLevel.end()){
+        throw std::runtime_error("An wrong AMR level is specified");
+      }
 
+      build(itr->second, level, std::move(itr->second.voxels));
+      itr->second.voxels = std::vector<Voxel>();
+    }
+
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::build(const TAMRLevel_t<COORD_T> &levelInput,
+                                        int levelID,
+                                        std::vector<Voxel> voxels)
+    {
+      this->level.level = levelID;
       this->level.cellWidthInModel = levelInput.cellWidthInModel;
       this->level.cellWidth = levelInput.cellWidth;
       this->level.halfCellWidth = levelInput.halfCellWidth;
       this->level.rcpCellWidth = levelInput.rcpCellWidth;
+      this->level.latticeOffset = levelInput.latticeOffset;
 
       this->worldBounds = levelInput.bounds;
 
-      PRINT(levelInput.voxels.size());
+      PRINT(voxels.size());
 
       node.resize(1);
-      buildRec(0,worldBounds, levelInput.voxels);
+      if (voxels.empty()) {
+        // buildRec() would leave the root unset, i.e. an inner node whose
+        // children are itself; make it a leaf without voxels instead, so
+        // lookups and value range queries simply find nothing
+        node[0].dim      = 3;
+        node[0].ofs      = 0;
+        node[0].numItems = 0;
+        leaf.resize(1);
+        return;
+      }
+      buildRec(0,worldBounds, std::move(voxels), 0);
 
     }
 
-    TAMRLevelKDT::~TAMRLevelKDT(){
+    template <typename COORD_T>
+    TAMRLevelKDT_t<COORD_T>::~TAMRLevelKDT_t(){
       for(auto &l : leaf){
         l.voxels.clear();
       }
@@ -36,32 +203,79 @@ namespace ospray {
       node.clear();
     }
 
-    void TAMRLevelKDT::makeLeaf(index_t nodeID,
-                    const box3f &bounds,
-                    const std::vector<TAMRVoxel> &voxels)
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::makeLeaf(index_t nodeID,
+                    const Box &bounds,
+                    std::vector<Voxel> voxels)
     {
       node[nodeID].dim = 3; 
       node[nodeID].ofs = this->leaf.size();
       node[nodeID].numItems = voxels.size();
 
-      TAMRLevelKDT::Leaf newLeaf; 
+      Leaf newLeaf; 
       newLeaf.bounds = bounds;
-      newLeaf.voxels = voxels;
 
-      this->leaf.push_back(newLeaf);
+      // slots are numbered x fastest over the leaf's bounds
+      const Vec bs = bounds.size() + Vec(1);
+      auto slotOf = [&](const Voxel &v) -> size_t {
+        const Vec d = v.lower - bounds.lower;
+        return size_t(d.x)
+               + size_t(bs.x) * (size_t(d.y) + size_t(bs.y) * size_t(d.z));
+      };
+
+      const size_t numWords = (newLeaf.numSlots() + 63) / 64;
+      if (numWords <= voxels.size()) {
+        // at most 12 bytes of mask and rank per voxel
+        newLeaf.occupancy.assign(numWords, 0);
+        for (const auto &v : voxels) {
+          const size_t slot = slotOf(v);
+          newLeaf.occupancy[slot >> 6] |= uint64(1) << (slot & 63);
+        }
+        newLeaf.occupancyRank.resize(numWords);
+        size_t count = 0;
+        for (size_t w = 0; w < numWords; ++w) {
+          newLeaf.occupancyRank[w] = uint32(count);
+          count += popcount(newLeaf.occupancy[w]);
+        }
+
+        if (count == voxels.size()) {
+          newLeaf.full = count == newLeaf.numSlots();
+          newLeaf.voxels.resize(count);
+          for (const auto &v : voxels) {
+            const size_t slot = slotOf(v);
+            const uint64 below =
+                newLeaf.occupancy[slot >> 6] & ((uint64(1) << (slot & 63)) - 1);
+            newLeaf.voxels[newLeaf.occupancyRank[slot >> 6] + popcount(below)] = v;
+          }
+        }
+        if (newLeaf.full || count != voxels.size()) {
+          // full leaves don't need the mask; overlapping voxels can't use it
+          newLeaf.occupancy     = std::vector<uint64>();
+          newLeaf.occupancyRank = std::vector<uint32>();
+        }
+      }
+      if (newLeaf.voxels.empty())
+        newLeaf.voxels = std::move(voxels);
+      if (params.compactLeaves)
+        newLeaf.makeCompact();
+
+      this->leaf.push_back(std::move(newLeaf));
 
     }
 
-    void TAMRLevelKDT::makeInner(index_t nodeID, int dim, float pos, int childID)
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::makeInner(index_t nodeID, int dim, COORD_T pos, int childID)
     {
       node[nodeID].dim = dim;
       node[nodeID].pos = pos;
       node[nodeID].ofs = childID;  
     }
 
-    void TAMRLevelKDT::buildRec(int nodeID, 
-                                const box3f &bounds, 
-                                std::vector<TAMRVoxel> voxels)
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::buildRec(int nodeID, 
+                                const Box &bounds, 
+                                std::vector<Voxel> voxels,
+                                int depth)
     {
 
       if(voxels.empty())
@@ -69,24 +283,28 @@ namespace ospray {
 
       int bestDim = -1;
 
-      vec3f bs = bounds.size() + vec3f(1);
+      Vec bs = bounds.size() + Vec(1);
       bestDim = (bs.x >= bs.y) ? ((bs.x >= bs.z) ? 0 : 2) : ((bs.y >= bs.z) ? 1 : 2); 
 
-      size_t numSlot = (size_t)bs.product();
-      if(numSlot == voxels.size())
+      size_t numSlot = size_t(bs.x) * size_t(bs.y) * size_t(bs.z);
+      if(numSlot == voxels.size()
+         || depth >= params.maxDepth
+         || voxels.size() <= params.minLeafSize
+         || (params.minOccupancy < 1.f
+             && double(voxels.size()) >= double(params.minOccupancy) * double(numSlot)))
       {
-        makeLeaf(nodeID, bounds, voxels);
+        makeLeaf(nodeID, bounds, std::move(voxels));
       }else{
 #if 0
         float bestPos = bounds.lower[bestDim] + 0.5 * bs[bestDim] - 1;
 #else 
-       float bestPos = getBestPos(bounds,voxels,bestDim);
+       COORD_T bestPos = getBestPos(bounds,voxels,bestDim);
 #endif 
 
 
 
-        std::vector<TAMRVoxel> l, r;
-        box3f lBounds, rBounds;
+        std::vector<Voxel> l, r;
+        Box lBounds, rBounds;
         for(auto & voxel : voxels){
           if(voxel.lower[bestDim] <= bestPos)
           {
@@ -106,71 +324,381 @@ namespace ospray {
         // PRINT(rBounds);
         // PRINT("====================");
 
+        // only voxels sharing one slot can end up all on one side
+        if (l.empty() || r.empty()) {
+          makeLeaf(nodeID, bounds, l.empty() ? std::move(r) : std::move(l));
+          return;
+        }
+
+        // the halves hold everything now, don't keep this level's copy
+        // alive all the way down the recursion
+        voxels = std::vector<Voxel>();
+
         int newNodeID = node.size();
         makeInner(nodeID, bestDim, bestPos, newNodeID);
 
-        node.push_back(TAMRLevelKDT::Node());
-        node.push_back(TAMRLevelKDT::Node());
+        node.push_back(Node());
+        node.push_back(Node());
+
+        buildRec(newNodeID+0,lBounds,std::move(l),depth+1);
+        buildRec(newNodeID+1,rBounds,std::move(r),depth+1);
+      }
+    }
+
+
+    template <typename COORD_T>
+    COORD_T TAMRLevelKDT_t<COORD_T>::getBestPos(const Box &bounds,
+                                                const std::vector<Voxel> &voxels,
+                                                int dim)
+    {
+      // count the voxels in each slice along 'dim'
+      // e.g. bounds = [[0,0,0],[3,3,2]], dim = 0 gives 4 slices
+      const COORD_T lower = bounds.lower[dim];
+      const size_t numSlices = size_t(bounds.upper[dim] - lower) + 1;
+      std::vector<size_t> pNumInDim(numSlices, 0);
+      for (const auto &voxel : voxels) {
+        const size_t slice = size_t(voxel.lower[dim] - lower);
+        if (slice < numSlices)
+          pNumInDim[slice]++;
+      }
 
-        buildRec(newNodeID+0,lBounds,l);
-        buildRec(newNodeID+1,rBounds,r);
+      // split after any slice whose count differs from the next one's,
+      // closest to the middle; the middle itself if there is none (for
+      // integer coordinates the slice below it)
+      const COORD_T mid = lower + (bounds.upper[dim] - lower) / COORD_T(2);
+      COORD_T bestPos = mid;
+      bool found = false;
+      for (size_t slice = 0; slice + 1 < numSlices; ++slice) {
+        if (pNumInDim[slice] == pNumInDim[slice + 1])
+          continue;
+        const COORD_T split = lower + COORD_T(slice);
+        if (!found || std::abs(double(split) - double(mid))
+                          < std::abs(double(bestPos) - double(mid)))
+          bestPos = split;
+        found = true;
       }
+
+      return bestPos;
+    } 
+
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::writeLeafSpheres(size_t leafBegin,
+                                        size_t leafEnd,
+                                        const size_t *leafOffset,
+                                        const vec4uc *palette,
+                                        size_t numColors,
+                                        vec4f *points,
+                                        vec4uc *colors,
+                                        bool release)
+    {
+      const float cellWidth = level.cellWidth;
+      const float radii     = 0.5 * cellWidth;
+      tasking::parallel_for(leafEnd - leafBegin, [&](size_t i) {
+        const size_t leafIndex = leafBegin + i;
+        Leaf &l                = leaf[leafIndex];
+        const vec4uc c         = palette[leafIndex % numColors];
+        vec4f *leafPoints      = points + leafOffset[leafIndex];
+        vec4uc *leafColors     = colors + leafOffset[leafIndex];
+        Vec lower[DECODE_BATCH];
+        const size_t numVoxels = l.size();
+        for (size_t b = 0; b < numVoxels; b += DECODE_BATCH) {
+          const size_t n = std::min(DECODE_BATCH, numVoxels - b);
+          l.decode(b, n, lower, nullptr);
+          for (size_t j = 0; j < n; ++j) {
+            const vec3f center =
+                (vec3f(lower[j]) + level.latticeOffset + vec3f(0.5))
+                * cellWidth;
+            leafPoints[b + j] = vec4f(center, radii);
+            leafColors[b + j] = c;
+          }
+        }
+        if (release)
+          l.release();
+      });
     }
 
+    template <typename COORD_T>
+    size_t TAMRLevelKDT_t<COORD_T>::Leaf::numSlots() const
+    {
+      const Vec bs = bounds.size() + Vec(1);
+      return size_t(bs.x) * size_t(bs.y) * size_t(bs.z);
+    }
 
-    float TAMRLevelKDT::getBestPos(const box3f& bounds, std::vector<TAMRVoxel> voxels, int dim)
+    template <typename COORD_T>
+    size_t TAMRLevelKDT_t<COORD_T>::Leaf::size() const
     {
+      return compact ? numVoxels : voxels.size();
+    }
 
-      // count the point number in each grid point on specific dimension.
-      // e.g. bounds = [[0,0,0],[3,3,2]], dim = 0
-      std::unordered_map<float, int> pNumInDim; 
-      for(auto& voxel: voxels){
-        pNumInDim[voxel.lower[dim]]++;
+    template <typename COORD_T>
+    bool TAMRLevelKDT_t<COORD_T>::Leaf::find(const Vec &p, Voxel &voxel) const
+    {
+      if (!compact && !full && occupancy.empty()) {
+        for (const auto &v : voxels) {
+          if (v.lower.x == p.x && v.lower.y == p.y && v.lower.z == p.z) {
+            voxel = v;
+            return true;
+          }
+        }
+        return false;
       }
 
-      vec3f bs = bounds.size() + vec3f(1);
-      int filledNum(1);
-      for(int i = 0 ; i < 3; i++){
-        if(i != dim)
-          filledNum *= bs[i];
+      const Vec d  = p - bounds.lower;
+      const Vec bs = bounds.size() + Vec(1);
+      if (d.x < 0 || d.y < 0 || d.z < 0 || d.x >= bs.x || d.y >= bs.y
+          || d.z >= bs.z)
+        return false;
+      const size_t x = size_t(d.x), y = size_t(d.y), z = size_t(d.z);
+      // not a lower corner of this level's cells
+      if (COORD_T(x) != d.x || COORD_T(y) != d.y || COORD_T(z) != d.z)
+        return false;
+
+      const size_t slot = x + size_t(bs.x) * (y + size_t(bs.y) * z);
+      if (!compact) {
+        if (full) {
+          voxel = voxels[slot];
+          return true;
+        }
+        const uint64 word = occupancy[slot >> 6];
+        const uint64 bit  = uint64(1) << (slot & 63);
+        if (!(word & bit))
+          return false;
+        voxel = voxels[occupancyRank[slot >> 6] + popcount(word & (bit - 1))];
+        return true;
+      }
+
+      size_t k = slot;
+      if (!full) {
+        const uint32 key = uint32(x) | uint32(y) << bitsX
+                           | uint32(z) << (bitsX + bitsY);
+        k = findKey(packedLower.data(), numVoxels, key);
+        if (k == numVoxels)
+          return false;
+      }
+      const size_t run =
+          std::upper_bound(runBegin.begin(), runBegin.end(), uint32(k))
+          - runBegin.begin() - 1;
+      voxel.lower = bounds.lower + Vec(COORD_T(x), COORD_T(y), COORD_T(z));
+      voxel.indexInBuffer = runIndex[run] + (k - runBegin[run]);
+      return true;
+    }
+
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::Leaf::decode(size_t begin,
+                                               size_t n,
+                                               Vec *lower,
+                                               uint64 *index) const
+    {
+      if (!compact) {
+        for (size_t k = 0; k < n; ++k) {
+          if (lower)
+            lower[k] = voxels[begin + k].lower;
+          if (index)
+            index[k] = voxels[begin + k].indexInBuffer;
+        }
+        return;
+      }
+
+      if (lower && full) {
+        // the slot gives the offset, x fastest
+        const size_t bsx = size_t(bounds.size().x) + 1;
+        const size_t bsy = size_t(bounds.size().y) + 1;
+        size_t x = begin % bsx, y = (begin / bsx) % bsy, z = begin / bsx / bsy;
+        for (size_t k = 0; k < n; ++k) {
+          lower[k] = bounds.lower + Vec(COORD_T(x), COORD_T(y), COORD_T(z));
+          if (++x == bsx) {
+            x = 0;
+            if (++y == bsy) {
+              y = 0;
+              ++z;
+            }
+          }
+        }
+      } else if (lower) {
+        int dx[DECODE_BATCH], dy[DECODE_BATCH], dz[DECODE_BATCH];
+        for (size_t b = 0; b < n; b += DECODE_BATCH) {
+          const size_t m = std::min(DECODE_BATCH, n - b);
+          unpackOffsets(packedLower.data() + begin + b, m, bitsX, bitsY, dx,
+                        dy, dz);
+          for (size_t k = 0; k < m; ++k) {
+            lower[b + k] =
+                bounds.lower
+                + Vec(COORD_T(dx[k]), COORD_T(dy[k]), COORD_T(dz[k]));
+          }
+        }
       }
 
+      if (index && n) {
+        size_t run =
+            std::upper_bound(runBegin.begin(), runBegin.end(), uint32(begin))
+            - runBegin.begin() - 1;
+        for (size_t k = 0; k < n; ++k) {
+          const size_t v = begin + k;
+          while (run + 1 < runBegin.size() && runBegin[run + 1] <= v)
+            ++run;
+          index[k] = runIndex[run] + (v - runBegin[run]);
+        }
+      }
+    }
 
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::Leaf::makeCompact()
+    {
+      if (compact || voxels.empty() || voxels.size() > UINT32_MAX)
+        return;
+      const Vec bs    = bounds.size() + Vec(1);
+      const int bitsZ = bitsFor(size_t(bs.z));
+      const int bx    = bitsFor(size_t(bs.x));
+      const int by    = bitsFor(size_t(bs.y));
+      if (bx + by + bitsZ > 32)
+        return;
 
-      std::vector<float> potentialPos;
-      float start = bounds.lower[dim];
-      float end = bounds.upper[dim];
-      while(start < end){
-        if(pNumInDim[start] != pNumInDim[start +1]){
-          potentialPos.push_back(start);
+      // (offset, voxel), so the offsets can be put in slot order
+      std::vector<std::pair<uint32, uint32>> keys(voxels.size());
+      for (size_t k = 0; k < voxels.size(); ++k) {
+        const Vec d    = voxels[k].lower - bounds.lower;
+        const size_t x = size_t(d.x), y = size_t(d.y), z = size_t(d.z);
+        // must decode to exactly the same lower corner
+        if (d.x < 0 || d.y < 0 || d.z < 0 || COORD_T(x) != d.x
+            || COORD_T(y) != d.y || COORD_T(z) != d.z
+            || !(bounds.lower.x + COORD_T(x) == voxels[k].lower.x
+                 && bounds.lower.y + COORD_T(y) == voxels[k].lower.y
+                 && bounds.lower.z + COORD_T(z) == voxels[k].lower.z))
+          return;
+        keys[k] = std::make_pair(
+            uint32(x) | uint32(y) << bx | uint32(z) << (bx + by), uint32(k));
+      }
+      // full and masked leaves are in slot order already
+      if (!full && occupancy.empty())
+        std::sort(keys.begin(), keys.end());
+
+      numVoxels = uint32(voxels.size());
+      bitsX     = uint8(bx);
+      bitsY     = uint8(by);
+      if (!full) {
+        packedLower.resize(numVoxels);
+        for (size_t k = 0; k < numVoxels; ++k)
+          packedLower[k] = keys[k].first;
+      }
+      for (size_t k = 0; k < numVoxels; ++k) {
+        const uint64 index = voxels[keys[k].second].indexInBuffer;
+        if (k == 0 || index != runIndex.back() + (k - runBegin.back())) {
+          runIndex.push_back(index);
+          runBegin.push_back(uint32(k));
         }
-        start++;
       }
- 
-      assert(potentialPos.size()!=0);
- 
-      // if(filledNum == 713){
-      //   PRINT(filledNum);
-      //   PRINT(bounds);
-      //   PRINT(dim);
-      //   PRINT(potentialPos.size());
-      //   PRINT("====================");
+      runIndex.shrink_to_fit();
+      runBegin.shrink_to_fit();
 
-      // }
+      compact       = true;
+      voxels        = std::vector<Voxel>();
+      occupancy     = std::vector<uint64>();
+      occupancyRank = std::vector<uint32>();
+    }
 
-      float bestPos = std::numeric_limits<float>::infinity();
-      float mid = bounds.center()[dim];
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::Leaf::release()
+    {
+      voxels        = std::vector<Voxel>();
+      occupancy     = std::vector<uint64>();
+      occupancyRank = std::vector<uint32>();
+      packedLower   = std::vector<uint32>();
+      runIndex      = std::vector<uint64>();
+      runBegin      = std::vector<uint32>();
+      numVoxels     = 0;
+    }
 
-      if(potentialPos.size() == 0)
-        bestPos = mid;
+    template <typename COORD_T>
+    bool TAMRLevelKDT_t<COORD_T>::find(const Vec &p, Voxel &voxel) const
+    {
+      if (leaf.empty())
+        return false;
+      size_t nodeID = 0;
+      while (!node[nodeID].isLeaf()) {
+        const Node &n = node[nodeID];
+        nodeID        = n.ofs + (p[n.dim] <= n.pos ? 0 : 1);
+      }
+      if (!leaf[node[nodeID].ofs].find(p, voxel))
+        return false;
+      voxel.level = level.level;
+      return true;
+    }
 
-      for (const auto &split : potentialPos) {
-          if (fabsf(split - mid) < fabsf(bestPos-mid))
-            bestPos = split;
+    template <typename COORD_T>
+    size_t TAMRLevelKDT_t<COORD_T>::sizeInBytes() const
+    {
+      size_t bytes = node.capacity() * sizeof(Node)
+                     + leaf.capacity() * sizeof(Leaf)
+                     + valueRange.capacity() * sizeof(range1f);
+      for (const auto &l : leaf) {
+        bytes += l.voxels.capacity() * sizeof(Voxel)
+                 + l.occupancy.capacity() * sizeof(uint64)
+                 + l.occupancyRank.capacity() * sizeof(uint32)
+                 + l.packedLower.capacity() * sizeof(uint32)
+                 + l.runIndex.capacity() * sizeof(uint64)
+                 + l.runBegin.capacity() * sizeof(uint32);
       }
+      return bytes;
+    }
 
-      return bestPos;
-    } 
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::computeValueRanges(const float *field)
+    {
+      std::vector<range1f> leafRange(leaf.size());
+      tasking::parallel_for(leaf.size(), [&](size_t leafID) {
+        const Leaf &l = leaf[leafID];
+        range1f r;
+        uint64 index[DECODE_BATCH];
+        for (size_t b = 0; b < l.size(); b += DECODE_BATCH) {
+          const size_t n = std::min(DECODE_BATCH, l.size() - b);
+          l.decode(b, n, nullptr, index);
+          for (size_t k = 0; k < n; ++k)
+            r.extend(field[index[k]]);
+        }
+        leafRange[leafID] = r;
+      });
+
+      // children are always stored after their parent, so a reverse
+      // sweep sees both children before the inner node itself
+      valueRange.resize(node.size());
+      for (size_t nodeID = node.size(); nodeID-- > 0;) {
+        const Node &n = node[nodeID];
+        if (n.isLeaf()) {
+          valueRange[nodeID] = leafRange[n.ofs];
+        } else {
+          valueRange[nodeID] = valueRange[n.ofs];
+          valueRange[nodeID].extend(valueRange[n.ofs + 1]);
+        }
+      }
+    }
+
+    template <typename COORD_T>
+    void TAMRLevelKDT_t<COORD_T>::findLeavesInRange(const range1f &range,
+                                         std::vector<size_t> &leafIDs) const
+    {
+      leafIDs.clear();
+      if (valueRange.empty())
+        throw std::runtime_error("computeValueRanges() has not been called");
+
+      std::vector<size_t> stack(1, 0);
+      while (!stack.empty()) {
+        const size_t nodeID = stack.back();
+        stack.pop_back();
+        const range1f &r = valueRange[nodeID];
+        if (r.upper < range.lower || r.lower > range.upper)
+          continue;
+        const Node &n = node[nodeID];
+        if (n.isLeaf()) {
+          leafIDs.push_back(n.ofs);
+        } else {
+          stack.push_back(n.ofs + 1);
+          stack.push_back(n.ofs);
+        }
+      }
+    }
+
+    template struct TAMRLevelKDT_t<float>;
+    template struct TAMRLevelKDT_t<int>;
 
   }  // namespace tamr
 }  // namespace ospray
@@ -1,4 +1,8 @@
+#ifndef TAMRLEVELKDT_H_
+#define TAMRLEVELKDT_H_
+
 #include "TAMRData.h"
+#include "ospcommon/range.h"
 
 using namespace ospray;
 using namespace ospray::sg;
@@ -6,10 +10,39 @@ using namespace ospray::sg;
 namespace ospray {
   namespace tamr {
 
-    struct TAMRLevelKDT
+    /*! when the build stops splitting. A node becomes a leaf once it
+      is fully occupied, 'maxDepth' levels deep, holds at most
+      'minLeafSize' voxels, or at least 'minOccupancy' of the cell
+      slots in its bounds hold a voxel. The defaults only stop at full
+      boxes, which on sparse levels gives deep trees of tiny leaves */
+    struct TAMRKDTParams
     {
-      TAMRLevelKDT(const TAMRData &input, int level);
-      ~TAMRLevelKDT();
+      int maxDepth{std::numeric_limits<int>::max()};
+      size_t minLeafSize{1};
+      float minOccupancy{1.f};
+      //! store the leaves' voxels in the compact form, see Leaf
+      bool compactLeaves{false};
+    };
+
+    /*! KD tree over the cells of one level. COORD_T is the voxel
+      coordinate type: float as the importer has always used, or int to
+      build and query on exact grid coordinates, see TAMRVoxel_t */
+    template <typename COORD_T>
+    struct TAMRLevelKDT_t
+    {
+      using Vec   = vec_t<COORD_T, 3>;
+      using Box   = box_t<COORD_T, 3>;
+      using Voxel = TAMRVoxel_t<COORD_T>;
+
+      TAMRLevelKDT_t(const TAMRData_t<COORD_T> &input,
+                     int level,
+                     const TAMRKDTParams &params = TAMRKDTParams());
+      /*! build from 'level' of 'input', moving its voxels into the tree
+        instead of copying them; that level of 'input' is left empty */
+      TAMRLevelKDT_t(TAMRData_t<COORD_T> &&input,
+                     int level,
+                     const TAMRKDTParams &params = TAMRKDTParams());
+      ~TAMRLevelKDT_t();
 
       /*! precomputed values per level, so we can easily compute
       logicla coordinates, find any level's cell width, etc */
@@ -20,15 +53,63 @@ namespace ospray {
         float rcpCellWidth;
         float halfCellWidth;
         int level;
+        //! see TAMRLevel_t::latticeOffset
+        vec3f latticeOffset;
       };
 
+      /*! the voxels of a leaf, ordered by their slot in 'bounds' (x
+        fastest). A full leaf finds a voxel by its slot directly; a
+        partial one keeps a bit per slot and finds it by rank. Leaves
+        too sparse for a mask to pay off have neither and are scanned.
+
+        A compact leaf keeps neither 'voxels' nor a mask. It stores
+         - each voxel's offset from bounds.lower, bit-packed into a
+           uint32 with x in the low bits, in slot order; none for full
+           leaves, where the slot gives the offset
+         - the voxels' field indices as runs of consecutive values.
+        That is 4 bytes or less per voxel instead of sizeof(Voxel).
+        Offsets are unpacked with AVX2 where available, and looked up
+        by an AVX2 scan or a binary search. Leaves whose offsets need
+        more than 32 bits, or aren't whole cells, stay uncompressed */
       struct Leaf
       {
-        Leaf() {}
-        Leaf(const Leaf &l) : voxels(l.voxels), bounds(l.bounds) {}
+        //! number of cell slots in 'bounds'
+        size_t numSlots() const;
+        //! number of voxels, in either form
+        size_t size() const;
+        /*! the voxel whose lower corner is 'p' into 'voxel'; false if
+          there is none. A compact leaf doesn't know its level and
+          leaves voxel.level alone */
+        bool find(const Vec &p, Voxel &voxel) const;
+        /*! lower corners and field indices of voxels [begin, begin +
+          n), in either form; either output may be null */
+        void decode(size_t begin, size_t n, Vec *lower, uint64 *index) const;
+        //! switch to the compact form if it can hold the voxels
+        void makeCompact();
+        //! free the voxels, in either form
+        void release();
+
+        std::vector<Voxel> voxels;
+        Box bounds;
+        //! every slot holds a voxel, voxels[slot] is the one in 'slot'
+        bool full{false};
+        /*! one bit per slot of 'bounds', set where there is a voxel;
+          empty for full and for unmasked leaves */
+        std::vector<uint64> occupancy;
+        //! number of set bits before each word of 'occupancy'
+        std::vector<uint32> occupancyRank;
 
-        std::vector<TAMRVoxel> voxels;
-        box3f bounds;
+        //! the voxels are kept in the fields below, 'voxels' is empty
+        bool compact{false};
+        uint32 numVoxels{0};
+        //! bits of the x and y offsets in 'packedLower', z gets the rest
+        uint8 bitsX{0};
+        uint8 bitsY{0};
+        //! offsets from bounds.lower, one per voxel; empty if 'full'
+        std::vector<uint32> packedLower;
+        //! first field index of each run, and the voxel it starts at
+        std::vector<uint64> runIndex;
+        std::vector<uint32> runBegin;
       };
 
       /*! each node in the tree refers to either a pair ofo child
@@ -51,7 +132,7 @@ namespace ospray {
         // second dword
         union
         {
-          float pos;
+          COORD_T pos;
           uint32 numItems;
         };
       };
@@ -63,19 +144,73 @@ namespace ospray {
       //! list of leaf nodes
       std::vector<Leaf> leaf;
       //! world bounds of domain
-      box3f worldBounds;
+      Box worldBounds;
+      //! the parameters the tree was built with
+      TAMRKDTParams params;
+      /*! optional min/max of a cell field per node, parallel to node[];
+        empty until computeValueRanges() is called */
+      std::vector<range1f> valueRange;
+
+      /*! the voxel of this level whose lower corner is 'p' into
+        'voxel', false if there is none: descends on the split planes,
+        then looks the slot up in the leaf */
+      bool find(const Vec &p, Voxel &voxel) const;
+
+      //! heap bytes held by the nodes, leaves, voxels and masks
+      size_t sizeInBytes() const;
+
+      /*! gather the values of 'field' (indexed by indexInBuffer) for
+        every leaf in parallel and propagate the ranges up the tree.
+        Call again to switch fields, the tree itself is untouched */
+      void computeValueRanges(const float *field);
+
+      /*! IDs of the leaves whose value range overlaps 'range', skipping
+        whole subtrees that can't contribute. Needs computeValueRanges() */
+      void findLeavesInRange(const range1f &range,
+                             std::vector<size_t> &leafIDs) const;
+
+      /*! write a sphere (cell center, half cell width) and the leaf's
+        palette color, palette[leaf % numColors], for every voxel of
+        leaves [leafBegin, leafEnd), in parallel over leaves. Leaf i's
+        spheres start at slot leafOffset[i] of 'points' and 'colors'.
+        With 'release' each leaf's voxels are freed once written */
+      void writeLeafSpheres(size_t leafBegin,
+                            size_t leafEnd,
+                            const size_t *leafOffset,
+                            const vec4uc *palette,
+                            size_t numColors,
+                            vec4f *points,
+                            vec4uc *colors,
+                            bool release = false);
+
+      /*! split position along 'dim' closest to the middle of 'bounds'
+        where the number of voxels per slice changes, or the middle if
+        every slice holds as many voxels */
+      static COORD_T getBestPos(const Box &bounds,
+                                const std::vector<Voxel> &voxels,
+                                int dim);
 
      private:
+      void build(const TAMRLevel_t<COORD_T> &levelInput,
+                 int levelID,
+                 std::vector<Voxel> voxels);
       void makeLeaf(index_t nodeID,
-                    const box3f &bounds,
-                    const std::vector<TAMRVoxel> &voxels);
-      void makeInner(index_t nodeID, int dim, float pos, int childID);
+                    const Box &bounds,
+                    std::vector<Voxel> voxels);
+      void makeInner(index_t nodeID, int dim, COORD_T pos, int childID);
       void buildRec(int nodeID,
-                    const box3f &bounds,
-                    std::vector<TAMRVoxel> voxels);
-
-      float getBestPos(const box3f& bounds, std::vector<TAMRVoxel> voxels, int dim);
+                    const Box &bounds,
+                    std::vector<Voxel> voxels,
+                    int depth);
     };
 
+    extern template struct TAMRLevelKDT_t<float>;
+    extern template struct TAMRLevelKDT_t<int>;
+
+    using TAMRLevelKDT  = TAMRLevelKDT_t<float>;
+    using TAMRLevelKDTi = TAMRLevelKDT_t<int>;
+
   }  // namespace tamr
 }  // namespace ospray
+
+#endif
@@ -0,0 +1,196 @@
+#include "TAMRMacrocellGrid.h"
+
+#include <atomic>
+#include <cmath>
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    static inline void atomicMin(std::atomic<float> &a, float v)
+    {
+      float cur = a.load();
+      while (v < cur && !a.compare_exchange_weak(cur, v))
+        ;
+    }
+
+    static inline void atomicMax(std::atomic<float> &a, float v)
+    {
+      float cur = a.load();
+      while (v > cur && !a.compare_exchange_weak(cur, v))
+        ;
+    }
+
+    static inline void atomicMin(std::atomic<int> &a, int v)
+    {
+      int cur = a.load();
+      while (v < cur && !a.compare_exchange_weak(cur, v))
+        ;
+    }
+
+    TAMRMacrocellGrid::TAMRMacrocellGrid(const TAMRData &data,
+                                         const float *field,
+                                         int maxDim)
+    {
+      for (const auto &lv : data.voxelsInLevel) {
+        const TAMRLevel &level = lv.second;
+        if (level.voxels.empty())
+          continue;
+        bounds.extend(level.bounds.lower * level.cellWidth);
+        bounds.extend((level.bounds.upper + vec3f(1.f)) * level.cellWidth);
+      }
+      if (bounds.empty()) {
+        dims     = vec3i(0);
+        cellSize = 0.f;
+        return;
+      }
+
+      const vec3f size = bounds.size();
+      cellSize = std::max(size.x, std::max(size.y, size.z)) / maxDim;
+      dims     = vec3i(std::max(1, (int)std::ceil(size.x / cellSize)),
+                   std::max(1, (int)std::ceil(size.y / cellSize)),
+                   std::max(1, (int)std::ceil(size.z / cellSize)));
+
+      const size_t numCells = size_t(dims.x) * dims.y * dims.z;
+      std::vector<std::atomic<float>> lo(numCells), hi(numCells);
+      std::vector<std::atomic<int>> finest(numCells);
+      for (size_t i = 0; i < numCells; ++i) {
+        lo[i]     = std::numeric_limits<float>::infinity();
+        hi[i]     = -std::numeric_limits<float>::infinity();
+        finest[i] = std::numeric_limits<int>::max();
+      }
+
+      const size_t voxelsPerTask = 64 * 1024;
+      for (const auto &lv : data.voxelsInLevel) {
+        const TAMRLevel &level = lv.second;
+        const size_t numTasks =
+            (level.voxels.size() + voxelsPerTask - 1) / voxelsPerTask;
+        tasking::parallel_for(numTasks, [&](size_t taskID) {
+          const size_t begin = taskID * voxelsPerTask;
+          const size_t end =
+              std::min(level.voxels.size(), begin + voxelsPerTask);
+          for (size_t i = begin; i < end; ++i) {
+            const TAMRVoxel &v = level.voxels[i];
+            const float value  = field[v.indexInBuffer];
+            const vec3f lower  = v.lower * level.cellWidth;
+            const vec3f upper  = lower + vec3f(level.cellWidth);
+            // cells only touching the voxel's upper faces are not overlapped
+            const vec3i c0 = cellCoord(lower);
+            const vec3i c1 = cellCoord(upper - vec3f(1e-6f * cellSize));
+            for (int z = c0.z; z <= c1.z; ++z)
+              for (int y = c0.y; y <= c1.y; ++y)
+                for (int x = c0.x; x <= c1.x; ++x) {
+                  const size_t id = cellID(vec3i(x, y, z));
+                  atomicMin(lo[id], value);
+                  atomicMax(hi[id], value);
+                  atomicMin(finest[id], lv.first);
+                }
+          }
+        });
+      }
+
+      cells.resize(numCells);
+      tasking::parallel_for(numCells, [&](size_t i) {
+        cells[i].valueRange = range1f(lo[i], hi[i]);
+        cells[i].finestLevel =
+            finest[i] == std::numeric_limits<int>::max() ? -1 : int(finest[i]);
+      });
+    }
+
+    vec3i TAMRMacrocellGrid::cellCoord(const vec3f &p) const
+    {
+      const vec3f c = (p - bounds.lower) / cellSize;
+      return vec3i(std::min(std::max((int)std::floor(c.x), 0), dims.x - 1),
+                   std::min(std::max((int)std::floor(c.y), 0), dims.y - 1),
+                   std::min(std::max((int)std::floor(c.z), 0), dims.z - 1));
+    }
+
+    void TAMRMacrocellGrid::overlappingCells(const box3f &box,
+                                             std::vector<size_t> &cellIDs) const
+    {
+      cellIDs.clear();
+      if (cells.empty() || box.upper.x < bounds.lower.x
+          || box.upper.y < bounds.lower.y || box.upper.z < bounds.lower.z
+          || box.lower.x > bounds.upper.x || box.lower.y > bounds.upper.y
+          || box.lower.z > bounds.upper.z)
+        return;
+
+      const vec3i c0 = cellCoord(box.lower);
+      const vec3i c1 = cellCoord(box.upper);
+      for (int z = c0.z; z <= c1.z; ++z)
+        for (int y = c0.y; y <= c1.y; ++y)
+          for (int x = c0.x; x <= c1.x; ++x)
+            cellIDs.push_back(cellID(vec3i(x, y, z)));
+    }
+
+    void TAMRMacrocellGrid::traverseRay(const vec3f &org,
+                                        const vec3f &dir,
+                                        float tnear,
+                                        float tfar,
+                                        std::vector<RayHit> &hits) const
+    {
+      hits.clear();
+      if (cells.empty())
+        return;
+
+      // clip the ray against the grid bounds
+      for (int d = 0; d < 3; ++d) {
+        if (dir[d] == 0.f) {
+          if (org[d] < bounds.lower[d] || org[d] > bounds.upper[d])
+            return;
+          continue;
+        }
+        const float rcp = 1.f / dir[d];
+        float t0        = (bounds.lower[d] - org[d]) * rcp;
+        float t1        = (bounds.upper[d] - org[d]) * rcp;
+        if (t0 > t1)
+          std::swap(t0, t1);
+        tnear = std::max(tnear, t0);
+        tfar  = std::min(tfar, t1);
+      }
+      if (tnear > tfar)
+        return;
+
+      // Amanatides & Woo style DDA from the entry point
+      vec3i cell = cellCoord(org + tnear * dir);
+      vec3i step;
+      vec3f tNext, tDelta;
+      for (int d = 0; d < 3; ++d) {
+        if (dir[d] > 0.f) {
+          step[d]   = 1;
+          tDelta[d] = cellSize / dir[d];
+          tNext[d] =
+              (bounds.lower[d] + (cell[d] + 1) * cellSize - org[d]) / dir[d];
+        } else if (dir[d] < 0.f) {
+          step[d]   = -1;
+          tDelta[d] = -cellSize / dir[d];
+          tNext[d]  = (bounds.lower[d] + cell[d] * cellSize - org[d]) / dir[d];
+        } else {
+          step[d]   = 0;
+          tDelta[d] = std::numeric_limits<float>::infinity();
+          tNext[d]  = std::numeric_limits<float>::infinity();
+        }
+      }
+
+      float t = tnear;
+      while (t < tfar) {
+        const int d =
+            (tNext.x <= tNext.y) ? (tNext.x <= tNext.z ? 0 : 2)
+                                 : (tNext.y <= tNext.z ? 1 : 2);
+        RayHit hit;
+        hit.cellID = cellID(cell);
+        hit.t0     = t;
+        hit.t1     = std::min(tNext[d], tfar);
+        hits.push_back(hit);
+
+        t = tNext[d];
+        cell[d] += step[d];
+        if (cell[d] < 0 || cell[d] >= dims[d])
+          break;
+        tNext[d] += tDelta[d];
+      }
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,69 @@
+#ifndef TAMRMACROCELLGRID_H_
+#define TAMRMACROCELLGRID_H_
+
+#include <vector>
+#include "TAMRData.h"
+#include "ospcommon/range.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! coarse uniform grid over the whole AMR domain, across all levels.
+      Each macrocell records the value range of the cells overlapping it
+      and the finest (smallest) level among them, for empty space
+      skipping and picking step sizes. Works in the same world space the
+      importers use, i.e. voxel.lower * cellWidth */
+    struct TAMRMacrocellGrid
+    {
+      struct Cell
+      {
+        range1f valueRange;
+        //! finest AMR level overlapping this cell, -1 if none does
+        int finestLevel;
+
+        inline bool empty() const
+        {
+          return finestLevel < 0;
+        }
+      };
+
+      //! a macrocell pierced by a ray, and the ray interval inside it
+      struct RayHit
+      {
+        size_t cellID;
+        float t0;
+        float t1;
+      };
+
+      /*! build from all levels of 'data' and a cell field indexed by
+        indexInBuffer; the longest domain axis gets 'maxDim' cells */
+      TAMRMacrocellGrid(const TAMRData &data, const float *field, int maxDim = 64);
+
+      inline size_t cellID(const vec3i &c) const
+      {
+        return c.x + size_t(dims.x) * (c.y + size_t(dims.y) * c.z);
+      }
+
+      //! IDs of all macrocells overlapping 'box'
+      void overlappingCells(const box3f &box, std::vector<size_t> &cellIDs) const;
+
+      //! macrocells along a ray in front-to-back order, via 3D DDA
+      void traverseRay(const vec3f &org,
+                       const vec3f &dir,
+                       float tnear,
+                       float tfar,
+                       std::vector<RayHit> &hits) const;
+
+      box3f bounds;
+      vec3i dims;
+      float cellSize;
+      std::vector<Cell> cells;
+
+     private:
+      vec3i cellCoord(const vec3f &p) const;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
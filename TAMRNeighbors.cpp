@@ -0,0 +1,129 @@
+#include "TAMRNeighbors.h"
+
+#include <cstdlib>
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    static const size_t BLOCK_SIZE = 4096;
+
+    static inline vec3i shiftDown(const vec3i &p, int level)
+    {
+      // arithmetic shift, i.e. floor division by 2^level
+      return vec3i(p.x >> level, p.y >> level, p.z >> level);
+    }
+
+    TAMRNeighbors::TAMRNeighbors(const TAMRData &data) : cells(data) {}
+
+    void TAMRNeighbors::neighborsOf(const TAMRVoxel &voxel,
+                                    Connectivity connectivity,
+                                    std::vector<Neighbor> &neighbors) const
+    {
+      const int L       = voxel.level;
+      const int size    = 1 << L;
+      const vec3i lower = cells.gridLower(voxel);
+      const size_t first = neighbors.size();
+
+      auto emit = [&](size_t indexInBuffer, int level, int direction) {
+        Neighbor n;
+        n.indexInBuffer = indexInBuffer;
+        n.level         = level;
+        n.direction     = direction;
+        neighbors.push_back(n);
+      };
+
+      for (int dz = -1; dz <= 1; ++dz)
+        for (int dy = -1; dy <= 1; ++dy)
+          for (int dx = -1; dx <= 1; ++dx) {
+            const int order = std::abs(dx) + std::abs(dy) + std::abs(dz);
+            if (order == 0 || order > connectivity)
+              continue;
+            const vec3i d(dx, dy, dz);
+            const int direction = (dx + 1) + 3 * (dy + 1) + 9 * (dz + 1);
+
+            // same level: exactly one cell, and then nothing else can be
+            // there since levels don't overlap
+            size_t idx;
+            if (findCell(L, shiftDown(lower, L) + d, idx)) {
+              emit(idx, L, direction);
+              continue;
+            }
+
+            // coarser: the one cell containing a point just outside
+            const vec3i probe(dx < 0 ? lower.x - 1 : lower.x + (dx > 0) * size,
+                              dy < 0 ? lower.y - 1 : lower.y + (dy > 0) * size,
+                              dz < 0 ? lower.z - 1 : lower.z + (dz > 0) * size);
+            bool foundCoarser = false;
+            for (const int l : cells.levels) {
+              if (l <= L || !findCell(l, shiftDown(probe, l), idx))
+                continue;
+              foundCoarser = true;
+              bool seen    = false;
+              for (size_t i = first; i < neighbors.size() && !seen; ++i)
+                seen = neighbors[i].indexInBuffer == idx;
+              if (!seen)
+                emit(idx, l, direction);
+              break;
+            }
+            if (foundCoarser)
+              continue;
+
+            // finer: every cell of the adjacent face/edge/corner, on any
+            // finer level that covers part of it
+            for (const int l : cells.levels) {
+              if (l >= L)
+                break;
+              const int n      = 1 << (L - l);
+              const vec3i base = shiftDown(lower, l);
+              vec3i c0, c1;
+              for (int a = 0; a < 3; ++a) {
+                c0[a] = d[a] < 0 ? base[a] - 1 : base[a] + (d[a] > 0) * n;
+                c1[a] = d[a] == 0 ? c0[a] + n - 1 : c0[a];
+              }
+              for (int z = c0.z; z <= c1.z; ++z)
+                for (int y = c0.y; y <= c1.y; ++y)
+                  for (int x = c0.x; x <= c1.x; ++x) {
+                    if (findCell(l, vec3i(x, y, z), idx))
+                      emit(idx, l, direction);
+                  }
+            }
+          }
+    }
+
+    void TAMRNeighbors::neighborsOf(const TAMRVoxel *voxels,
+                                    size_t numVoxels,
+                                    Connectivity connectivity,
+                                    std::vector<size_t> &offsets,
+                                    std::vector<Neighbor> &neighbors) const
+    {
+      const size_t numBlocks = (numVoxels + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      std::vector<std::vector<Neighbor>> blockNeighbors(numBlocks);
+      offsets.resize(numVoxels + 1);
+      offsets[0] = 0;
+
+      // each block gathers into its own list, counts go to offsets[i+1]
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        std::vector<Neighbor> &local = blockNeighbors[b];
+        const size_t end = std::min(numVoxels, (b + 1) * BLOCK_SIZE);
+        for (size_t i = b * BLOCK_SIZE; i < end; ++i) {
+          const size_t before = local.size();
+          neighborsOf(voxels[i], connectivity, local);
+          offsets[i + 1] = local.size() - before;
+        }
+      });
+
+      for (size_t i = 0; i < numVoxels; ++i)
+        offsets[i + 1] += offsets[i];
+
+      neighbors.resize(offsets[numVoxels]);
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        std::copy(blockNeighbors[b].begin(),
+                  blockNeighbors[b].end(),
+                  neighbors.begin() + offsets[b * BLOCK_SIZE]);
+      });
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
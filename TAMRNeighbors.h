@@ -0,0 +1,67 @@
+#ifndef TAMRNEIGHBORS_H_
+#define TAMRNEIGHBORS_H_
+
+#include <vector>
+#include "TAMRCellIndex.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! face, edge and corner neighbors of AMR cells across levels, for
+      gradients, ghost cells and crack-free interpolation. Lookups go
+      through a TAMRCellIndex, so cells use its coordinates.
+      Assumes leaf-only AMR data where cells of different levels don't
+      overlap, as in the exajet hex files */
+    struct TAMRNeighbors
+    {
+      //! which of the 26 surrounding directions are searched
+      enum Connectivity
+      {
+        Faces   = 1,  // 6 neighbors sharing a face
+        Edges   = 2,  // 18, faces and edges
+        Corners = 3   // all 26
+      };
+
+      struct Neighbor
+      {
+        size_t indexInBuffer;
+        int level;
+        //! 0..26, (dx+1) + 3*(dy+1) + 9*(dz+1) with 13 being the cell itself
+        int direction;
+      };
+
+      TAMRNeighbors(const TAMRData &data);
+
+      /*! indexInBuffer of the level 'level' cell at level-local integer
+        coordinate 'cell', see TAMRCellIndex */
+      inline bool findCell(int level,
+                           const vec3i &cell,
+                           size_t &indexInBuffer) const
+      {
+        return cells.find(level, cell, indexInBuffer);
+      }
+
+      /*! append the neighbors of 'voxel' to 'neighbors'. A coarser
+        neighbor touching the cell along several directions is reported
+        once, with the first direction it was found in; a finer level
+        face contributes all of its cells */
+      void neighborsOf(const TAMRVoxel &voxel,
+                       Connectivity connectivity,
+                       std::vector<Neighbor> &neighbors) const;
+
+      /*! neighbors of a batch of cells, computed in parallel. On return
+        the neighbors of cell i are neighbors[offsets[i]..offsets[i+1]) */
+      void neighborsOf(const TAMRVoxel *voxels,
+                       size_t numVoxels,
+                       Connectivity connectivity,
+                       std::vector<size_t> &offsets,
+                       std::vector<Neighbor> &neighbors) const;
+
+      //! the per-level cell lookup the queries run on
+      TAMRCellIndex cells;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
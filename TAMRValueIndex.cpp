@@ -0,0 +1,91 @@
+#include "TAMRValueIndex.h"
+
+#include <algorithm>
+
+#include "ParallelSort.h"
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    TAMRValueIndex::TAMRValueIndex(const TAMRData &data, const float *field)
+    {
+      for (const auto &lv : data.voxelsInLevel) {
+        const std::vector<TAMRVoxel> &voxels = lv.second.voxels;
+        std::vector<Entry> &entries          = entriesInLevel[lv.first];
+        entries.resize(voxels.size());
+
+        const size_t chunkSize = 1 << 16;
+        tasking::parallel_for((voxels.size() + chunkSize - 1) / chunkSize,
+                              [&](size_t c) {
+          const size_t end = std::min(voxels.size(), (c + 1) * chunkSize);
+          for (size_t i = c * chunkSize; i < end; ++i) {
+            entries[i].value         = field[voxels[i].indexInBuffer];
+            entries[i].indexInBuffer = voxels[i].indexInBuffer;
+          }
+        });
+
+        parallelSort(entries);
+      }
+    }
+
+    void TAMRValueIndex::findSpans(const range1f &range,
+                                   int level,
+                                   std::vector<Span> &spans) const
+    {
+      spans.clear();
+      Entry lo, hi;
+      lo.value = range.lower;
+      hi.value = range.upper;
+      for (const auto &lv : entriesInLevel) {
+        if (level != -1 && lv.first != level)
+          continue;
+        const std::vector<Entry> &entries = lv.second;
+        auto begin = std::lower_bound(entries.begin(), entries.end(), lo);
+        auto end   = std::upper_bound(begin, entries.end(), hi);
+        if (end > begin) {
+          Span span;
+          span.begin = &*begin;
+          span.size  = end - begin;
+          spans.push_back(span);
+        }
+      }
+    }
+
+    size_t TAMRValueIndex::count(const range1f &range, int level) const
+    {
+      std::vector<Span> spans;
+      findSpans(range, level, spans);
+      size_t n = 0;
+      for (const auto &s : spans)
+        n += s.size;
+      return n;
+    }
+
+    void TAMRValueIndex::query(const range1f &range,
+                               std::vector<size_t> &indices,
+                               int level) const
+    {
+      std::vector<Span> spans;
+      findSpans(range, level, spans);
+
+      size_t total = 0;
+      for (const auto &s : spans)
+        total += s.size;
+      indices.resize(total);
+
+      size_t *out = indices.data();
+      const size_t chunkSize = 1 << 16;
+      for (const auto &s : spans) {
+        tasking::parallel_for((s.size + chunkSize - 1) / chunkSize,
+                              [&](size_t c) {
+          const size_t end = std::min(s.size, (c + 1) * chunkSize);
+          for (size_t i = c * chunkSize; i < end; ++i)
+            out[i] = s.begin[i].indexInBuffer;
+        });
+        out += s.size;
+      }
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,55 @@
+#ifndef TAMRVALUEINDEX_H_
+#define TAMRVALUEINDEX_H_
+
+#include <unordered_map>
+#include <vector>
+#include "TAMRData.h"
+#include "ospcommon/range.h"
+
+namespace ospray {
+  namespace tamr {
+
+    /*! per-level value-sorted copy of a cell field, so "all cells with a
+      value in [a,b]" is two binary searches and a parallel copy instead
+      of a linear scan over the whole field */
+    struct TAMRValueIndex
+    {
+      struct Entry
+      {
+        float value;
+        size_t indexInBuffer;
+
+        inline bool operator<(const Entry &o) const
+        {
+          return value < o.value;
+        }
+      };
+
+      //! build for every level of 'data', 'field' indexed by indexInBuffer
+      TAMRValueIndex(const TAMRData &data, const float *field);
+
+      /*! indexInBuffer of every cell whose value lies in [range.lower,
+        range.upper], on 'level' or on all levels if level is -1. Results
+        are grouped by level and sorted by value within a level */
+      void query(const range1f &range,
+                 std::vector<size_t> &indices,
+                 int level = -1) const;
+
+      //! number of cells query() would return
+      size_t count(const range1f &range, int level = -1) const;
+
+      std::unordered_map<int, std::vector<Entry>> entriesInLevel;
+
+     private:
+      struct Span
+      {
+        const Entry *begin;
+        size_t size;
+      };
+      void findSpans(const range1f &range, int level, std::vector<Span> &spans) const;
+    };
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
@@ -0,0 +1,648 @@
+#include "VTPSurface.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "ospcommon/tasking/parallel_for.h"
+
+namespace ospray {
+  namespace tamr {
+
+    enum class VTPType
+    {
+      Int32,
+      Int64,
+      UInt32,
+      UInt64,
+      Float32,
+      Float64,
+      Unknown
+    };
+
+    static VTPType parseVTPType(const std::string &name)
+    {
+      if (name == "Int32")
+        return VTPType::Int32;
+      if (name == "Int64")
+        return VTPType::Int64;
+      if (name == "UInt32")
+        return VTPType::UInt32;
+      if (name == "UInt64")
+        return VTPType::UInt64;
+      if (name == "Float32")
+        return VTPType::Float32;
+      if (name == "Float64")
+        return VTPType::Float64;
+      return VTPType::Unknown;
+    }
+
+    static size_t typeSize(VTPType type)
+    {
+      switch (type) {
+      case VTPType::Int32:
+      case VTPType::UInt32:
+      case VTPType::Float32:
+        return 4;
+      case VTPType::Int64:
+      case VTPType::UInt64:
+      case VTPType::Float64:
+        return 8;
+      default:
+        return 0;
+      }
+    }
+
+    // the raw data may sit at any byte offset, so elements are memcpy'd
+    template <typename T>
+    static inline T load(const char *data, size_t i)
+    {
+      T value;
+      memcpy(&value, data + i * sizeof(T), sizeof(T));
+      return value;
+    }
+
+    static inline int64 readInt(const char *data, VTPType type, size_t i)
+    {
+      switch (type) {
+      case VTPType::Int32:
+        return load<int32_t>(data, i);
+      case VTPType::UInt32:
+        return load<uint32_t>(data, i);
+      case VTPType::Int64:
+        return load<int64_t>(data, i);
+      default:
+        return int64(load<uint64_t>(data, i));
+      }
+    }
+
+    static const char *findString(const char *begin,
+                                  const char *end,
+                                  const char *s)
+    {
+      if (begin >= end)
+        return nullptr;
+      return static_cast<const char *>(
+          memmem(begin, end - begin, s, strlen(s)));
+    }
+
+    static const char *findChar(const char *begin, const char *end, char c)
+    {
+      if (begin >= end)
+        return nullptr;
+      return static_cast<const char *>(memchr(begin, c, end - begin));
+    }
+
+    //! value of attribute 'name' in the tag [tag, tagEnd)
+    static bool attribute(const char *tag,
+                          const char *tagEnd,
+                          const char *name,
+                          std::string &value)
+    {
+      const std::string key = std::string(name) + "=\"";
+      const char *p         = tag;
+      while ((p = findString(p, tagEnd, key.c_str()))) {
+        if (p > tag && isspace(p[-1])) {
+          const char *begin = p + key.size();
+          const char *end   = findChar(begin, tagEnd, '"');
+          if (!end)
+            return false;
+          value.assign(begin, end);
+          return true;
+        }
+        p += key.size();
+      }
+      return false;
+    }
+
+    static size_t sizeAttribute(const char *tag,
+                                const char *tagEnd,
+                                const char *name,
+                                size_t defaultValue = 0)
+    {
+      std::string value;
+      return attribute(tag, tagEnd, name, value)
+                 ? strtoull(value.c_str(), nullptr, 10)
+                 : defaultValue;
+    }
+
+    static int base64Value(char c)
+    {
+      if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+      if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+      if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+      if (c == '+')
+        return 62;
+      if (c == '/')
+        return 63;
+      if (c == '=')
+        return 0;
+      return -1;
+    }
+
+    /*! decode 'bytes' bytes of the base64 text at 'in' into 'out',
+      returns the end of the text consumed */
+    static const char *decodeBase64(const char *in,
+                                    const char *end,
+                                    size_t bytes,
+                                    char *out)
+    {
+      static const struct Table
+      {
+        Table()
+        {
+          for (int c = 0; c < 256; ++c)
+            value[c] = base64Value(char(c));
+        }
+        int value[256];
+      } table;
+
+      const size_t groups = (bytes + 2) / 3;
+      if (size_t(end - in) < 4 * groups)
+        throw std::runtime_error("truncated base64 data");
+
+      for (size_t g = 0; g < groups; ++g, in += 4) {
+        int v[4];
+        for (int k = 0; k < 4; ++k) {
+          v[k] = table.value[uint8(in[k])];
+          if (v[k] < 0)
+            throw std::runtime_error("invalid base64 data");
+        }
+        const uint32 word = (v[0] << 18) | (v[1] << 12) | (v[2] << 6) | v[3];
+        const char decoded[3] = {
+            char(word >> 16), char(word >> 8), char(word)};
+        const size_t n = std::min(size_t(3), bytes - 3 * g);
+        memcpy(out + 3 * g, decoded, n);
+      }
+      return in;
+    }
+
+    struct VTPDataArray
+    {
+      enum Format
+      {
+        Missing,
+        Appended,
+        Binary,
+        Ascii
+      };
+
+      Format format{Missing};
+      VTPType type{VTPType::Unknown};
+      size_t components{1};
+      //! offset behind the appended data's '_' marker
+      size_t offset{0};
+      //! start of the inline base64 text
+      const char *text{nullptr};
+    };
+
+    struct VTPPiece
+    {
+      size_t numPoints{0};
+      size_t numPolys{0};
+      VTPDataArray points;
+      VTPDataArray connectivity;
+      VTPDataArray offsets;
+      //! filled in by countTriangles()
+      size_t numTriangles{0};
+    };
+
+    /*! one mapped .vtp file and the arrays its XML header describes;
+      throws std::runtime_error for anything it can't read */
+    class VTPFile
+    {
+     public:
+      VTPFile(const FileName &fileName);
+      ~VTPFile();
+
+      /*! decoded bytes of 'array'. Raw appended data is returned in
+        place, base64 text is decoded into 'scratch' */
+      const char *read(const VTPDataArray &array,
+                       size_t &bytes,
+                       std::vector<char> &scratch) const;
+
+      void countTriangles(VTPPiece &piece, std::vector<char> &scratch) const;
+
+      void fill(const VTPPiece &piece,
+                vec3f *vertices,
+                vec3i *indices,
+                int vertexBase,
+                std::vector<char> &scratch) const;
+
+      std::vector<VTPPiece> pieces;
+
+     private:
+      void parseHeader();
+
+      size_t size{0};
+      const char *begin{nullptr};
+      const char *end{nullptr};
+      bool uint64Header{false};
+      bool base64Appended{false};
+      const char *appended{nullptr};
+    };
+
+    VTPFile::VTPFile(const FileName &fileName)
+    {
+      const int fd = open(fileName.c_str(), O_RDONLY);
+      if (fd == -1)
+        throw std::runtime_error(strerror(errno));
+      struct stat statBuf = {0};
+      fstat(fd, &statBuf);
+      size = statBuf.st_size;
+      void *mapping =
+          size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+      // the mapping stays valid without the descriptor, so thousands of
+      // surface files can be open at once
+      close(fd);
+      if (mapping == MAP_FAILED)
+        throw std::runtime_error("could not map file");
+      begin = static_cast<const char *>(mapping);
+      end   = begin + size;
+
+      try {
+        parseHeader();
+      } catch (...) {
+        munmap((void *)begin, size);
+        throw;
+      }
+    }
+
+    VTPFile::~VTPFile()
+    {
+      munmap((void *)begin, size);
+    }
+
+    void VTPFile::parseHeader()
+    {
+      const char *xmlEnd = findString(begin, end, "<AppendedData");
+      if (!xmlEnd)
+        xmlEnd = end;
+
+      const char *vtk = findString(begin, xmlEnd, "<VTKFile");
+      const char *vtkEnd = vtk ? findChar(vtk, xmlEnd, '>') : nullptr;
+      if (!vtkEnd)
+        throw std::runtime_error("not a VTK XML file");
+
+      std::string value;
+      if (attribute(vtk, vtkEnd, "type", value) && value != "PolyData")
+        throw std::runtime_error("not a PolyData file");
+      if (attribute(vtk, vtkEnd, "compressor", value))
+        throw std::runtime_error("compressed files are not supported");
+      if (attribute(vtk, vtkEnd, "byte_order", value)
+          && value != "LittleEndian")
+        throw std::runtime_error("big endian files are not supported");
+      uint64Header = attribute(vtk, vtkEnd, "header_type", value)
+                     && value == "UInt64";
+
+      if (xmlEnd != end) {
+        const char *tagEnd = findChar(xmlEnd, end, '>');
+        if (!tagEnd)
+          throw std::runtime_error("malformed AppendedData tag");
+        base64Appended = attribute(xmlEnd, tagEnd, "encoding", value)
+                         && value == "base64";
+        const char *marker = findChar(tagEnd, end, '_');
+        if (!marker)
+          throw std::runtime_error("appended data has no '_' marker");
+        appended = marker + 1;
+      }
+
+      enum Section
+      {
+        Other,
+        Points,
+        Polys
+      } section = Other;
+
+      const char *p = begin;
+      while ((p = findChar(p, xmlEnd, '<'))) {
+        const char *tagEnd = findChar(p, xmlEnd, '>');
+        if (!tagEnd)
+          break;
+        const char *name   = p + 1;
+        const bool closing = *name == '/';
+        if (closing)
+          ++name;
+        const char *nameEnd = name;
+        while (nameEnd < tagEnd && !isspace(*nameEnd) && *nameEnd != '/')
+          ++nameEnd;
+        const std::string tag(name, nameEnd);
+
+        if (tag == "Piece" && !closing) {
+          pieces.push_back(VTPPiece());
+          pieces.back().numPoints = sizeAttribute(p, tagEnd, "NumberOfPoints");
+          pieces.back().numPolys  = sizeAttribute(p, tagEnd, "NumberOfPolys");
+        } else if (tag == "Points") {
+          section = closing ? Other : Points;
+        } else if (tag == "Polys") {
+          section = closing ? Other : Polys;
+        } else if (tag == "DataArray" && !closing && section != Other
+                   && !pieces.empty()) {
+          VTPDataArray array;
+          array.type       = attribute(p, tagEnd, "type", value)
+                                 ? parseVTPType(value)
+                                 : VTPType::Unknown;
+          array.components = sizeAttribute(p, tagEnd, "NumberOfComponents", 1);
+          attribute(p, tagEnd, "format", value);
+          if (value == "appended") {
+            array.format = VTPDataArray::Appended;
+            array.offset = sizeAttribute(p, tagEnd, "offset");
+          } else if (value == "binary") {
+            array.format = VTPDataArray::Binary;
+            array.text   = tagEnd + 1;
+          } else {
+            array.format = VTPDataArray::Ascii;
+          }
+
+          VTPPiece &piece = pieces.back();
+          if (section == Points) {
+            piece.points = array;
+          } else if (attribute(p, tagEnd, "Name", value)) {
+            if (value == "connectivity")
+              piece.connectivity = array;
+            else if (value == "offsets")
+              piece.offsets = array;
+          }
+        }
+        p = tagEnd + 1;
+      }
+    }
+
+    const char *VTPFile::read(const VTPDataArray &array,
+                              size_t &bytes,
+                              std::vector<char> &scratch) const
+    {
+      if (array.format == VTPDataArray::Missing)
+        throw std::runtime_error("missing data array");
+      if (array.format == VTPDataArray::Ascii)
+        throw std::runtime_error("ascii data arrays are not supported");
+      if (array.format == VTPDataArray::Appended && !appended)
+        throw std::runtime_error("appended array without appended data");
+
+      // every array starts with its size in bytes
+      const size_t headerSize = uint64Header ? 8 : 4;
+      auto headerValue = [&](const char *header) -> size_t {
+        return uint64Header ? size_t(load<uint64_t>(header, 0))
+                            : size_t(load<uint32_t>(header, 0));
+      };
+
+      if (array.format == VTPDataArray::Appended && !base64Appended) {
+        const char *p = appended + array.offset;
+        if (p < appended || size_t(end - p) < headerSize)
+          throw std::runtime_error("truncated appended data");
+        bytes = headerValue(p);
+        if (size_t(end - p) - headerSize < bytes)
+          throw std::runtime_error("truncated appended data");
+        return p + headerSize;
+      }
+
+      const char *p = array.format == VTPDataArray::Appended
+                          ? appended + array.offset
+                          : array.text;
+      while (p < end && isspace(*p))
+        ++p;
+      char header[8];
+      const char *headerEnd = decodeBase64(p, end, headerSize, header);
+      bytes = headerValue(header);
+
+      // VTK either encodes the header on its own, ending in padding, or
+      // as the start of one stream together with the data
+      if (headerEnd[-1] == '=') {
+        scratch.resize(bytes);
+        decodeBase64(headerEnd, end, bytes, scratch.data());
+        return scratch.data();
+      }
+      scratch.resize(headerSize + bytes);
+      decodeBase64(p, end, headerSize + bytes, scratch.data());
+      return scratch.data() + headerSize;
+    }
+
+    // VTK writes either each polygon's end offset, or a leading 0 and
+    // numPolys + 1 begin offsets
+    static inline void polygonRange(const char *offsets,
+                                    VTPType type,
+                                    size_t numOffsets,
+                                    size_t numPolys,
+                                    size_t k,
+                                    int64 &first,
+                                    int64 &last)
+    {
+      if (numOffsets == numPolys) {
+        first = k == 0 ? 0 : readInt(offsets, type, k - 1);
+        last  = readInt(offsets, type, k);
+      } else {
+        first = readInt(offsets, type, k);
+        last  = readInt(offsets, type, k + 1);
+      }
+    }
+
+    void VTPFile::countTriangles(VTPPiece &piece,
+                                 std::vector<char> &scratch) const
+    {
+      piece.numTriangles = 0;
+      if (piece.numPolys == 0)
+        return;
+      if (piece.points.type != VTPType::Float32
+          && piece.points.type != VTPType::Float64)
+        throw std::runtime_error("unsupported point type");
+      if (piece.points.components != 3)
+        throw std::runtime_error("points need 3 components");
+      if (typeSize(piece.offsets.type) == 0
+          || piece.offsets.type == VTPType::Float32
+          || piece.offsets.type == VTPType::Float64
+          || typeSize(piece.connectivity.type) == 0
+          || piece.connectivity.type == VTPType::Float32
+          || piece.connectivity.type == VTPType::Float64)
+        throw std::runtime_error("unsupported polygon array type");
+
+      size_t bytes          = 0;
+      const char *offsets   = read(piece.offsets, bytes, scratch);
+      const size_t numOffsets = bytes / typeSize(piece.offsets.type);
+      if (numOffsets != piece.numPolys && numOffsets != piece.numPolys + 1)
+        throw std::runtime_error("offsets don't match NumberOfPolys");
+
+      int64 first = 0, last = 0;
+      for (size_t k = 0; k < piece.numPolys; ++k) {
+        polygonRange(offsets, piece.offsets.type, numOffsets, piece.numPolys,
+                     k, first, last);
+        if (last - first >= 3)
+          piece.numTriangles += last - first - 2;
+      }
+    }
+
+    void VTPFile::fill(const VTPPiece &piece,
+                       vec3f *vertices,
+                       vec3i *indices,
+                       int vertexBase,
+                       std::vector<char> &scratch) const
+    {
+      if (piece.numPolys == 0)
+        return;
+
+      size_t bytes       = 0;
+      const char *points = read(piece.points, bytes, scratch);
+      if (bytes < piece.numPoints * 3 * typeSize(piece.points.type))
+        throw std::runtime_error("fewer points than NumberOfPoints");
+      if (piece.points.type == VTPType::Float32) {
+        memcpy(vertices, points, piece.numPoints * sizeof(vec3f));
+      } else {
+        for (size_t i = 0; i < piece.numPoints; ++i) {
+          vertices[i] = vec3f(load<double>(points, 3 * i),
+                              load<double>(points, 3 * i + 1),
+                              load<double>(points, 3 * i + 2));
+        }
+      }
+
+      // the offsets are small, keep them in their own buffer while the
+      // connectivity takes the scratch one
+      std::vector<char> offsetScratch;
+      size_t offsetBytes    = 0;
+      const char *offsets   = read(piece.offsets, offsetBytes, offsetScratch);
+      const size_t numOffsets = offsetBytes / typeSize(piece.offsets.type);
+      const char *connectivity = read(piece.connectivity, bytes, scratch);
+      const size_t numConnectivity =
+          bytes / typeSize(piece.connectivity.type);
+
+      auto vertex = [&](int64 c) -> int {
+        if (c < 0 || size_t(c) >= numConnectivity)
+          throw std::runtime_error("polygon offsets out of range");
+        const int64 v = readInt(connectivity, piece.connectivity.type, c);
+        if (v < 0 || size_t(v) >= piece.numPoints)
+          throw std::runtime_error("polygon vertex out of range");
+        return vertexBase + int(v);
+      };
+
+      size_t t    = 0;
+      int64 first = 0, last = 0;
+      for (size_t k = 0; k < piece.numPolys; ++k) {
+        polygonRange(offsets, piece.offsets.type, numOffsets, piece.numPolys,
+                     k, first, last);
+        if (last - first < 3)
+          continue;
+        // fan triangulation
+        const int v0 = vertex(first);
+        for (int64 c = first + 1; c + 1 < last; ++c)
+          indices[t++] = vec3i(v0, vertex(c), vertex(c + 1));
+      }
+    }
+
+    std::vector<SurfaceMesh> loadSurfaces(const std::vector<FileName> &files)
+    {
+      const size_t numFiles = files.size();
+      std::vector<std::unique_ptr<VTPFile>> parsed(numFiles);
+      std::vector<std::string> errors(numFiles);
+
+      // first pass: parse the headers and count each file's triangles
+      tasking::parallel_for(numFiles, [&](size_t f) {
+        try {
+          std::unique_ptr<VTPFile> file(new VTPFile(files[f]));
+          std::vector<char> scratch;
+          for (auto &piece : file->pieces)
+            file->countTriangles(piece, scratch);
+          parsed[f] = std::move(file);
+        } catch (const std::exception &e) {
+          errors[f] = e.what();
+        }
+      });
+
+      // assign files to meshes in order, starting a new mesh whenever the
+      // next file would overflow the 32 bit indices
+      const size_t maxVertices = std::numeric_limits<int32_t>::max();
+      std::vector<SurfaceMesh> meshes;
+      std::vector<size_t> fileMesh(numFiles);
+      std::vector<size_t> fileVertex(numFiles);
+      std::vector<size_t> fileTriangle(numFiles);
+      std::vector<size_t> meshVertices, meshTriangles;
+      for (size_t f = 0; f < numFiles; ++f) {
+        if (!parsed[f]) {
+          std::cout << "Skipping surface " << files[f] << ": " << errors[f]
+                    << "\n";
+          continue;
+        }
+        size_t vertices = 0, triangles = 0;
+        for (const auto &piece : parsed[f]->pieces) {
+          if (piece.numPolys) {
+            vertices += piece.numPoints;
+            triangles += piece.numTriangles;
+          }
+        }
+        if (vertices > maxVertices) {
+          std::cout << "Skipping surface " << files[f]
+                    << ": too many points\n";
+          parsed[f].reset();
+          continue;
+        }
+        if (meshes.empty() || meshVertices.back() + vertices > maxVertices) {
+          meshes.push_back(SurfaceMesh());
+          meshVertices.push_back(0);
+          meshTriangles.push_back(0);
+        }
+        fileMesh[f]     = meshes.size() - 1;
+        fileVertex[f]   = meshVertices.back();
+        fileTriangle[f] = meshTriangles.back();
+        meshVertices.back() += vertices;
+        meshTriangles.back() += triangles;
+        meshes.back().numFiles++;
+      }
+
+      for (size_t m = 0; m < meshes.size(); ++m) {
+        meshes[m].vertices.resize(meshVertices[m]);
+        meshes[m].indices.resize(meshTriangles[m]);
+      }
+
+      // second pass: decode every file straight into its slot; a file
+      // failing here leaves its triangles zeroed, i.e. degenerate
+      std::vector<std::string> fillErrors(numFiles);
+      tasking::parallel_for(numFiles, [&](size_t f) {
+        if (!parsed[f])
+          return;
+        SurfaceMesh &mesh = meshes[fileMesh[f]];
+        size_t vertex     = fileVertex[f];
+        size_t triangle   = fileTriangle[f];
+        std::vector<char> scratch;
+        try {
+          for (const auto &piece : parsed[f]->pieces) {
+            if (!piece.numPolys)
+              continue;
+            parsed[f]->fill(piece,
+                            mesh.vertices.data() + vertex,
+                            mesh.indices.data() + triangle,
+                            int(vertex),
+                            scratch);
+            vertex += piece.numPoints;
+            triangle += piece.numTriangles;
+          }
+        } catch (const std::exception &e) {
+          fillErrors[f] = e.what();
+        }
+        parsed[f].reset();
+      });
+
+      for (size_t f = 0; f < numFiles; ++f) {
+        if (!fillErrors[f].empty()) {
+          std::cout << "Failed to read surface " << files[f] << ": "
+                    << fillErrors[f] << ", its triangles are left empty\n";
+        }
+      }
+
+      return meshes;
+    }
+
+  }  // namespace tamr
+}  // namespace ospray
@@ -0,0 +1,38 @@
+#ifndef VTPSURFACE_H_
+#define VTPSURFACE_H_
+
+#include <string>
+#include <vector>
+#include "ospcommon/FileName.h"
+#include "ospcommon/containers/AlignedVector.h"
+#include "ospcommon/vec.h"
+
+using namespace ospcommon;
+
+namespace ospray {
+  namespace tamr {
+
+    //! a merged triangle mesh of one or more surface files
+    struct SurfaceMesh
+    {
+      ospcommon::containers::AlignedVector<vec3f> vertices;
+      ospcommon::containers::AlignedVector<vec3i> indices;
+      //! the files merged into this mesh
+      size_t numFiles{0};
+    };
+
+    /*! load VTK XML PolyData (.vtp) surfaces in parallel and merge them
+      into as few triangle meshes as 32 bit indices allow.
+
+      Supports the appended (raw or base64) and inline base64 binary
+      layouts with Float32/Float64 points and 32/64 bit polygon arrays,
+      which is what the exajet surfaces use. Polygons are fan
+      triangulated; verts, lines and strips are ignored. Raw appended
+      data is read straight from the file mapping. Files that can't be
+      read (compressed, ascii or malformed) are reported and skipped */
+    std::vector<SurfaceMesh> loadSurfaces(const std::vector<FileName> &files);
+
+  }  // namespace tamr
+}  // namespace ospray
+
+#endif
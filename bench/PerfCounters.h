@@ -0,0 +1,78 @@
+#ifndef PERFCOUNTERS_H_
+#define PERFCOUNTERS_H_
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+
+/*! a single hardware counter of the calling thread via perf_event_open.
+  valid() is false if the kernel or the perf_event_paranoid setting
+  doesn't let us count, in which case read() returns 0 */
+class PerfCounter
+{
+ public:
+  PerfCounter(uint32_t type, uint64_t config)
+  {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~PerfCounter()
+  {
+    if (fd != -1)
+      close(fd);
+  }
+
+  static PerfCounter dtlbLoadMisses()
+  {
+    return PerfCounter(PERF_TYPE_HW_CACHE,
+                       PERF_COUNT_HW_CACHE_DTLB
+                           | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                           | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  }
+
+  PerfCounter(PerfCounter &&o) : fd(o.fd)
+  {
+    o.fd = -1;
+  }
+
+  bool valid() const
+  {
+    return fd != -1;
+  }
+
+  void start()
+  {
+    if (fd == -1)
+      return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  uint64_t stop()
+  {
+    uint64_t count = 0;
+    if (fd == -1)
+      return 0;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (::read(fd, &count, sizeof(count)) != sizeof(count))
+      return 0;
+    return count;
+  }
+
+ private:
+  int fd{-1};
+};
+
+#endif
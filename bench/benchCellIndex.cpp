@@ -0,0 +1,174 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../TAMRCellIndex.h"
+#include "../TAMRLevelKDT.h"
+#include "ospcommon/tasking/parallel_for.h"
+
+using namespace ospray::tamr;
+
+// Builds a TAMRCellIndex and a TAMRLevelKDT over the same synthetic level
+// (an N^3 block of cells with one octant cut out, so there are both holes
+// and full regions, and optionally a random fraction of the cells
+// dropped to make it sparse) and reports build time, size and point
+// lookup throughput of both, for random cells that exist and random
+// coordinates, a bit over half of which miss. The KDT's build parameters
+// can be set to compare tree shapes.
+
+static volatile size_t sink;
+
+template <typename F>
+static double seconds(F &&f)
+{
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                       - start)
+      .count();
+}
+
+static void report(const char *what, size_t n, double t)
+{
+  std::cout << what << ": " << t << "s, " << n / t * 1e-6 << " M/s\n";
+}
+
+int main(int argc, const char **argv)
+{
+  int size          = 128;
+  size_t numLookups = 10000000;
+  // unmasked sparse KDT leaves are scanned linearly, so it can be given
+  // fewer lookups
+  size_t numKDTLookups = numLookups;
+  bool withKDT         = true;
+  float sparse         = 0.f;
+  TAMRKDTParams kdtParams;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--size" && i + 1 < argc)
+      size = atoi(argv[++i]);
+    else if (arg == "--lookups" && i + 1 < argc)
+      numLookups = atol(argv[++i]);
+    else if (arg == "--kdt-lookups" && i + 1 < argc)
+      numKDTLookups = atol(argv[++i]);
+    else if (arg == "--no-kdt")
+      withKDT = false;
+    else if (arg == "--sparse" && i + 1 < argc)
+      sparse = atof(argv[++i]);
+    else if (arg == "--kdt-max-depth" && i + 1 < argc)
+      kdtParams.maxDepth = atoi(argv[++i]);
+    else if (arg == "--kdt-min-leaf" && i + 1 < argc)
+      kdtParams.minLeafSize = atol(argv[++i]);
+    else if (arg == "--kdt-min-occupancy" && i + 1 < argc)
+      kdtParams.minOccupancy = atof(argv[++i]);
+    else if (arg == "--kdt-compact")
+      kdtParams.compactLeaves = true;
+    else {
+      std::cout << "usage: " << argv[0]
+                << " [--size N] [--lookups N] [--kdt-lookups N] [--no-kdt]"
+                   " [--sparse f] [--kdt-max-depth N] [--kdt-min-leaf N]"
+                   " [--kdt-min-occupancy f] [--kdt-compact]\n";
+      return 1;
+    }
+  }
+
+  TAMRData data;
+  data.amrOrigin   = vec3f(0.f);
+  data.cellScale   = 1.f;
+  TAMRLevel &level = data.voxelsInLevel[0];
+  level.level            = 0;
+  level.cellWidthInModel = level.cellWidth = level.rcpCellWidth = 1.f;
+  level.halfCellWidth    = 0.5f;
+  const int half         = size / 2;
+  std::mt19937 dropRng(3);
+  std::uniform_real_distribution<float> drop(0.f, 1.f);
+  for (int z = 0; z < size; ++z)
+    for (int y = 0; y < size; ++y)
+      for (int x = 0; x < size; ++x) {
+        if (x >= half && y >= half && z >= half)
+          continue;
+        if (sparse > 0.f && drop(dropRng) < sparse)
+          continue;
+        TAMRVoxel v;
+        v.lower         = vec3f(x, y, z);
+        v.level         = 0;
+        v.indexInBuffer = level.voxels.size();
+        level.push_voxel(v);
+      }
+  const size_t numCells = level.voxels.size();
+  std::cout << numCells << " cells, " << numLookups << " lookups\n";
+
+  std::vector<vec3i> hits(numLookups), randoms(numLookups);
+  std::mt19937 rng(7);
+  for (size_t i = 0; i < numLookups; ++i) {
+    hits[i] = vec3i(level.voxels[rng() % numCells].lower);
+    randoms[i] =
+        vec3i(int(rng() % (2 * size)) - half, rng() % size, rng() % size);
+  }
+
+  auto lookupAll = [&](const std::vector<vec3i> &queries,
+                       size_t n,
+                       const TAMRCellIndex *index,
+                       const TAMRLevelKDT *kdt) {
+    const size_t blockSize = 64 * 1024;
+    const size_t numBlocks = (n + blockSize - 1) / blockSize;
+    std::vector<size_t> found(numBlocks, 0);
+    const double t = seconds([&]() {
+      tasking::parallel_for(numBlocks, [&](size_t b) {
+        const size_t end = std::min(n, (b + 1) * blockSize);
+        size_t idx;
+        TAMRVoxel voxel;
+        for (size_t i = b * blockSize; i < end; ++i) {
+          found[b] += kdt ? kdt->find(vec3f(queries[i]), voxel)
+                          : index->find(0, queries[i], idx);
+        }
+      });
+    });
+    size_t total = 0;
+    for (const size_t f : found)
+      total += f;
+    sink = total;
+    return t;
+  };
+
+  TAMRCellIndex *index = nullptr;
+  report("TAMRCellIndex build", numCells,
+         seconds([&]() { index = new TAMRCellIndex(data); }));
+  std::cout << "TAMRCellIndex size: " << index->sizeInBytes() / double(numCells)
+            << " bytes/cell\n";
+  report("TAMRCellIndex lookup hits", numLookups,
+         lookupAll(hits, numLookups, index, nullptr));
+  report("TAMRCellIndex lookup random", numLookups,
+         lookupAll(randoms, numLookups, index, nullptr));
+  delete index;
+
+  if (withKDT) {
+    TAMRLevelKDT *kdt = nullptr;
+    report("TAMRLevelKDT build", numCells,
+           seconds([&]() { kdt = new TAMRLevelKDT(data, 0, kdtParams); }));
+    size_t full = 0, masked = 0, compact = 0;
+    for (const auto &l : kdt->leaf) {
+      full += l.full;
+      masked += !l.occupancy.empty();
+      compact += l.compact;
+    }
+    std::cout << "TAMRLevelKDT nodes: " << kdt->node.size()
+              << ", leaves: " << kdt->leaf.size() << " (" << full
+              << " full, " << masked << " masked, "
+              << kdt->leaf.size() - full - masked << " scanned; " << compact
+              << " compact)\n";
+    std::cout << "TAMRLevelKDT size: " << kdt->sizeInBytes() / double(numCells)
+              << " bytes/cell\n";
+    numKDTLookups = std::min(numKDTLookups, numLookups);
+    report("TAMRLevelKDT lookup hits", numKDTLookups,
+           lookupAll(hits, numKDTLookups, nullptr, kdt));
+    report("TAMRLevelKDT lookup random", numKDTLookups,
+           lookupAll(randoms, numKDTLookups, nullptr, kdt));
+    delete kdt;
+  }
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../HugePages.h"
+#include "../sparsepp/spp.h"
+#include "PerfCounters.h"
+
+using namespace ospray::tamr;
+
+// Measures runtime and dTLB load misses of random lookups under each huge
+// page mode, for a flat table (like the output buffers) and for the
+// sparse_hash_map the unstructured importer uses for vertex dedup. Each
+// mode runs in a forked child, so pages from one mode can't carry over
+// into the next.
+
+struct Key
+{
+  size_t x, y, z;
+};
+
+inline bool operator==(const Key &a, const Key &b)
+{
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+struct HashKey
+{
+  size_t operator()(const Key &a) const
+  {
+    return a.x + 1232128 * (a.y + a.z * 1259072);
+  }
+};
+
+static volatile uint64_t sink;
+
+struct Result
+{
+  double seconds;
+  uint64_t tlbMisses;
+};
+
+template <typename F>
+static Result measure(F &&f)
+{
+  PerfCounter tlb  = PerfCounter::dtlbLoadMisses();
+  const auto start = std::chrono::steady_clock::now();
+  tlb.start();
+  f();
+  Result r;
+  r.tlbMisses = tlb.stop();
+  r.seconds   = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                            - start)
+                  .count();
+  return r;
+}
+
+static void report(const char *what, HugePageMode mode, const Result &r)
+{
+  std::cout << what << " [" << toString(mode) << "]: " << r.seconds << "s, "
+            << r.tlbMisses << " dTLB load misses\n";
+}
+
+static void runMode(HugePageMode mode,
+                    size_t tableMB,
+                    size_t numLookups,
+                    size_t numKeys)
+{
+  // flat table with random reads
+  {
+    HugePageBuffer table(tableMB << 20, mode);
+    uint64_t *t     = static_cast<uint64_t *>(table.data());
+    const size_t n  = table.size() / sizeof(uint64_t);
+    for (size_t i = 0; i < n; ++i)
+      t[i] = i;
+
+    std::mt19937_64 rng(1);
+    uint64_t sum   = 0;
+    const Result r = measure([&]() {
+      for (size_t i = 0; i < numLookups; ++i)
+        sum += t[rng() % n];
+    });
+    report("table lookups", table.mode, r);
+    sink = sum;
+  }
+
+  // dedup map inserts and lookups, with the map allocated from a huge
+  // page arena as in the importer
+  {
+    using Allocator = HugePageAllocator<std::pair<const Key, int32_t>>;
+    spp::sparse_hash_map<Key, int32_t, HashKey, std::equal_to<Key>, Allocator>
+        map(0,
+            HashKey(),
+            std::equal_to<Key>(),
+            Allocator(mode == HugePageMode::Off
+                          ? nullptr
+                          : std::make_shared<HugePageArena>(mode)));
+    std::mt19937_64 rng(2);
+    const Result insert = measure([&]() {
+      for (size_t i = 0; i < numKeys; ++i) {
+        map[Key{rng() % 1232128, rng() % 1259072, rng() % 1238336}] = i;
+      }
+    });
+    report("dedup map insert", mode, insert);
+
+    rng.seed(2);
+    size_t found        = 0;
+    const Result lookup = measure([&]() {
+      for (size_t i = 0; i < numKeys; ++i)
+        found +=
+            map.count(Key{rng() % 1232128, rng() % 1259072, rng() % 1238336});
+    });
+    report("dedup map lookup", mode, lookup);
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  size_t tableMB    = 4096;
+  size_t numLookups = 50000000;
+  size_t numKeys    = 20000000;
+  std::vector<HugePageMode> modes;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--table-mb" && i + 1 < argc)
+      tableMB = atol(argv[++i]);
+    else if (arg == "--lookups" && i + 1 < argc)
+      numLookups = atol(argv[++i]);
+    else if (arg == "--keys" && i + 1 < argc)
+      numKeys = atol(argv[++i]);
+    else if (arg == "--mode" && i + 1 < argc)
+      modes.push_back(parseHugePageMode(argv[++i]));
+    else {
+      std::cout << "usage: " << argv[0]
+                << " [--table-mb N] [--lookups N] [--keys N]"
+                   " [--mode off|thp|2m|1g]\n";
+      return 1;
+    }
+  }
+  if (modes.empty()) {
+    modes = {HugePageMode::Off,
+             HugePageMode::Transparent,
+             HugePageMode::Huge2M,
+             HugePageMode::Huge1G};
+  }
+
+  if (!PerfCounter::dtlbLoadMisses().valid())
+    std::cout << "dTLB counter unavailable (check perf_event_paranoid)\n";
+
+  for (const auto mode : modes) {
+    std::cout.flush();
+    const pid_t child = fork();
+    if (child == -1) {
+      perror("fork");
+      return 1;
+    }
+    if (child == 0) {
+      runMode(mode, tableMB, numLookups, numKeys);
+      std::cout.flush();
+      _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      std::cout << "[" << toString(mode) << "] run failed\n";
+  }
+  return 0;
+}
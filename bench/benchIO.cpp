@@ -0,0 +1,120 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../ChunkReader.h"
+#include "../HexFile.h"
+
+using namespace ospray::tamr;
+
+// Streams a raw hexas.bin through each IO mode, doing a per-hex level
+// histogram as stand-in work, and reports the throughput of each mode.
+// The histogram's checksum is printed too, so the work can't be optimized
+// away and every mode can be seen to read the same data.
+// With --cold the file's pages are dropped from the page cache before
+// every run (needs the file to be clean, i.e. not recently written).
+
+static void dropPageCache(const std::string &fileName)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static double runMode(const std::string &fileName,
+                      IOMode mode,
+                      size_t chunkBytes,
+                      size_t &numHexes,
+                      uint64_t &checksum)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  ChunkReader reader(fileName, mode, chunkBytes);
+  if (!reader.valid())
+    return 0.0;
+
+  std::vector<size_t> histogram(32, 0);
+  size_t bytes = 0;
+  numHexes     = 0;
+  while (const void *chunk = reader.next(bytes)) {
+    const Hexahedron *hexes = static_cast<const Hexahedron *>(chunk);
+    const size_t n          = bytes / sizeof(Hexahedron);
+    for (size_t i = 0; i < n; ++i)
+      histogram[hexes[i].level & 31]++;
+    numHexes += n;
+  }
+
+  // FNV-1a over the level counts
+  checksum = 14695981039346656037ull;
+  for (const size_t count : histogram) {
+    checksum ^= count;
+    checksum *= 1099511628211ull;
+  }
+
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                       - start)
+      .count();
+}
+
+int main(int argc, const char **argv)
+{
+  std::string fileName;
+  bool cold         = false;
+  size_t chunkBytes = size_t(64) << 20;
+  std::vector<IOMode> modes;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--cold")
+      cold = true;
+    else if (arg == "--chunk-mb" && i + 1 < argc)
+      chunkBytes = size_t(atol(argv[++i])) << 20;
+    else if (arg == "--mode" && i + 1 < argc)
+      modes.push_back(parseIOMode(argv[++i]));
+    else
+      fileName = arg;
+  }
+
+  if (fileName.empty()) {
+    std::cout << "usage: " << argv[0]
+              << " [--cold] [--chunk-mb N] [--mode mmap|populate|prefetch|pread]"
+                 " <hexas.bin>\n";
+    return 1;
+  }
+
+  if (modes.empty())
+    modes = {IOMode::Mmap, IOMode::Populate, IOMode::Prefetch, IOMode::Pread};
+
+  chunkBytes = std::max(chunkBytes / sizeof(Hexahedron), size_t(1))
+               * sizeof(Hexahedron);
+  for (const auto mode : modes) {
+    if (cold)
+      dropPageCache(fileName);
+    size_t numHexes   = 0;
+    uint64_t checksum = 0;
+    double secs       = 0.0;
+    try {
+      secs = runMode(fileName, mode, chunkBytes, numHexes, checksum);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+    const double bytes = double(numHexes) * sizeof(Hexahedron);
+    std::cout << toString(mode) << ": " << numHexes << " hexes in " << secs
+              << "s, " << bytes / secs / (1 << 20) << " MB/s, checksum "
+              << std::hex << checksum << std::dec << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../HexScan.h"
+
+using namespace ospray::tamr;
+
+// Scans a hex file and its fields for their counts, bounds and ranges, the
+// same as an import with EXAJET_SCAN=1, and reports the scan's throughput.
+// With --write-sidecar the result is kept next to the hex file for later
+// imports; with --cold the files are dropped from the page cache first.
+
+static void dropPageCache(const FileName &fileName)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static size_t fileSize(const FileName &fileName)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd == -1)
+    return 0;
+  const off_t size = lseek(fd, 0, SEEK_END);
+  close(fd);
+  return size > 0 ? size_t(size) : 0;
+}
+
+int main(int argc, const char **argv)
+{
+  FileName hexFile;
+  std::vector<FileName> fieldFiles;
+  bool cold         = false;
+  bool writeSidecar = false;
+  size_t chunkBytes = size_t(64) << 20;
+  IOMode mode       = IOMode::Mmap;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--cold")
+      cold = true;
+    else if (arg == "--write-sidecar")
+      writeSidecar = true;
+    else if (arg == "--chunk-mb" && i + 1 < argc)
+      chunkBytes = size_t(atol(argv[++i])) << 20;
+    else if (arg == "--mode" && i + 1 < argc)
+      mode = parseIOMode(argv[++i]);
+    else if (hexFile.str().empty())
+      hexFile = arg;
+    else
+      fieldFiles.push_back(arg);
+  }
+
+  if (hexFile.str().empty()) {
+    std::cout << "usage: " << argv[0]
+              << " [--cold] [--write-sidecar] [--chunk-mb N]"
+                 " [--mode mmap|populate|prefetch|pread]"
+                 " <hexas.bin> [field.bin ...]\n";
+    return 1;
+  }
+
+  size_t bytes = fileSize(hexFile);
+  for (const auto &f : fieldFiles)
+    bytes += fileSize(f);
+  if (cold) {
+    dropPageCache(hexFile);
+    for (const auto &f : fieldFiles)
+      dropPageCache(f);
+  }
+
+  HexScan scan;
+  const auto start = std::chrono::steady_clock::now();
+  try {
+    scan = scanHexFile(hexFile, fieldFiles, mode, chunkBytes);
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  const double secs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  scan.print(std::cout);
+  std::cout << toString(mode) << ": " << bytes << " bytes in " << secs
+            << "s, " << bytes / secs / (1 << 20) << " MB/s\n";
+
+  if (writeSidecar) {
+    try {
+      scan.writeSidecar(hexFile);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+    std::cout << "Wrote " << HexScan::sidecarName(hexFile).str() << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../3rd_lib/chull.h"
+#include "../HexConvert.h"
+#include "../HexMesh.h"
+#include "../TAMRLevelKDT.h"
+
+using namespace ospray::tamr;
+
+// Regression suite for the importer's hot stages on synthetic inputs of
+// fixed seed and size. Each case is run a number of times and its best
+// time is compared against a baseline saved by an earlier run on the same
+// machine; a case slower than its baseline by more than the tolerance is
+// reported as a regression and the exit code is 1.
+//
+// Baseline file lines are "<case> <size> <seconds>", '#' starts a comment.
+
+static volatile size_t sink;
+
+struct BenchCase
+{
+  std::string name;
+  //! problem size, recorded with the baseline so a rescaled run isn't
+  //! compared against it
+  size_t size;
+  //! untimed, builds the case's inputs
+  std::function<void()> setup;
+  std::function<void()> run;
+  //! untimed, drops the inputs again
+  std::function<void()> teardown;
+};
+
+struct Baseline
+{
+  size_t size;
+  double seconds;
+};
+
+static std::map<std::string, Baseline> readBaseline(const std::string &file)
+{
+  std::map<std::string, Baseline> baseline;
+  std::ifstream in(file);
+  if (!in) {
+    std::cout << "Can't read baseline " << file << "\n";
+    exit(2);
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    std::string name;
+    Baseline b;
+    if (fields >> name >> b.size >> b.seconds)
+      baseline[name] = b;
+  }
+  return baseline;
+}
+
+// an N^3 block of level 0 cells with one octant cut out, so there are
+// both holes and full regions, in z, y, x order
+static std::vector<Hexahedron> blockHexes(int n, const vec3i &origin)
+{
+  std::vector<Hexahedron> hexes;
+  const int half = n / 2;
+  for (int z = 0; z < n; ++z)
+    for (int y = 0; y < n; ++y)
+      for (int x = 0; x < n; ++x) {
+        if (x >= half && y >= half && z >= half)
+          continue;
+        Hexahedron h;
+        h.lower = origin + vec3i(x, y, z);
+        h.level = 0;
+        hexes.push_back(h);
+      }
+  return hexes;
+}
+
+// random cells of levels 0..6 on their level's grid, like an AMR scan
+static std::vector<Hexahedron> randomHexes(size_t n, const vec3i &origin)
+{
+  std::vector<Hexahedron> hexes(n);
+  std::mt19937 rng(42);
+  for (auto &h : hexes) {
+    h.level         = rng() % 7;
+    const int cells = 4096 >> h.level;
+    h.lower = origin
+              + vec3i(rng() % cells, rng() % cells, rng() % cells)
+                    * (1 << h.level);
+  }
+  return hexes;
+}
+
+static TAMRData levelData(const std::vector<Hexahedron> &hexes)
+{
+  TAMRData data;
+  data.amrOrigin = vec3f(0.f);
+  data.cellScale = 1.f;
+  std::vector<vec3f> scratch;
+  bucketHexes(data, hexes.data(), hexes.size(), nullptr, 0, scratch);
+  TAMRLevel &level       = data.voxelsInLevel[0];
+  level.level            = 0;
+  level.cellWidthInModel = level.cellWidth = level.rcpCellWidth = 1.f;
+  level.halfCellWidth    = 0.5f;
+  return data;
+}
+
+int main(int argc, const char **argv)
+{
+  std::string baselineFile, saveFile, filter;
+  int repetitions        = 5;
+  double scale           = 1.;
+  double defaultTolerance = 0.15;
+  std::map<std::string, double> tolerance;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--baseline" && i + 1 < argc)
+      baselineFile = argv[++i];
+    else if (arg == "--save-baseline" && i + 1 < argc)
+      saveFile = argv[++i];
+    else if (arg == "--filter" && i + 1 < argc)
+      filter = argv[++i];
+    else if (arg == "--repetitions" && i + 1 < argc)
+      repetitions = std::max(1, atoi(argv[++i]));
+    else if (arg == "--scale" && i + 1 < argc)
+      scale = atof(argv[++i]);
+    else if (arg == "--tolerance" && i + 1 < argc) {
+      // either a default for all cases or "<case>=<fraction>"
+      const std::string t = argv[++i];
+      const size_t eq     = t.find('=');
+      if (eq == std::string::npos)
+        defaultTolerance = atof(t.c_str());
+      else
+        tolerance[t.substr(0, eq)] = atof(t.c_str() + eq + 1);
+    } else {
+      std::cout << "usage: " << argv[0]
+                << " [--baseline file] [--save-baseline file]"
+                   " [--tolerance f | --tolerance case=f]..."
+                   " [--filter substring] [--repetitions N] [--scale f]\n";
+      return 2;
+    }
+  }
+
+  auto scaled = [&](double n) -> size_t {
+    return std::max(size_t(1), size_t(n * scale));
+  };
+  // the unstructured importer's grid origin, so HexMesh keys look real
+  const vec3i gridMin(1232128, 1259072, 1238336);
+  const int kdtBlock = std::max(2, int(96 * std::cbrt(scale)));
+
+  std::vector<Hexahedron> hexes;
+  TAMRData data;
+  TAMRLevelKDT *kdt = nullptr;
+  std::vector<float> points;
+  std::vector<size_t> leafOffset;
+  std::vector<vec4f> spheres;
+  std::vector<vec4uc> colors;
+  const std::vector<vec4uc> palette = {vec4uc(255, 0, 0, 255),
+                                       vec4uc(0, 255, 0, 255),
+                                       vec4uc(0, 0, 255, 255)};
+
+  auto dropAll = [&]() {
+    hexes = std::vector<Hexahedron>();
+    data  = TAMRData();
+    delete kdt;
+    kdt = nullptr;
+    points     = std::vector<float>();
+    leafOffset = std::vector<size_t>();
+    spheres    = std::vector<vec4f>();
+    colors     = std::vector<vec4uc>();
+  };
+
+  const size_t kdtCells = blockHexes(kdtBlock, vec3i(0)).size();
+
+  std::vector<BenchCase> cases = {
+      {"level_bucketing",
+       scaled(4e6),
+       [&]() { hexes = randomHexes(scaled(4e6), vec3i(0)); },
+       [&]() {
+         TAMRData d;
+         d.amrOrigin = vec3f(0.f);
+         std::vector<vec3f> scratch;
+         bucketHexes(d, hexes.data(), hexes.size(), nullptr, 0, scratch);
+         sink = d.voxelsInLevel.size();
+       },
+       dropAll},
+      {"vertex_dedup",
+       kdtCells,
+       [&]() { hexes = blockHexes(kdtBlock, gridMin); },
+       [&]() {
+         HexMesh mesh;
+         for (size_t i = 0; i < hexes.size(); ++i)
+           mesh.add(hexes[i], 0.f, i);
+         mesh.flush();
+         sink = mesh.verts.size();
+       },
+       dropAll},
+      {"kdt_build",
+       kdtCells,
+       [&]() { data = levelData(blockHexes(kdtBlock, vec3i(0))); },
+       [&]() {
+         TAMRLevelKDT tree(data, 0);
+         sink = tree.leaf.size();
+       },
+       dropAll},
+      {"get_best_pos",
+       kdtCells,
+       [&]() { data = levelData(blockHexes(kdtBlock, vec3i(0))); },
+       [&]() {
+         const TAMRLevel &level = data.voxelsInLevel[0];
+         float pos              = 0.f;
+         for (int dim = 0; dim < 3; ++dim)
+           pos += TAMRLevelKDT::getBestPos(level.bounds, level.voxels, dim);
+         sink = size_t(pos);
+       },
+       dropAll},
+      {"sphere_generation",
+       kdtCells,
+       [&]() {
+         data = levelData(blockHexes(kdtBlock, vec3i(0)));
+         kdt  = new TAMRLevelKDT(data, 0);
+         leafOffset.assign(kdt->leaf.size() + 1, 0);
+         for (size_t i = 0; i < kdt->leaf.size(); ++i)
+           leafOffset[i + 1] = leafOffset[i] + kdt->leaf[i].size();
+         spheres.resize(leafOffset.back());
+         colors.resize(leafOffset.back());
+       },
+       [&]() {
+         kdt->writeLeafSpheres(0, kdt->leaf.size(), leafOffset.data(),
+                               palette.data(), palette.size(),
+                               spheres.data(), colors.data());
+         sink = spheres.size();
+       },
+       dropAll},
+      {"chull3d",
+       scaled(5000),
+       [&]() {
+         // points in a ball, so the hull has many faces
+         std::mt19937 rng(7);
+         std::uniform_real_distribution<float> coord(-1.f, 1.f);
+         while (points.size() < 3 * scaled(5000)) {
+           const vec3f p(coord(rng), coord(rng), coord(rng));
+           if (p.x * p.x + p.y * p.y + p.z * p.z <= 1.f) {
+             points.push_back(p.x);
+             points.push_back(p.y);
+             points.push_back(p.z);
+           }
+         }
+       },
+       [&]() {
+         Chull3D hull(points.data(), int(points.size() / 3));
+         hull.compute();
+         sink = hull.get_n_faces();
+       },
+       dropAll},
+  };
+
+  std::map<std::string, Baseline> baseline;
+  if (!baselineFile.empty())
+    baseline = readBaseline(baselineFile);
+
+  std::ofstream save;
+  if (!saveFile.empty()) {
+    save.open(saveFile);
+    save << "# exajetBenchSuite baseline: <case> <size> <seconds>\n";
+  }
+
+  int regressions = 0;
+  std::cout << std::left << std::setw(20) << "case" << std::setw(10)
+            << "size" << std::setw(12) << "best (s)" << std::setw(12)
+            << "median (s)" << std::setw(12) << "baseline" << "status\n";
+  for (auto &c : cases) {
+    if (!filter.empty() && c.name.find(filter) == std::string::npos)
+      continue;
+    c.setup();
+    std::vector<double> times;
+    for (int r = 0; r < repetitions; ++r) {
+      const auto start = std::chrono::steady_clock::now();
+      c.run();
+      times.push_back(std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+    }
+    c.teardown();
+    std::sort(times.begin(), times.end());
+    const double best = times.front();
+
+    std::cout << std::setw(20) << c.name << std::setw(10) << c.size
+              << std::setw(12) << best << std::setw(12)
+              << times[times.size() / 2];
+
+    auto b = baseline.find(c.name);
+    if (b == baseline.end()) {
+      std::cout << std::setw(12) << "-" << "no baseline\n";
+    } else if (b->second.size != c.size) {
+      std::cout << std::setw(12) << b->second.seconds
+                << "size differs, not compared\n";
+    } else {
+      auto t = tolerance.find(c.name);
+      const double tol =
+          t == tolerance.end() ? defaultTolerance : t->second;
+      const double change = best / b->second.seconds - 1.;
+      std::cout << std::setw(12) << b->second.seconds << std::showpos
+                << std::fixed << std::setprecision(1) << change * 100.
+                << "% " << std::noshowpos << std::defaultfloat
+                << std::setprecision(6);
+      if (change > tol) {
+        std::cout << "REGRESSION (tolerance " << tol * 100. << "%)\n";
+        ++regressions;
+      } else if (change < -tol) {
+        std::cout << "faster\n";
+      } else {
+        std::cout << "ok\n";
+      }
+    }
+
+    if (save.is_open())
+      save << c.name << " " << c.size << " " << best << "\n";
+  }
+
+  if (regressions)
+    std::cout << regressions << " regression(s)\n";
+  return regressions ? 1 : 0;
+}
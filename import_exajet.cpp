@@ -5,13 +5,21 @@
 #include <unistd.h>
 #include <math.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "common/sg/common/Common.h"
 #include "common/sg/geometry/Spheres.h"
+#include "common/sg/geometry/TriangleMesh.h"
 #include "common/sg/importer/Importer.h"
 #include "common/sg/transferFunction/TransferFunction.h"
 // #include "importer/Importer.h"
@@ -27,12 +35,27 @@
 // #include "ospcommon/ospmath.h"
 #include "ospcommon/memory/malloc.h"
 #include "ospcommon/range.h"
+#include "ospcommon/tasking/parallel_for.h"
 #include "ospcommon/xml/XML.h"
 #include "ospray/ospray.h"
 
-#include "sparsepp/spp.h"
+#include "ChunkReader.h"
+#include "FieldStats.h"
+#include "FieldStream.h"
+#include "HexConvert.h"
+#include "HexCrop.h"
+#include "HexFile.h"
+#include "HexMesh.h"
+#include "HexParts.h"
+#include "HexScan.h"
+#include "HugePages.h"
+#include "MemoryLedger.h"
 #include "TAMRData.h"
 #include "TAMRLevelKDT.h"
+#include "TAMRFieldCompression.h"
+#include "SurfaceOptimize.h"
+#include "VTPSurface.h"
+#include "ImportOptions.h"
 
 using namespace ospcommon;
 using namespace ospray;
@@ -51,7 +74,7 @@ static std::vector<float> tfn_colors = {
       1.0f, 0.88f, 0.3f,  0.3f 
 };
 
-inline vec3f findColorForValue(std::vector<float> colors, int i, int N, bool isRandom)
+inline vec3f findColorForValue(const std::vector<float> &colors, int i, int N, bool isRandom)
 {
   vec3f c; 
   int colorNum = colors.size() / 4;
@@ -83,57 +106,286 @@ inline vec3f findColorForValue(std::vector<float> colors, int i, int N, bool isR
 }
 
 
-//NATHAN: Looks like this maps to the Exajet file format. It specifies:
-//* The lower left corner of the hex.
-//* The AMR level.
-struct Hexahedron
+// What a loader hands back: creates the loaded data's nodes under the given
+// parent. Loading can run on any thread, the nodes are only created where
+// the scene may be changed, i.e. on the caller's or the render thread. An
+// empty result means the load failed or was cancelled.
+using ImportResult = std::function<void(sg::Node &parent)>;
+
+// Where a running load is. Written by the loader, read by whoever waits
+// for it; without one a load runs to the end unobserved. The loader never
+// touches the scene: 'changed' is raised instead, and the waiting node
+// marks itself modified on the render thread.
+struct ImportProgress
 {
-  vec3i lower;
-  int level;
+  //! 'done' is the fraction of the load finished, 0..1
+  void report(float done)
+  {
+    const float last = fraction.exchange(done);
+    // whole percents are plenty to wake up the render thread for
+    if (int(done * 100.f) != int(last * 100.f))
+      changed = true;
+  }
+
+  std::atomic<float> fraction{0.f};
+  std::atomic<bool> cancelled{false};
+  std::atomic<bool> changed{false};
 };
 
-void importExaJet(const std::shared_ptr<Node> world, const FileName fileName)
+// field files of a partitioned run are named after their hex files, see
+// listHexParts()
+static const std::string fieldPrefix = "y_vorticity";
+
+// a directory of hex/field file pairs or a list of them, see listHexParts()
+static bool isPartitioned(const FileName &fileName)
 {
-  int fd               = open(fileName.c_str(), O_RDONLY);
-  struct stat stat_buf = {0};
-  fstat(fd, &stat_buf);
-  const size_t num_hexes = stat_buf.st_size / sizeof(Hexahedron);
-  std::cout << "File " << fileName.c_str() << "\n"
-            << "size: " << stat_buf.st_size << "\n"
-            << "#hexes: " << num_hexes << "\n";
-  void *mapping = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (mapping == MAP_FAILED) {
-    std::cout << "Failed to map file\n";
-    perror("mapping file");
-    return;
-  }
+  return fileName.ext() == "exaparts" || fileName.ext() == "jetparts"
+         || isDirectory(fileName);
+}
 
+//! the sphere preview's output, built off the render thread
+struct SphereBuffers
+{
   ospcommon::containers::AlignedVector<vec4f> points;
   ospcommon::containers::AlignedVector<vec4uc> colors;
+};
+
+// The sphere preview, on float or exact integer voxel coordinates
+template <typename COORD_T>
+static ImportResult loadExaJetSpheres(const FileName fileName,
+                                      const ImportOptions &opts,
+                                      ImportProgress *progress)
+{
+  using Vec = vec_t<COORD_T, 3>;
 
-  points.reserve(num_hexes);
-  colors.reserve(num_hexes);
+  auto report = [&](float done) {
+    if (progress)
+      progress->report(done);
+  };
+  auto cancelled = [&]() { return progress && progress->cancelled; };
 
-  Hexahedron *hexes = static_cast<Hexahedron *>(mapping);
+  // The sphere preview only shows the cells of this level
+  const int accelLevel = 6;
+
+  // Streaming keeps the input window, the preview level's voxels, the tree
+  // and the spheres from all being resident at full size at once.
+  const bool streaming = opts.streaming;
+  MemoryLedger ledger(opts.memoryBudget);
+  IOMode ioMode = opts.ioMode;
+  if (streaming && (ioMode == IOMode::Mmap || ioMode == IOMode::Populate)) {
+    // these keep every page of the hex file mapped once it was touched
+    ioMode = IOMode::Prefetch;
+    std::cout << "Streaming import, reading with io mode "
+              << toString(ioMode) << "\n";
+  }
 
-  ospray::tamr::TAMRData data;
-  data.amrOrigin = hexes[0].lower;
+  ospray::tamr::TAMRData_t<COORD_T> data;
   int maxLevel   = 0;
 
-  size_t showVoxelNumber = num_hexes;//* 0.001;
+  auto accountVoxels = [&]() {
+    size_t bytes = 0;
+    for (const auto &lv : data.voxelsInLevel)
+      bytes += lv.second.voxels.capacity() * sizeof(TAMRVoxel_t<COORD_T>);
+    ledger.set("voxels", bytes);
+  };
+
+  std::vector<Vec> voxelLower;
+  auto addVoxels = [&](const Hexahedron *hexes, size_t n,
+                       const uint64 *source, uint64 firstSource) {
+    bucketHexes(data, hexes, n, source, firstSource, voxelLower);
+  };
+
+  if (isPartitioned(fileName)) {
+    // All parts are scanned and bucketed in parallel, straight into their
+    // slots of the merged levels; the origin is the min over all of them.
+    const auto scanStart = std::chrono::steady_clock::now();
+    try {
+      const std::vector<HexPart> parts = listHexParts(fileName, fieldPrefix);
+      std::cout << "Partitioned run " << fileName.c_str() << "\n"
+                << "#parts: " << parts.size() << "\n";
+      maxLevel = loadHexParts(data, parts, streaming ? accelLevel : -1,
+                              opts.cropBoxes, opts.hugePages);
+    } catch (const std::runtime_error &e) {
+      std::cout << "Failed to load parts: " << e.what() << "\n";
+      return ImportResult();
+    }
+    accountVoxels();
+    std::cout << "Scanned hexes in "
+              << std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - scanStart)
+                     .count()
+              << "s\n";
+  } else if (HexIndex::isIndexedFile(fileName)) {
+    // The container already knows the level layout and grid origin, so
+    // just seek to the run of the level we need instead of scanning.
+    const HexIndex index = HexIndex::read(fileName);
+    std::cout << "Indexed file " << fileName.c_str() << "\n"
+              << "#hexes: " << index.header.numHexes << "\n";
+
+    data.amrOrigin = Vec(index.header.gridMin);
+    maxLevel       = index.maxLevel();
+
+    std::vector<Hexahedron> levelHexes;
+    std::vector<uint64> originalIndex;
+    if (opts.cropBoxes.empty() && streaming) {
+      // read the level in windows of the io chunk size
+      const size_t window =
+          std::max(opts.ioChunkBytes / sizeof(Hexahedron), size_t(1));
+      for (uint64 first = 0;; first += window) {
+        index.readLevelRange(accelLevel, first, window, levelHexes,
+                             &originalIndex);
+        if (levelHexes.empty())
+          break;
+        ledger.set("hex window",
+                   levelHexes.capacity() * sizeof(Hexahedron)
+                       + originalIndex.capacity() * sizeof(uint64)
+                       + voxelLower.capacity() * sizeof(Vec));
+        addVoxels(levelHexes.data(), levelHexes.size(), originalIndex.data(),
+                  0);
+        accountVoxels();
+        if (cancelled())
+          return ImportResult();
+      }
+    } else {
+      if (opts.cropBoxes.empty()) {
+        index.readLevel(accelLevel, levelHexes, &originalIndex);
+      } else {
+        // only read the blocks touching the crop boxes, then filter exactly
+        std::vector<Hexahedron> blockHexes;
+        std::vector<uint64> blockIndex;
+        std::vector<uint64> survivors;
+        index.readRegion(opts.cropBoxes, blockHexes, &blockIndex, accelLevel);
+        cropHexesParallel(blockHexes.data(), blockHexes.size(),
+                          opts.cropBoxes, survivors);
+        for (const uint64 s : survivors) {
+          levelHexes.push_back(blockHexes[s]);
+          originalIndex.push_back(blockIndex[s]);
+        }
+      }
+      ledger.set("hex window",
+                 levelHexes.capacity() * sizeof(Hexahedron)
+                     + originalIndex.capacity() * sizeof(uint64));
+      addVoxels(levelHexes.data(), levelHexes.size(), originalIndex.data(),
+                  0);
+      accountVoxels();
+    }
+  } else {
+    const size_t chunkBytes =
+        opts.ioChunkBytes / sizeof(Hexahedron) * sizeof(Hexahedron);
+    ChunkReader hexReader(fileName, ioMode, chunkBytes, 3, opts.hugePages);
+    if (!hexReader.valid()) {
+      std::cout << "Failed to map file\n";
+      return ImportResult();
+    }
+    const size_t num_hexes = hexReader.fileSize() / sizeof(Hexahedron);
+    std::cout << "File " << fileName.c_str() << "\n"
+              << "size: " << hexReader.fileSize() << "\n"
+              << "#hexes: " << num_hexes << "\n";
+
+    // The origin is the min over all lower corners, as for indexed and
+    // partitioned files, so the data lands in the same place whichever
+    // form it is in. It comes from the scan sidecar if there is one.
+    // Otherwise the voxels are bucketed relative to the first chunk's min
+    // and moved to the min over all chunks at the end.
+    HexScan scan;
+    const bool scanned = HexScan::readSidecar(fileName, scan);
+    if (scanned)
+      data.amrOrigin = Vec(scan.gridBounds.lower);
+    vec3i gridMin;
+
+    // The scan also sizes every level up front. Cropping keeps an unknown
+    // share of each, so then they're left to grow.
+    if (scanned && opts.cropBoxes.empty()) {
+      for (const auto &lv : scan.levels) {
+        if (streaming && lv.level != accelLevel)
+          continue;
+        auto &voxels = data.voxelsInLevel[lv.level].voxels;
+        voxels.reserve(lv.numHexes);
+        adviseHugePages(voxels, opts.hugePages);
+      }
+      accountVoxels();
+      std::cout << "Presized the levels from the scan\n";
+    }
+
+    const auto scanStart = std::chrono::steady_clock::now();
 
-  for (size_t i = 0; i < showVoxelNumber; ++i) {
-    Hexahedron &h = hexes[i];
+    size_t chunkStart = 0;
+    size_t bytes      = 0;
+    std::vector<uint64> survivors;
+    std::vector<uint64> source;
+    std::vector<Hexahedron> kept;
+    while (const void *chunk = hexReader.next(bytes)) {
+      const Hexahedron *hexes = static_cast<const Hexahedron *>(chunk);
+      const size_t n          = bytes / sizeof(Hexahedron);
+      if (!scanned && n > 0) {
+        const vec3i chunkMin = minHexLower(hexes, n);
+        gridMin = chunkStart == 0 ? chunkMin : min(gridMin, chunkMin);
+        if (chunkStart == 0)
+          data.amrOrigin = Vec(gridMin);
+      }
+
+      // The world scale is that of the whole data set, even when cropping
+      // or streaming. Every level imported gets a bucket, so without either
+      // it's read off the buckets at the end; otherwise it comes out of the
+      // pass over the chunk.
+      if (opts.cropBoxes.empty() && !streaming) {
+        addVoxels(hexes, n, nullptr, chunkStart);
+      } else {
+        if (!opts.cropBoxes.empty()) {
+          cropHexesParallel(hexes, n, opts.cropBoxes, survivors, 0,
+                            &maxLevel);
+        } else {
+          survivors.resize(n);
+          for (size_t i = 0; i < n; ++i) {
+            survivors[i] = i;
+            maxLevel     = max(maxLevel, hexes[i].level);
+          }
+        }
+        // when streaming, the levels the preview doesn't show are dropped
+        // right here rather than kept around until the end of the import
+        size_t numKept = 0;
+        kept.resize(survivors.size());
+        source.resize(survivors.size());
+        for (const uint64 s : survivors) {
+          if (streaming && hexes[s].level != accelLevel)
+            continue;
+          kept[numKept]   = hexes[s];
+          source[numKept] = chunkStart + s;
+          ++numKept;
+        }
+        addVoxels(kept.data(), numKept, source.data(), 0);
+      }
+      chunkStart += n;
+      report(0.6f * chunkStart / num_hexes);
+      if (cancelled())
+        return ImportResult();
+
+      for (const auto &lv : data.voxelsInLevel)
+        adviseHugePages(lv.second.voxels, opts.hugePages);
 
-    ospray::tamr::TAMRVoxel voxel;
-    voxel.level         = h.level;
-    maxLevel            = max(maxLevel, h.level);
-    float model2world   = 1.0 / (1 << voxel.level);
-    voxel.lower         = (h.lower - data.amrOrigin) * model2world;
-    voxel.indexInBuffer = i;
+      // the reader holds its current chunk and up to three read ahead
+      ledger.set("hex window",
+                 4 * chunkBytes + survivors.capacity() * sizeof(uint64)
+                     + source.capacity() * sizeof(uint64)
+                     + kept.capacity() * sizeof(Hexahedron)
+                     + voxelLower.capacity() * sizeof(Vec));
+      accountVoxels();
+    }
 
-    data.voxelsInLevel[h.level].push_voxel(voxel);
+    for (const auto &lv : data.voxelsInLevel)
+      maxLevel = max(maxLevel, lv.first);
+    if (!scanned && chunkStart > 0 && Vec(gridMin) != data.amrOrigin)
+      rebaseVoxels(data, Vec(gridMin));
+
+    std::cout << "Scanned hexes in "
+              << std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - scanStart)
+                     .count()
+              << "s (io mode: " << toString(ioMode) << ")\n";
   }
+  ledger.release("hex window");
+  voxelLower = std::vector<Vec>();
+
   // Cell width in model space. Scale to 1 in world space
   data.cellScale = (float)(1 << maxLevel);
 
@@ -147,28 +399,76 @@ void importExaJet(const std::shared_ptr<Node> world, const FileName fileName)
               << " bounds" << lv.second.bounds << "\n";
   }
 
-  munmap(mapping, stat_buf.st_size);
-  close(fd);
-
-  TAMRLevelKDT accel(data, 6);
+  // streaming hands the voxels over to the tree instead of copying them
+  using KDT = TAMRLevelKDT_t<COORD_T>;
+  std::unique_ptr<KDT> accelTree(
+      streaming ? new KDT(std::move(data), accelLevel, opts.kdtParams)
+                : new KDT(data, accelLevel, opts.kdtParams));
+  KDT &accel = *accelTree;
+  PRINT(accel.node.size());
   PRINT(accel.leaf.size());
-  int leafIndex(0);
-  for(auto & l : accel.leaf)
-  {
-    //std::cout<<"leaf bounds:" << l.bounds<<std::endl;
-    
-    vec3f c = findColorForValue(tfn_colors, leafIndex, (int)accel.leaf.size(),true);
-    for(auto &v: l.voxels){
-        float radii  = 0.5 * accel.level.cellWidth;
-        vec3f center = (v.lower + vec3f(0.5)) * accel.level.cellWidth;
-        points.push_back(vec4f(center, radii));
-        colors.push_back(vec4uc(c.x * 255.0, c.y * 255.0, c.z * 255.0, 255));
-    }
+  report(0.7f);
+
+  auto accountTree = [&]() { ledger.set("kd tree", accel.sizeInBytes()); };
+  accountVoxels();
+  accountTree();
+
+  // Each leaf's spheres go to a fixed slot of the presized outputs, so the
+  // leaves can be written in parallel.
+  const size_t numLeaves = accel.leaf.size();
+  std::vector<size_t> leafOffset(numLeaves + 1, 0);
+  for (size_t i = 0; i < numLeaves; ++i)
+    leafOffset[i + 1] = leafOffset[i] + accel.leaf[i].size();
+  const size_t numSpheres = leafOffset[numLeaves];
 
-    leafIndex++;
+  // With random coloring a leaf's color only depends on its index modulo
+  // the number of colors, so the palette is converted once up front.
+  const int numColors =
+      std::min(int(tfn_colors.size() / 4), std::max(int(numLeaves), 1));
+  std::vector<vec4uc> palette(numColors);
+  for (int i = 0; i < numColors; ++i) {
+    const vec3f c = findColorForValue(tfn_colors, i, int(numLeaves), true);
+    palette[i] = vec4uc(c.x * 255.0, c.y * 255.0, c.z * 255.0, 255);
   }
 
+  auto out     = std::make_shared<SphereBuffers>();
+  auto &points = out->points;
+  auto &colors = out->colors;
+
+  // Only reserved here; the outputs are filled a block of leaves at a time,
+  // so their pages only become resident as the tree's leaves are consumed.
+  points.reserve(numSpheres);
+  colors.reserve(numSpheres);
+  adviseHugePages(points, opts.hugePages);
+  adviseHugePages(colors, opts.hugePages);
+
+  const size_t spheresPerBlock = size_t(1) << 22;
+  size_t leafBegin = 0;
+  while (leafBegin < numLeaves) {
+    size_t leafEnd = leafBegin + 1;
+    while (leafEnd < numLeaves
+           && leafOffset[leafEnd + 1] - leafOffset[leafBegin]
+                  <= spheresPerBlock)
+      ++leafEnd;
+
+    points.resize(leafOffset[leafEnd]);
+    colors.resize(leafOffset[leafEnd]);
+    accel.writeLeafSpheres(leafBegin, leafEnd, leafOffset.data(),
+                           palette.data(), numColors, points.data(),
+                           colors.data(), streaming);
+    leafBegin = leafEnd;
+    report(0.7f + 0.3f * leafBegin / numLeaves);
+    if (cancelled())
+      return ImportResult();
+
+    ledger.set("spheres",
+               points.size() * sizeof(vec4f) + colors.size() * sizeof(vec4uc));
+    if (streaming)
+      accountTree();
+  }
 
+  if (streaming || opts.memoryBudget)
+    ledger.report();
 
   // for (auto &lv : data.voxelsInLevel) {
   //     for (auto &v : lv.second.voxels) {
@@ -194,185 +494,486 @@ void importExaJet(const std::shared_ptr<Node> world, const FileName fileName)
   //     }
   // }
 
-  auto exajetGeom = createNode(fileName, "Spheres")->nodeAs<Spheres>();
-  exajetGeom->createChild("bytes_per_sphere", "int", int(sizeof(vec4f)));
-  exajetGeom->createChild("offset_center", "int", int(0));
-  exajetGeom->createChild("radius", "float", 0.5f);
-  exajetGeom->createChild("offset_radius", "int", int(sizeof(vec3f)));
+  const std::string name = fileName.str();
+  return [out, name](sg::Node &parent) {
+    auto exajetGeom = createNode(name, "Spheres")->nodeAs<Spheres>();
+    exajetGeom->createChild("bytes_per_sphere", "int", int(sizeof(vec4f)));
+    exajetGeom->createChild("offset_center", "int", int(0));
+    exajetGeom->createChild("radius", "float", 0.5f);
+    exajetGeom->createChild("offset_radius", "int", int(sizeof(vec3f)));
 
-  auto materials = exajetGeom->child("materialList").nodeAs<MaterialList>();
-  materials->item(0)["Ks"] = vec3f(0.f);
+    auto materials = exajetGeom->child("materialList").nodeAs<MaterialList>();
+    materials->item(0)["Ks"] = vec3f(0.f);
 
-  auto spheres = std::make_shared<DataVectorT<vec4f, OSP_RAW>>();
-  spheres->setName("spheres");
-  spheres->v = std::move(points);
+    auto spheres = std::make_shared<DataVectorT<vec4f, OSP_RAW>>();
+    spheres->setName("spheres");
+    spheres->v = std::move(out->points);
 
-  auto colorData = std::make_shared<DataVectorT<vec4uc, OSP_UCHAR4>>();
-  colorData->setName("color");
-  colorData->v = std::move(colors);
+    auto colorData = std::make_shared<DataVectorT<vec4uc, OSP_UCHAR4>>();
+    colorData->setName("color");
+    colorData->v = std::move(out->colors);
 
-  exajetGeom->add(spheres);
-  exajetGeom->add(colorData);
+    exajetGeom->add(spheres);
+    exajetGeom->add(colorData);
 
-  world->add(exajetGeom);
+    parent.add(exajetGeom);
+  };
 }
 
+// Runs one load on its own thread, so the caller returns right away. The
+// load itself fans out over the tasking system's worker pool as always.
+class AsyncLoader
+{
+ public:
+  using LoadFunction = std::function<ImportResult(ImportProgress *)>;
+
+  AsyncLoader(LoadFunction load)
+  {
+    thread = std::thread([=]() {
+      const auto start = std::chrono::steady_clock::now();
+      // nothing may escape the thread, the message is reported from the
+      // render thread along with the (empty) result
+      ImportResult loaded;
+      std::string failure;
+      try {
+        loaded = load(&progress);
+      } catch (const std::exception &e) {
+        failure = e.what();
+      } catch (...) {
+        failure = "unknown error";
+      }
+      const double secs = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        result  = std::move(loaded);
+        error   = std::move(failure);
+        seconds = secs;
+        done    = true;
+      }
+      progress.changed = true;
+    });
+  }
+
+  ~AsyncLoader()
+  {
+    cancel();
+    thread.join();
+  }
+
+  void cancel()
+  {
+    progress.cancelled = true;
+  }
+
+  float fraction() const
+  {
+    return progress.fraction;
+  }
+
+  //! whether there is news for preCommit() since the last call
+  bool takeChanged()
+  {
+    return progress.changed.exchange(false);
+  }
+
+  /*! true once the load has ended, 'loaded' is then its result and
+    'failure' why it is empty, if it threw */
+  bool takeResult(ImportResult &loaded, std::string &failure, double &secs)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!done)
+      return false;
+    loaded  = std::move(result);
+    failure = std::move(error);
+    secs    = seconds;
+    return true;
+  }
 
-struct HexVert {
-  size_t x, y, z;
-  HexVert() : x(-1), y(-1), z(-1) {}
-  HexVert(size_t x, size_t y, size_t z) : x(x), y(y), z(z) {}
-  HexVert(const vec3i &v) : x(v.x), y(v.y), z(v.z) {}
+ private:
+  ImportProgress progress;
+  std::mutex mutex;
+  bool done{false};
+  ImportResult result;
+  std::string error;
+  double seconds{0.0};
+  std::thread thread;
 };
 
-bool operator==(const HexVert &a, const HexVert &b) {
-  return a.x == b.x && a.y == b.y && a.z == b.z;
-}
+// Stands in for an import running in the background (EXAJET_ASYNC). Until
+// the data arrives the node only has the bounds the data is expected to
+// fill, so the viewer can place its camera. Each frame preRender() checks
+// whether the loader has news and marks the node modified; the next
+// commit's preCommit() then shows the progress in "progress" and, once the
+// load is done, creates the loaded nodes under this one. Setting "cancel"
+// abandons the load.
+struct ExajetAsyncImport : public sg::Renderable
+{
+  ExajetAsyncImport()
+  {
+    createChild("progress", "float", 0.f,
+                NodeFlags::required | NodeFlags::valid_min_max,
+                "fraction of the import loaded").setMinMax(0.f, 1.f);
+    createChild("cancel", "bool", false, NodeFlags::required,
+                "abandon the import");
+  }
+
+  std::string toString() const override
+  {
+    return "ospray::sg::ExajetAsyncImport";
+  }
+
+  box3f computeBounds() const override
+  {
+    return loader ? placeholder : Renderable::computeBounds();
+  }
+
+  void preRender(RenderContext &) override
+  {
+    if (loader && loader->takeChanged())
+      markAsModified();
+  }
+
+  void preCommit(RenderContext &) override
+  {
+    if (!loader)
+      return;
+    if (child("cancel").valueAs<bool>())
+      loader->cancel();
+    child("progress") = loader->fraction();
 
-struct HashHexVert {
-  // Hard to really decide how to hash each vert to a unique index,
-  // due to the AMR layout..
-  size_t operator()(const HexVert &a) const {
-    return a.x + 1232128 * (a.y + a.z * 1259072);
+    ImportResult loaded;
+    std::string failure;
+    double secs = 0.0;
+    if (!loader->takeResult(loaded, failure, secs))
+      return;
+    loader.reset();
+    if (!failure.empty())
+      std::cout << "Background import failed: " << failure << "\n";
+    if (loaded) {
+      std::cout << "Background import loaded in " << secs << "s\n";
+      loaded(*this);
+      child("progress") = 1.f;
+    }
   }
+
+  //! world bounds the data is expected to fill, empty if unknown
+  box3f placeholder;
+  // declared last so the loader thread is joined before anything else
+  // it might call into goes away
+  std::unique_ptr<AsyncLoader> loader;
 };
 
-void importUnstructured(const std::shared_ptr<Node> world, const FileName fileName){
-  // Open the hexahedron data file
-  int hexFd = open(fileName.c_str(), O_RDONLY);
-  struct stat statBuf = {0};
-  fstat(hexFd, &statBuf);
-  const size_t numHexes = statBuf.st_size / sizeof(Hexahedron);
-  std::cout << "File " << fileName.c_str() << "\n"
-    << "size: " << statBuf.st_size << "\n"
-    << "#hexes: " << numHexes << "\n";
-  void *hexMapping = mmap(NULL, statBuf.st_size, PROT_READ, MAP_PRIVATE, hexFd, 0);
-  if (hexMapping == MAP_FAILED) {
-    std::cout << "Failed to map hexes file\n";
-    perror("hex_mapping file");
+// Adds an ExajetAsyncImport for 'load' to 'world' and returns
+static void importAsync(const std::shared_ptr<Node> world,
+                        const FileName &fileName,
+                        const box3f &placeholder,
+                        AsyncLoader::LoadFunction load)
+{
+  auto async =
+      createNode(fileName, "ExajetAsyncImport")->nodeAs<ExajetAsyncImport>();
+  async->placeholder = placeholder;
+  async->loader.reset(new AsyncLoader(load));
+  world->add(async);
+}
+
+// Runs 'load' on the calling thread. A read error thrown on the way is
+// reported like any other failed load.
+static ImportResult loadNow(const AsyncLoader::LoadFunction &load)
+{
+  try {
+    return load(nullptr);
+  } catch (const std::exception &e) {
+    std::cout << "Import failed: " << e.what() << "\n";
+    return ImportResult();
+  }
+}
+
+// World bounds of the sphere preview, if an indexed file's header has them
+static box3f sphereBounds(const FileName &fileName)
+{
+  if (isPartitioned(fileName) || !HexIndex::isIndexedFile(fileName))
+    return box3f();
+  // a bad header is left for the load itself to report
+  HexIndex index;
+  try {
+    index = HexIndex::read(fileName);
+  } catch (const std::runtime_error &) {
+    return box3f();
+  }
+  // sphere centers are (lower - gridMin) / 2^maxLevel
+  const vec3f extent(index.header.gridMax - index.header.gridMin);
+  return box3f(vec3f(0.f), extent / float(1 << index.maxLevel()));
+}
+
+// Scan mode: only the facts of a hex file and its fields, read at full
+// bandwidth without building any voxels or meshes. They're printed, added
+// to the scene under a "scan" node and kept in the file's sidecar for the
+// imports to come.
+static void importScan(const std::shared_ptr<Node> world,
+                       const FileName &fileName,
+                       const std::vector<FileName> &fieldFiles,
+                       const ImportOptions &opts)
+{
+  if (isPartitioned(fileName)) {
+    std::cout << "Scan mode needs a single hex file, scan the parts one by "
+                 "one\n";
     return;
   }
 
-  // Open the field data file
-  const std::string cellFieldName = "y_vorticity.bin";
-  const FileName fieldFile = fileName.path() + cellFieldName;
-  std::cout << "Loading field file: " << fieldFile << "\n";
-  int fieldFd = open(fieldFile.c_str(), O_RDONLY);
-  struct stat fieldStatBuf = {0};
-  fstat(fieldFd, &fieldStatBuf);
-  std::cout << "File " << fieldFile.c_str() << "\n"
-    << "size: " << fieldStatBuf.st_size << "\n";
-  void *fieldMapping = mmap(NULL, fieldStatBuf.st_size, PROT_READ,
-                            MAP_PRIVATE, fieldFd, 0);
-  if (fieldMapping == MAP_FAILED) {
-    std::cout << "Failed to map field file\n";
-    perror("field_mapping file");
+  const auto start = std::chrono::steady_clock::now();
+  HexScan scan;
+  try {
+    scan = scanHexFile(fileName, fieldFiles, opts.ioMode, opts.ioChunkBytes,
+                       opts.hugePages);
+  } catch (const std::runtime_error &e) {
+    std::cout << "Failed to scan " << fileName.c_str() << ": " << e.what()
+              << "\n";
     return;
   }
+  std::cout << "Scanned " << fileName.c_str() << " in "
+            << std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start).count()
+            << "s (io mode: " << toString(opts.ioMode) << ")\n";
+  scan.print(std::cout);
 
-  ospcommon::containers::AlignedVector<vec3f> verts;
-  ospcommon::containers::AlignedVector<vec4i> indices;
-  ospcommon::containers::AlignedVector<float> cellVals;
-                                                                                   
-  const Hexahedron *hexes = static_cast<const Hexahedron*>(hexMapping);
-  const float *cellField = static_cast<const float*>(fieldMapping);
+  try {
+    scan.writeSidecar(fileName);
+    std::cout << "Wrote " << HexScan::sidecarName(fileName).c_str() << "\n";
+  } catch (const std::runtime_error &e) {
+    std::cout << "Failed to write the scan sidecar: " << e.what() << "\n";
+  }
 
-  const int desiredLevel = -1;
-  const size_t memLimit = 0;//size_t(5)*size_t(1024)*size_t(1024)*size_t(1024);
+  auto node = createNode("scan", "Node");
+  node->createChild("numHexes", "int", int(scan.numHexes));
+  node->createChild("gridMin", "vec3i", scan.gridBounds.lower);
+  node->createChild("gridMax", "vec3i", scan.gridBounds.upper);
+  for (const auto &lv : scan.levels) {
+    auto level = createNode("level" + std::to_string(lv.level), "Node");
+    level->createChild("count", "int", int(lv.numHexes));
+    level->createChild("boundsMin", "vec3i", lv.bounds.lower);
+    level->createChild("boundsMax", "vec3i", lv.bounds.upper);
+    node->add(level);
+  }
+  for (const auto &f : scan.fields) {
+    auto field = createNode(f.fileName.name(), "Node");
+    field->createChild("count", "int", int(f.all.count));
+    field->createChild("min", "float", f.all.range.lower);
+    field->createChild("max", "float", f.all.range.upper);
+    field->createChild("mean", "float", float(f.all.mean));
+    node->add(field);
+  }
+  world->add(node);
+}
+
+// Reads the EXAJET_* options, reporting malformed ones instead of letting
+// the exception escape into the viewer.
+static bool readOptions(ImportOptions &opts)
+{
+  try {
+    opts = ImportOptions::fromEnvironment();
+  } catch (const std::runtime_error &e) {
+    std::cout << "Invalid import options: " << e.what() << "\n";
+    return false;
+  }
+  return true;
+}
+
+void importExaJet(const std::shared_ptr<Node> world, const FileName fileName)
+{
+  ImportOptions opts;
+  if (!readOptions(opts))
+    return;
+  if (opts.scan) {
+    // the preview doesn't read the field, but its facts come cheap here
+    const FileName fieldFile = fileName.path() + "y_vorticity.bin";
+    std::vector<FileName> fieldFiles;
+    if (std::ifstream(fieldFile.c_str()))
+      fieldFiles.push_back(fieldFile);
+    importScan(world, fileName, fieldFiles, opts);
+    return;
+  }
+  auto load = [=](ImportProgress *progress) -> ImportResult {
+    if (opts.intCoords)
+      return loadExaJetSpheres<int>(fileName, opts, progress);
+    return loadExaJetSpheres<float>(fileName, opts, progress);
+  };
+  if (opts.async) {
+    importAsync(world, fileName, sphereBounds(fileName), load);
+    return;
+  }
+  if (ImportResult loaded = loadNow(load))
+    loaded(*world);
+}
+
+
+// Plays back a time series of cell fields on an unstructured volume.
+// "timestep" selects the step shown; with "play" set, every commit moves on
+// to the next step once it has finished loading in the background, so
+// playback runs at the speed of the disk instead of stalling on it. A step
+// picked on the slider is shown once it is loaded; the commits until then
+// keep showing the current one. Playback skips steps whose file could not
+// be read even after the stream's retries.
+struct ExajetTimeSeries : public sg::Node
+{
+  ExajetTimeSeries()
+  {
+    createChild("timestep", "int", 0,
+                NodeFlags::required | NodeFlags::gui_slider,
+                "timestep shown on the volume");
+    createChild("play", "bool", false, NodeFlags::required,
+                "advance to each timestep as soon as it is loaded");
+  }
+
+  std::string toString() const override
+  {
+    return "ospray::sg::ExajetTimeSeries";
+  }
 
-  // TODO: Using this vertex index re-mapping will help us save
-  // a ton of memory and indices by re-using existing vertices, but will
-  // really hurt load performance.
-#define REMAP_INDICES
-#ifdef REMAP_INDICES
-  spp::sparse_hash_map<HexVert, int32_t, HashHexVert> vertsMap;
-#endif
-
-  const vec3i gridMin = vec3i(1232128, 1259072, 1238336);
-  const float voxelScale = 0.0005;
-  const vec3f worldMin = vec3f(-1.73575, -9.44, -3.73281);
-
-  for (size_t i = 1; i < numHexes; ++i) {
-    const Hexahedron &h = hexes[i];
-    if (verts.size() + 8 >= std::numeric_limits<int32_t>::max()) {
-      std::cout << "Index size limit reached, terminating mesh load\n";
-      break;
+  void preCommit(RenderContext &) override
+  {
+    if (!stream || stream->numSteps() == 0)
+      return;
+
+    int step = child("timestep").valueAs<int>();
+    if (child("play").valueAs<bool>() && currentStep != -1) {
+      const size_t next = nextStep(currentStep);
+      if (stream->ready(next)) {
+        step = next;
+        child("timestep").setValue(step);
+      }
     }
-    if (desiredLevel == -1 || h.level == desiredLevel) {
-      // Pretty inefficient, no vertex re-use, but rendering the octree AMR
-      // as an unstructured mesh is a bad route anyways that we won't do beyond
-      // quick testing/previewing
-      const vec3i hexSize = vec3i(1 << h.level);
-
-      // Verts ordering for a hex cell:
-      // four bottom verts counter-clockwise
-      // four top verts counter-clockwise
-      for (int k = 0; k < 2; ++k) {
-        vec4i idx;
-        for (int j = 0; j < 2; ++j) {
-          for (int i = 0; i < 2; ++i) {
-            // We want to go x_low -> x_hi if y_low, and x_hi -> x_low if y_hi
-            const int x = (i + j) % 2;
-            const vec3i p = h.lower + hexSize * vec3i(x, j, k);
-            const vec3f worldPos = vec3f(p - gridMin) * voxelScale + worldMin;
-
-#ifdef REMAP_INDICES
-            HexVert hexVert(p);
-            auto fnd = vertsMap.find(hexVert);
-            if (fnd == vertsMap.end()) {
-              vertsMap[hexVert] = verts.size();
-              idx[j * 2 + i] = verts.size();
-              verts.push_back(worldPos);
-            } else {
-              idx[j * 2 + i] = fnd->second;
-            }
-#else
-            idx[j * 2 + i] = verts.size();
-            verts.push_back(worldPos);
-#endif
-          }
-        }
-        indices.push_back(idx);
+
+    if (step != currentStep) {
+      // the copy happens between frames, so the renderer never sees a
+      // partially updated step
+      if (!stream->copyTo(step, field->v.data())) {
+        // still loading (copyTo() requested it) or unreadable; the
+        // render thread never waits for the disk
+        return;
       }
-      cellVals.push_back(cellField[i]);
+      field->markAsModified();
+      volume->markAsModified();
+      currentStep = step;
+    }
+    stream->prefetch(nextStep(currentStep));
+  }
+
+  // the step after 'step' that playback moves to
+  size_t nextStep(size_t step) const
+  {
+    const size_t n = stream->numSteps();
+    for (size_t i = 1; i < n; ++i) {
+      const size_t next = (step + i) % n;
+      if (!stream->failed(next))
+        return next;
+    }
+    return (step + 1) % n;
+  }
+
+  std::shared_ptr<FieldStream> stream;
+  std::shared_ptr<DataVector1f> field;
+  std::shared_ptr<Node> volume;
+  int currentStep{-1};
+};
+
+// Read-only mapping of a whole field file, released on destruction.
+struct MappedField
+{
+  MappedField(const FileName &fileName)
+  {
+    fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1) {
+      perror(fileName.c_str());
+      return;
     }
-    const size_t memSize = verts.size() * sizeof(vec3f)
-                           + indices.size() * sizeof(vec4i)
-                           + cellVals.size() * sizeof(float);
-    if (memLimit != 0 && memSize >= memLimit) {
-      break;
+    struct stat statBuf = {0};
+    fstat(fd, &statBuf);
+    size = statBuf.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      perror("field_mapping file");
+      return;
     }
+    values = static_cast<const float*>(mapping);
+  }
+
+  ~MappedField()
+  {
+    if (values)
+      munmap((void *)values, size);
+    if (fd != -1)
+      close(fd);
   }
 
-  std::cout << "Imported " << cellVals.size() << " hexahedrons\n";
+  int fd{-1};
+  size_t size{0};
+  const float *values{nullptr};
+};
 
-  munmap(hexMapping, statBuf.st_size);
-  munmap(fieldMapping, fieldStatBuf.st_size);
-  close(hexFd);
-  close(fieldFd);
+// Adds the hexes of one level of an indexed file, cropped if requested, to
+// 'mesh', and their values to 'stats' if given. The index table maps each
+// hex back to its slot in the field file. Returns false once the mesh is
+// full or 'cancel' is set.
+static bool addIndexedLevel(const HexIndex &index, int level,
+                            const float *cellField, const ImportOptions &opts,
+                            HexMesh &mesh,
+                            FieldStatsBuilder *stats,
+                            const std::atomic<bool> *cancel = nullptr)
+{
+  std::vector<Hexahedron> hexes;
+  std::vector<uint64> fieldIndex;
+  std::vector<uint64> survivors;
+  if (opts.cropBoxes.empty()) {
+    index.readLevel(level, hexes, &fieldIndex);
+    survivors.resize(hexes.size());
+    for (size_t i = 0; i < hexes.size(); ++i)
+      survivors[i] = i;
+  } else {
+    index.readRegion(opts.cropBoxes, hexes, &fieldIndex, level);
+    cropHexesParallel(hexes.data(), hexes.size(), opts.cropBoxes, survivors);
+  }
 
-  //NATHAN: Here is where we create the unstructured volume. This code uses
-  //OSPRay's scene graph functionality. We should probably avoid using OSPRay's
-  //scene graph for now because we are starting out by rendering just one volume.
-  //Furthermore, Will ays that the scene graph is poorly documented (I think
-  //that's what he said?)  
- 
+  size_t added = 0;
+  bool complete = true;
+  while (added < survivors.size() && complete) {
+    const uint64 s = survivors[added++];
+    complete = mesh.add(hexes[s], cellField[fieldIndex[s]], fieldIndex[s]);
+    if (cancel && (added & 0xffff) == 0 && *cancel)
+      complete = false;
+  }
+
+  if (stats) {
+    for (size_t i = 0; i < added; ++i)
+      survivors[i] = fieldIndex[survivors[i]];
+    stats->add(level, cellField, survivors.data(), added);
+  }
+  return complete;
+}
+
+// Builds the UnstructuredVolume node for a finished mesh, handing over its
+// buffers.
+static std::shared_ptr<Volume> createJetVolume(const std::string &name,
+                                               HexMesh &mesh,
+                                               const std::string &cellFieldName,
+                                               std::shared_ptr<DataVector1f> *field = nullptr)
+{
   //NATHAN: "Jet" appears to refer to the jet airplane in the data set, not the
   //"jet" colormap.
-  auto jet = createNode(fileName, "UnstructuredVolume")->nodeAs<Volume>();
+  auto jet = createNode(name, "UnstructuredVolume")->nodeAs<Volume>();
   jet->createChild("cellFieldName", "string", cellFieldName);
 
   auto vertsData = std::make_shared<DataVectorT<vec3f, OSP_FLOAT3>>();
   vertsData->setName("vertices");
-  vertsData->v = std::move(verts);
+  vertsData->v = std::move(mesh.verts);
 
   auto indicesData = std::make_shared<DataVectorT<vec4i, OSP_INT4>>();
   indicesData->setName("indices");
-  indicesData->v = std::move(indices);
+  indicesData->v = std::move(mesh.indices);
 
   auto cellFieldData = std::make_shared<DataVector1f>();
   cellFieldData->setName("0");
-  cellFieldData->v = std::move(cellVals);
+  cellFieldData->v = std::move(mesh.cellVals);
 
   //NATHAN: Since we are using cellField, I believe that we are using cell-centered data here.
   auto fieldList = std::make_shared<NodeList<DataVector1f>>();
@@ -386,7 +987,645 @@ void importUnstructured(const std::shared_ptr<Node> world, const FileName fileNa
   jet->add(indicesData);
   jet->add(fieldList);
 
-  world->add(jet);
+  if (field)
+    *field = cellFieldData;
+  return jet;
+}
+
+// Hangs the field's statistics under 'volume' as a "fieldStats" node with
+// an "all" child and one per level, each holding count, min, max, mean and
+// histogram, and sets the transfer function to the field's range.
+static void attachFieldStats(sg::Node &volume,
+                             const FieldStatsBuilder &stats,
+                             size_t numBins)
+{
+  auto statsNode = createNode("fieldStats", "Node");
+  auto addStats  = [&](const std::string &name, const FieldStats &fs) {
+    auto node = createNode(name, "Node");
+    node->createChild("count", "int", int(fs.count));
+    node->createChild("min", "float", fs.range.lower);
+    node->createChild("max", "float", fs.range.upper);
+    node->createChild("mean", "float", float(fs.mean));
+    auto histogram = std::make_shared<DataVector1f>();
+    histogram->setName("histogram");
+    histogram->v.resize(fs.histogram.size());
+    std::copy(fs.histogram.begin(), fs.histogram.end(), histogram->v.begin());
+    node->add(histogram);
+    statsNode->add(node);
+  };
+
+  const FieldStats all = stats.global(numBins);
+  addStats("all", all);
+  for (const auto &level : stats.perLevel(numBins))
+    addStats("level" + std::to_string(level.first), level.second);
+  volume.add(statsNode);
+
+  if (all.count == 0)
+    return;
+  std::cout << "Field range [" << all.range.lower << ", " << all.range.upper
+            << "], mean " << all.mean << " over " << all.count << " cells\n";
+  volume["transferFunction"]["valueRange"] =
+      vec2f(all.range.lower, all.range.upper);
+}
+
+// Builds the remaining levels of an indexed file one at a time, coarsest
+// first, on a background thread. takeChanged() turns true after each level,
+// and once more if reading the file fails; the error is kept for
+// takeError() rather than thrown on the loader thread.
+class ProgressiveLoader
+{
+ public:
+  ProgressiveLoader(const FileName &fileName, const FileName &fieldFile,
+                    const std::vector<int> &levels, const ImportOptions &opts)
+      : opts(opts)
+  {
+    thread = std::thread([=]() {
+      try {
+        loadLevels(fileName, fieldFile, levels);
+      } catch (const std::exception &e) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          error = e.what();
+        }
+        changed = true;
+      }
+    });
+  }
+
+  ~ProgressiveLoader()
+  {
+    cancel();
+    thread.join();
+  }
+
+  void cancel()
+  {
+    cancelled = true;
+  }
+
+  struct FinishedLevel
+  {
+    int level;
+    std::shared_ptr<HexMesh> mesh;
+    //! null unless field stats are enabled
+    std::shared_ptr<FieldStatsBuilder> stats;
+  };
+
+  //! the levels finished since the last call
+  std::vector<FinishedLevel> takeFinished()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<FinishedLevel> levels;
+    levels.swap(finished);
+    return levels;
+  }
+
+  //! whether levels or an error arrived since the last call
+  bool takeChanged()
+  {
+    return changed.exchange(false);
+  }
+
+  //! why the loader stopped early, empty if it didn't (or was cancelled)
+  std::string takeError()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string taken;
+    taken.swap(error);
+    return taken;
+  }
+
+ private:
+  void loadLevels(const FileName &fileName,
+                  const FileName &fieldFile,
+                  const std::vector<int> &levels)
+  {
+    const HexIndex index = HexIndex::read(fileName);
+    MappedField field(fieldFile);
+    if (!field.values)
+      throw std::runtime_error("failed to map " + fieldFile.str());
+    for (const int level : levels) {
+      const auto start = std::chrono::steady_clock::now();
+      FinishedLevel done;
+      done.level = level;
+      done.mesh  = std::make_shared<HexMesh>(0, false, opts.hugePages);
+      if (opts.fieldStatsBins)
+        done.stats = std::make_shared<FieldStatsBuilder>();
+      HexMesh *mesh = done.mesh.get();
+      const bool complete =
+          addIndexedLevel(index, level, field.values, opts, *mesh,
+                          done.stats.get(), &cancelled);
+      if (cancelled)
+        break;
+      mesh->flush();
+      std::cout << "Progressive import: level " << level << ", "
+                << mesh->cellVals.size() << " hexahedrons in "
+                << std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start).count()
+                << "s\n";
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(done);
+      }
+      changed = true;
+      if (!complete)
+        break;
+    }
+  }
+
+  ImportOptions opts;
+  std::atomic<bool> cancelled{false};
+  std::atomic<bool> changed{false};
+  std::mutex mutex;
+  std::vector<FinishedLevel> finished;
+  std::string error;
+  std::thread thread;
+};
+
+// Scene node of a progressive import. It starts out holding the coarsest
+// level's volume and adds a volume for each finer level as the background
+// loader finishes it; setting "cancel" drops the levels still to come.
+// Like ExajetAsyncImport it marks itself modified from preRender() when the
+// loader has news, so the scene is only ever touched on the render thread.
+struct ExajetProgressive : public sg::Renderable
+{
+  ExajetProgressive()
+  {
+    createChild("cancel", "bool", false, NodeFlags::required,
+                "stop loading the remaining finer levels");
+  }
+
+  std::string toString() const override
+  {
+    return "ospray::sg::ExajetProgressive";
+  }
+
+  void preRender(RenderContext &) override
+  {
+    if (loader && loader->takeChanged())
+      markAsModified();
+  }
+
+  void preCommit(RenderContext &) override
+  {
+    if (!loader)
+      return;
+    if (child("cancel").valueAs<bool>())
+      loader->cancel();
+    for (auto &level : loader->takeFinished()) {
+      auto volume = createJetVolume("level" + std::to_string(level.level),
+                                    *level.mesh, cellFieldName);
+      if (level.stats)
+        attachFieldStats(*volume, *level.stats, statsBins);
+      add(volume);
+    }
+    const std::string error = loader->takeError();
+    if (!error.empty())
+      std::cout << "Progressive import stopped: " << error << "\n";
+  }
+
+  std::string cellFieldName;
+  size_t statsBins{0};
+  // declared last so the loader thread is joined before anything else
+  // it might call into goes away
+  std::unique_ptr<ProgressiveLoader> loader;
+};
+
+// Progressive import of an indexed file: the coarsest level is built right
+// away so something shows up within seconds, finer levels follow in the
+// background.
+static void importProgressive(const std::shared_ptr<Node> world,
+                              const FileName &fileName,
+                              const FileName &fieldFile,
+                              const std::string &cellFieldName,
+                              const ImportOptions &opts)
+{
+  HexIndex index;
+  try {
+    index = HexIndex::read(fileName);
+  } catch (const std::runtime_error &e) {
+    std::cout << "Failed to read " << fileName.c_str() << ": " << e.what()
+              << "\n";
+    return;
+  }
+  std::vector<int> levels;
+  for (const auto &run : index.levels)
+    levels.push_back(run.level);
+  // cells are 2^level wide, so higher levels are coarser
+  std::sort(levels.rbegin(), levels.rend());
+  if (levels.empty())
+    return;
+
+  MappedField field(fieldFile);
+  if (!field.values) {
+    std::cout << "Failed to map field file\n";
+    return;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  HexMesh coarsest(0, false, opts.hugePages);
+  FieldStatsBuilder stats;
+  addIndexedLevel(index, levels[0], field.values, opts, coarsest,
+                  opts.fieldStatsBins ? &stats : nullptr);
+  coarsest.flush();
+  std::cout << "Progressive import: level " << levels[0] << ", "
+            << coarsest.cellVals.size() << " hexahedrons in "
+            << std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start).count()
+            << "s\n";
+
+  auto progressive =
+      createNode(fileName, "ExajetProgressive")->nodeAs<ExajetProgressive>();
+  progressive->cellFieldName = cellFieldName;
+  progressive->statsBins     = opts.fieldStatsBins;
+  auto volume = createJetVolume("level" + std::to_string(levels[0]),
+                                coarsest, cellFieldName);
+  if (opts.fieldStatsBins)
+    attachFieldStats(*volume, stats, opts.fieldStatsBins);
+  progressive->add(volume);
+  if (levels.size() > 1) {
+    // the node owns the loader, which joins its thread before the node
+    // goes away
+    progressive->loader.reset(new ProgressiveLoader(
+        fileName, fieldFile,
+        std::vector<int>(levels.begin() + 1, levels.end()), opts));
+  }
+  world->add(progressive);
+}
+
+// Loads the mesh and cell field of importUnstructured(); the volume is
+// created when the result is added to the scene.
+static ImportResult loadUnstructured(const FileName &fileName,
+                                     const FileName &fieldFile,
+                                     const std::string &cellFieldName,
+                                     const ImportOptions &opts,
+                                     ImportProgress *progress)
+{
+  const int desiredLevel = -1;
+  const size_t memLimit = 0;//size_t(5)*size_t(1024)*size_t(1024)*size_t(1024);
+
+  const bool partitioned = isPartitioned(fileName);
+
+  auto report = [&](float done) {
+    if (progress)
+      progress->report(done);
+  };
+  const std::atomic<bool> *cancel = progress ? &progress->cancelled : nullptr;
+
+  // With a time series, remember where each imported cell's value sits in
+  // the field files, so every timestep can be permuted the same way.
+  // A timestep is one field file, so this needs a single hex file too.
+  std::vector<FileName> timeSeriesFiles;
+  if (!opts.timeSeries.empty()) {
+    if (partitioned)
+      std::cout << "Time series need a single hex file, ignoring them\n";
+    else
+      timeSeriesFiles = expandFieldFiles(opts.timeSeries, fileName);
+  }
+  const bool timeSeries = !timeSeriesFiles.empty();
+
+  auto meshData = std::make_shared<HexMesh>(memLimit, timeSeries,
+                                            opts.hugePages);
+  HexMesh &mesh  = *meshData;
+  // gathered from the same chunks the mesh is built from
+  auto stats = std::make_shared<FieldStatsBuilder>();
+  FieldStatsBuilder *fieldStats = opts.fieldStatsBins ? stats.get() : nullptr;
+
+  // 'source' is the hex's position in the hex and field files
+  auto queueHex = [&](const Hexahedron &h, const float cellValue,
+                      const uint64 source) -> bool {
+    if (desiredLevel != -1 && h.level != desiredLevel)
+      return true;
+    return mesh.add(h, cellValue, source);
+  };
+
+  // Streams a hex file and its field file in lockstep; the readers fetch
+  // the next chunks while the current one is being deduplicated. The
+  // file's hexes are numbered from 'firstSource' on, 'done' is the share of
+  // the import finished before it and 'share' its own.
+  bool keepGoing = true;
+  auto streamHexFile = [&](const FileName &hexFile,
+                           const FileName &hexFieldFile,
+                           uint64 firstSource, uint64 &numHexes,
+                           float done, float share) -> bool {
+    const size_t hexesPerChunk = opts.ioChunkBytes / sizeof(Hexahedron);
+    ChunkReader hexReader(hexFile, opts.ioMode,
+                          hexesPerChunk * sizeof(Hexahedron),
+                          3, opts.hugePages);
+    if (!hexReader.valid()) {
+      std::cout << "Failed to map hexes file\n";
+      return false;
+    }
+    numHexes = hexReader.fileSize() / sizeof(Hexahedron);
+    std::cout << "File " << hexFile.c_str() << "\n"
+      << "size: " << hexReader.fileSize() << "\n"
+      << "#hexes: " << numHexes << "\n";
+
+    std::cout << "Loading field file: " << hexFieldFile << "\n";
+    ChunkReader fieldReader(hexFieldFile, opts.ioMode,
+                            hexesPerChunk * sizeof(float),
+                            3, opts.hugePages);
+    if (!fieldReader.valid()) {
+      std::cout << "Failed to map field file\n";
+      return false;
+    }
+    std::cout << "File " << hexFieldFile.c_str() << "\n"
+      << "size: " << fieldReader.fileSize() << "\n";
+
+    size_t chunkStart = 0;
+    std::vector<uint64> survivors;
+    size_t hexBytes = 0;
+    size_t fieldBytes = 0;
+    while (keepGoing) {
+      const void *hexChunk = hexReader.next(hexBytes);
+      const void *fieldChunk = fieldReader.next(fieldBytes);
+      if (!hexChunk || !fieldChunk)
+        break;
+      const Hexahedron *hexes = static_cast<const Hexahedron*>(hexChunk);
+      const float *cellField = static_cast<const float*>(fieldChunk);
+      const size_t n = std::min(hexBytes / sizeof(Hexahedron),
+                                fieldBytes / sizeof(float));
+      const uint64 source = firstSource + chunkStart;
+      /* the first hex of the file is skipped, as it always has been; of
+        a partitioned run only the first part's, so later parts keep all
+        of their cells as the other import paths do */
+      const size_t first = source == 0 ? 1 : 0;
+      if (opts.cropBoxes.empty()) {
+        size_t i = first;
+        while (i < n && keepGoing) {
+          keepGoing = queueHex(hexes[i], cellField[i], source + i);
+          ++i;
+        }
+        if (fieldStats)
+          fieldStats->add(cellField + first, hexes + first, i - first);
+      } else {
+        cropHexesParallel(hexes + first, n - first, opts.cropBoxes,
+                          survivors, first);
+        size_t i = 0;
+        while (i < survivors.size() && keepGoing) {
+          keepGoing = queueHex(hexes[survivors[i]], cellField[survivors[i]],
+                               source + survivors[i]);
+          ++i;
+        }
+        if (fieldStats)
+          fieldStats->add(cellField, hexes, survivors.data(), i);
+      }
+      chunkStart += n;
+      report(done + share * chunkStart / numHexes);
+      if (cancel && *cancel)
+        keepGoing = false;
+
+      // re-advise as the output buffers and the dedup map's heap grow
+      mesh.adviseHugePages(opts.hugePages);
+    }
+    return true;
+  };
+
+  const auto scanStart = std::chrono::steady_clock::now();
+
+  if (!partitioned && HexIndex::isIndexedFile(fileName)) {
+    // An indexed container is read level by level, so the field has to be
+    // fully mapped for random access.
+    const HexIndex index = HexIndex::read(fileName);
+    std::cout << "Indexed file " << fileName.c_str() << "\n"
+      << "#hexes: " << index.header.numHexes << "\n";
+
+    std::cout << "Loading field file: " << fieldFile << "\n";
+    MappedField field(fieldFile);
+    if (!field.values) {
+      std::cout << "Failed to map field file\n";
+      return ImportResult();
+    }
+    std::cout << "File " << fieldFile.c_str() << "\n"
+      << "size: " << field.size << "\n";
+
+    uint64 levelsDone = 0;
+    for (const auto &run : index.levels) {
+      if (desiredLevel != -1 && run.level != desiredLevel)
+        continue;
+      if (!addIndexedLevel(index, run.level, field.values, opts, mesh,
+                           fieldStats, cancel))
+        break;
+      levelsDone += run.numHexes;
+      report(0.9f * levelsDone / index.header.numHexes);
+    }
+  } else {
+    // The parts of a partitioned run go through the same serial dedup one
+    // after another, numbered as if their files were concatenated.
+    std::vector<HexPart> parts;
+    if (partitioned) {
+      try {
+        parts = listHexParts(fileName, fieldPrefix);
+      } catch (const std::runtime_error &e) {
+        std::cout << "Failed to list parts: " << e.what() << "\n";
+        return ImportResult();
+      }
+      std::cout << "Partitioned run " << fileName.c_str() << "\n"
+        << "#parts: " << parts.size() << "\n";
+    } else {
+      HexPart part;
+      part.hexFile   = fileName;
+      part.fieldFile = fieldFile;
+      parts.push_back(part);
+    }
+
+    // with a scan of every hex file the per cell buffers are sized up front
+    if (opts.cropBoxes.empty()) {
+      uint64 numCells = 0;
+      bool scanned    = true;
+      for (const auto &part : parts) {
+        HexScan scan;
+        scanned = scanned && HexScan::readSidecar(part.hexFile, scan);
+        numCells += scan.numHexes;
+      }
+      if (scanned) {
+        mesh.reserve(numCells);
+        std::cout << "Presized the mesh for " << numCells
+                  << " cells from the scan sidecars\n";
+      }
+    }
+
+    uint64 firstSource = 0;
+    const float share = 0.9f / parts.size();
+    for (size_t p = 0; p < parts.size() && keepGoing; ++p) {
+      uint64 numHexes = 0;
+      if (!streamHexFile(parts[p].hexFile, parts[p].fieldFile, firstSource,
+                         numHexes, p * share, share))
+        return ImportResult();
+      firstSource += numHexes;
+    }
+  }
+  if (cancel && *cancel)
+    return ImportResult();
+
+  mesh.flush();
+
+  const double scanTime = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - scanStart).count();
+  std::cout << "Imported " << mesh.cellVals.size() << " hexahedrons in "
+    << scanTime << "s (io mode: " << toString(opts.ioMode) << ")\n";
+
+  std::shared_ptr<FieldStream> stream;
+  if (timeSeries) {
+    stream = std::make_shared<FieldStream>(timeSeriesFiles,
+                                           mesh.cellSource,
+                                           opts.ioMode,
+                                           opts.ioChunkBytes,
+                                           opts.hugePages,
+                                           opts.fieldEncoding,
+                                           opts.fieldBlockSize,
+                                           opts.fieldCacheBytes);
+    mesh.cellSource = std::vector<uint64>();
+    stream->prefetch(0);
+    std::cout << "Time series: " << stream->numSteps() << " timesteps\n";
+  }
+  report(1.f);
+
+  //NATHAN: Here is where we create the unstructured volume. This code uses
+  //OSPRay's scene graph functionality. We should probably avoid using OSPRay's
+  //scene graph for now because we are starting out by rendering just one volume.
+  //Furthermore, Will ays that the scene graph is poorly documented (I think
+  //that's what he said?)  
+  const std::string name = fileName.str();
+  const size_t statsBins = opts.fieldStatsBins;
+  return [=](sg::Node &parent) {
+    std::shared_ptr<DataVector1f> cellFieldData;
+    auto jet = createJetVolume(name, *meshData, cellFieldName, &cellFieldData);
+    if (statsBins)
+      attachFieldStats(*jet, *stats, statsBins);
+
+    if (stream) {
+      auto player = createNode("timeSeries", "ExajetTimeSeries")
+                        ->nodeAs<ExajetTimeSeries>();
+      player->child("timestep").setMinMax(0, int(stream->numSteps()) - 1);
+      player->stream = stream;
+      player->field  = cellFieldData;
+      player->volume = jet;
+      jet->add(player);
+    }
+
+    parent.add(jet);
+  };
+}
+
+// World bounds of the unstructured volume, if an indexed file's header or a
+// raw file's scan sidecar has them
+static box3f unstructuredBounds(const FileName &fileName)
+{
+  if (isPartitioned(fileName))
+    return box3f();
+  if (!HexIndex::isIndexedFile(fileName)) {
+    HexScan scan;
+    if (!HexScan::readSidecar(fileName, scan))
+      return box3f();
+    return HexMesh::worldBounds(scan.gridBounds);
+  }
+  HexIndex index;
+  try {
+    index = HexIndex::read(fileName);
+  } catch (const std::runtime_error &) {
+    return box3f();
+  }
+  return HexMesh::worldBounds(
+      box3i(index.header.gridMin, index.header.gridMax));
+}
+
+void importUnstructured(const std::shared_ptr<Node> world, const FileName fileName){
+  ImportOptions opts;
+  if (!readOptions(opts))
+    return;
+
+  const std::string cellFieldName = "y_vorticity.bin";
+  const FileName fieldFile = fileName.path() + cellFieldName;
+
+  if (opts.scan) {
+    importScan(world, fileName, std::vector<FileName>(1, fieldFile), opts);
+    return;
+  }
+
+  if (opts.progressive) {
+    if (!isPartitioned(fileName) && HexIndex::isIndexedFile(fileName)) {
+      importProgressive(world, fileName, fieldFile, cellFieldName, opts);
+      return;
+    }
+    std::cout << "Progressive import needs an indexed hex file (see "
+                 "exajetIndex), loading everything at once\n";
+  }
+
+  auto load = [=](ImportProgress *progress) {
+    return loadUnstructured(fileName, fieldFile, cellFieldName, opts,
+                            progress);
+  };
+  if (opts.async) {
+    importAsync(world, fileName, unstructuredBounds(fileName), load);
+    return;
+  }
+  if (ImportResult loaded = loadNow(load))
+    loaded(*world);
+}
+
+// Imports the aircraft surfaces. 'fileName' is a .vtp file, a directory of
+// them, or ';' separated glob patterns; all files are read in parallel and
+// merged into as few triangle meshes as possible.
+void importSurfaces(const std::shared_ptr<Node> world, const FileName fileName)
+{
+  ImportOptions opts;
+  if (!readOptions(opts))
+    return;
+
+  std::string patterns = fileName.str();
+  struct stat statBuf = {0};
+  if (stat(fileName.c_str(), &statBuf) == 0 && S_ISDIR(statBuf.st_mode))
+    patterns += "/*.vtp";
+  const std::vector<FileName> files = expandFieldFiles(patterns, FileName());
+  if (files.empty())
+    return;
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<SurfaceMesh> meshes = loadSurfaces(files);
+  const double loadTime = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  // The patches share their border vertices; welding them and ordering
+  // the triangles spatially gives the BVH builder a few large, coherent
+  // meshes instead of thousands of fragments.
+  if (opts.surfaceOptimize) {
+    const auto optimizeStart = std::chrono::steady_clock::now();
+    size_t welded = 0;
+    for (auto &mesh : meshes) {
+      welded += weldVertices(mesh);
+      reorderMorton(mesh);
+    }
+    std::cout << "Welded " << welded << " surface vertices and reordered "
+              << "the meshes in "
+              << std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - optimizeStart).count()
+              << "s\n";
+  }
+
+  size_t numTriangles = 0;
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    numTriangles += meshes[m].indices.size();
+
+    auto mesh = createNode("surfaces_" + std::to_string(m), "TriangleMesh")
+                    ->nodeAs<TriangleMesh>();
+
+    auto vertices = std::make_shared<DataVector3f>();
+    vertices->setName("vertex");
+    vertices->v = std::move(meshes[m].vertices);
+
+    auto indices = std::make_shared<DataVector3i>();
+    indices->setName("index");
+    indices->v = std::move(meshes[m].indices);
+
+    mesh->add(vertices);
+    mesh->add(indices);
+    world->add(mesh);
+  }
+
+  std::cout << "Imported " << files.size() << " surface files into "
+            << meshes.size() << " meshes, " << numTriangles
+            << " triangles in " << loadTime << "s\n";
 }
 
 extern "C" OSPRAY_DLLEXPORT void ospray_init_module_exajet_import() {
@@ -395,4 +1634,12 @@ extern "C" OSPRAY_DLLEXPORT void ospray_init_module_exajet_import() {
 
 OSPSG_REGISTER_IMPORT_FUNCTION(importExaJet, bin);
 OSPSG_REGISTER_IMPORT_FUNCTION(importUnstructured, jetunstr);
+OSPSG_REGISTER_IMPORT_FUNCTION(importExaJet, exahex);
+OSPSG_REGISTER_IMPORT_FUNCTION(importExaJet, exaparts);
+OSPSG_REGISTER_IMPORT_FUNCTION(importUnstructured, jetparts);
+OSPSG_REGISTER_IMPORT_FUNCTION(importSurfaces, vtp);
+OSPSG_REGISTER_IMPORT_FUNCTION(importSurfaces, exavtp);
+OSP_REGISTER_SG_NODE(ExajetTimeSeries);
+OSP_REGISTER_SG_NODE(ExajetProgressive);
+OSP_REGISTER_SG_NODE(ExajetAsyncImport);
 
@@ -0,0 +1,32 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#include "../HexFile.h"
+
+using namespace ospray::tamr;
+
+// Converts a raw exajet hexas.bin into the indexed (level sorted) container
+// that the importers can seek into.
+int main(int argc, const char **argv)
+{
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0]
+              << " <hexas.bin> <out.exahex> [hexes per block]\n";
+    return 1;
+  }
+
+  const long blockSize = argc > 3 ? atol(argv[3]) : 1 << 16;
+  if (blockSize <= 0 || blockSize > long(UINT32_MAX)) {
+    std::cerr << "hexes per block must be in 1.." << UINT32_MAX << "\n";
+    return 1;
+  }
+  try {
+    convertHexFile(argv[1], argv[2], blockSize);
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}